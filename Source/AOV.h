@@ -0,0 +1,156 @@
+#pragma once
+
+#include "Utils.h"
+#include "Vec3.h"
+
+namespace Luma {
+
+// The arbitrary output variables (AOVs): values other than the radiance that are recorded for each
+// pixel while rendering, and can be saved as separate images, e.g. for compositing or debugging.
+enum class AOV
+{
+    Albedo,      // The albedo (surface color) of the first hit.
+    Normal,      // The surface normal of the first hit, with components in [-1.0, 1.0].
+    Depth,       // The distance from the camera to the first hit.
+    ObjectID,    // The ID of the first element hit in the pixel (see Hit), or zero for none.
+    SampleCount, // The number of samples taken for the pixel.
+};
+
+// Returns the name of the specified AOV, as used in scene files and output paths.
+inline const char* aovName(AOV aov)
+{
+    static const char* NAMES[] = { "albedo", "normal", "depth", "id", "samples" };
+
+    return NAMES[static_cast<int>(aov)];
+}
+
+// Parses the name of an AOV, returning whether the name was valid.
+inline bool parseAOV(const string& name, AOV& aov)
+{
+    for (AOV candidate : { AOV::Albedo, AOV::Normal, AOV::Depth, AOV::ObjectID, AOV::SampleCount })
+    {
+        if (name == aovName(candidate))
+        {
+            aov = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Returns the number of components of the specified AOV, e.g. three for the albedo.
+inline uint32_t aovComponents(AOV aov)
+{
+    return aov == AOV::Albedo || aov == AOV::Normal ? 3 : 1;
+}
+
+// The AOVs of a sample, from the first surface hit by the camera ray: the albedo, normal, distance
+// (depth), and element ID. Where the ray misses the scene, the albedo is the background radiance
+// and the other values are zero. The albedo, normal and depth are smooth where the radiance is
+// noisy, so they can also guide a denoiser.
+struct AOVSample
+{
+    Vec3 albedo;
+    Vec3 normal;
+    float depth = 0.0f;
+    uint32_t objectID = 0;
+
+    // Adds the values of another sample, e.g. to accumulate the samples of a pixel. IDs can't be
+    // averaged, so the first nonzero ID is kept, i.e. the first element seen in the pixel.
+    AOVSample& operator+=(const AOVSample& other)
+    {
+        albedo += other.albedo;
+        normal += other.normal;
+        depth += other.depth;
+        objectID = objectID != 0 ? objectID : other.objectID;
+
+        return *this;
+    }
+};
+
+// A buffer of the AOVs of each pixel, i.e. the average of the AOVs of its samples, as a separate
+// float plane for each variable. This has the dimensions of the framebuffer, i.e. the rendered
+// region of the image.
+//
+// NOTE: The AOVs are not stored in checkpoints, so they are not available when resuming a render
+// (see main()). The object ID is stored as a float, which is exact for scenes with up to 2^24
+// (about 16 million) elements.
+class AOVBuffer
+{
+public:
+    // Constructor.
+    AOVBuffer(uint32_t width, uint32_t height) : m_width(width), m_height(height)
+    {
+        for (AOV aov : { AOV::Albedo, AOV::Normal, AOV::Depth, AOV::ObjectID, AOV::SampleCount })
+        {
+            m_planes[static_cast<int>(aov)].resize(size_t(width) * height * aovComponents(aov));
+        }
+    }
+
+    // Returns the dimensions of the buffer.
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+
+    // Sets the AOVs of the pixel at the specified position from the sum of the specified number of
+    // samples. The normal is normalized, since the average of unit normals is generally shorter.
+    void set(uint32_t x, uint32_t y, const AOVSample& sum, uint32_t sampleCount)
+    {
+        const size_t index = size_t(y) * m_width + x;
+        const float scale = sampleCount > 0 ? 1.0f / sampleCount : 0.0f;
+        Vec3 normal = sum.normal;
+        if (dot(normal, normal) > 0.0f)
+        {
+            normal.normalize();
+        }
+        setVec3(&getWritablePlane(AOV::Albedo)[index * 3], sum.albedo * scale);
+        setVec3(&getWritablePlane(AOV::Normal)[index * 3], normal);
+        getWritablePlane(AOV::Depth)[index] = sum.depth * scale;
+        getWritablePlane(AOV::ObjectID)[index] = static_cast<float>(sum.objectID);
+    }
+
+    // Sets the total number of samples of the pixel at the specified position.
+    void setSampleCount(uint32_t x, uint32_t y, uint32_t sampleCount)
+    {
+        const size_t index = size_t(y) * m_width + x;
+        getWritablePlane(AOV::SampleCount)[index] = static_cast<float>(sampleCount);
+    }
+
+    // Returns the plane of the specified AOV, in rows from the top, with the number of components
+    // per pixel returned by aovComponents().
+    const float* getPlane(AOV aov) const { return m_planes[static_cast<int>(aov)].data(); }
+
+    // Returns the planes used by the denoiser.
+    const float* albedo() const { return getPlane(AOV::Albedo); }
+    const float* normal() const { return getPlane(AOV::Normal); }
+    const float* depth() const { return getPlane(AOV::Depth); }
+
+    // Clears the buffer, e.g. before rendering another frame.
+    void clear()
+    {
+        for (vector<float>& plane : m_planes)
+        {
+            std::fill(plane.begin(), plane.end(), 0.0f);
+        }
+    }
+
+private:
+    static const int AOV_COUNT = 5;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    vector<float> m_planes[AOV_COUNT];
+
+    // Returns the plane of the specified AOV, for writing.
+    float* getWritablePlane(AOV aov) { return m_planes[static_cast<int>(aov)].data(); }
+
+    // Stores a vector as three floats.
+    static void setVec3(float* pValues, const Vec3& value)
+    {
+        pValues[0] = value.x();
+        pValues[1] = value.y();
+        pValues[2] = value.z();
+    }
+};
+
+} // namespace Luma
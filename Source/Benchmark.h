@@ -0,0 +1,203 @@
+#pragma once
+
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Image.h"
+#include "Renderer.h"
+#include "Resample.h"
+#include "Scene.h"
+#include "SceneGenerator.h"
+
+namespace Luma {
+
+// Runs a scalability benchmark, rendering generated scenes of the specified type with 10, 100, 1000,
+// etc. primitives, up to the specified maximum count. The results are written to the console as CSV
+// lines, so that they can be redirected to a file and the rays per second plotted against the
+// primitive count.
+void benchmarkScenes(SceneType type, size_t maxCount, uint32_t seed)
+{
+    // Use a small image with a single sample per pixel, and render it repeatedly until a minimum
+    // amount of time has passed. This gives stable results for small scenes without making large
+    // scenes take too long.
+    static const double MIN_SECONDS = 1.0;
+    RenderSettings settings;
+    settings.width = 128;
+    settings.height = 72;
+    settings.samples = 1;
+    Framebuffer framebuffer(settings.width, settings.height);
+    Camera camera(settings.aspect());
+
+    std::cout
+        << "# Benchmarking \"" << sceneTypeName(type) << "\" scenes at "
+        << settings.width << "x" << settings.height << " with seed " << seed
+        << " on " << std::thread::hardware_concurrency() << " threads." << std::endl;
+    std::cout << "primitives,build_seconds,rays,render_seconds,rays_per_second" << std::endl;
+
+    for (size_t count = 10; count <= maxCount; count *= 10)
+    {
+        // Generate the scene, recording the time spent.
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Scene scene;
+        generateScene(scene, type, count, seed);
+        auto endTime = std::chrono::high_resolution_clock::now();
+        double buildSeconds = std::chrono::duration<double>(endTime - startTime).count();
+
+        // Render the scene until the minimum time has passed, accumulating the statistics.
+        RenderStats totalStats;
+        while (totalStats.seconds < MIN_SECONDS)
+        {
+            framebuffer.clearSampleCounts();
+            RenderStats stats = render(scene, camera, framebuffer, settings, false);
+            totalStats.rayCount += stats.rayCount;
+            totalStats.seconds += stats.seconds;
+        }
+
+        std::cout
+            << count << "," << buildSeconds << ","
+            << totalStats.rayCount << "," << totalStats.seconds << ","
+            << static_cast<uint64_t>(totalStats.raysPerSecond()) << std::endl;
+    }
+}
+
+// Enlarges an 8-bit RGB image by an integer scale with a simple loop over the destination pixels,
+// copying one pixel at a time on a single thread. This was previously used to enlarge PNG output,
+// and is kept here as the reference for benchmarking Resampler.
+inline void scaleImageLoop(
+    const uint8_t* pSrcData, uint16_t width, uint16_t height, uint8_t scale, uint8_t* pDstData)
+{
+    static const uint8_t NUM_COMPONENTS = 3;
+    uint16_t destWidth = width * scale;
+    uint16_t destHeight = height * scale;
+    uint8_t* pDst = pDstData;
+    for (uint16_t y = 0; y < destHeight; y++)
+    {
+        const uint8_t* pSrc = &pSrcData[(y / scale) * width * NUM_COMPONENTS];
+        for (uint16_t x = 0; x < destWidth; x++)
+        {
+            ::memcpy(pDst, pSrc, NUM_COMPONENTS);
+            pDst += NUM_COMPONENTS;
+            pSrc += (x + 1) % scale == 0 ? NUM_COMPONENTS : 0;
+        }
+    }
+}
+
+// Runs a resampling benchmark, enlarging an image with the default render resolution (480x270) to
+// 4K (3840x2160) and 8K (7680x4320) outputs with the reference loop and each resample filter. The
+// results are written to the console as CSV lines, like benchmarkScenes().
+void benchmarkResampling()
+{
+    // Create a source image with noisy content, which is as good as any for timing.
+    static const double MIN_SECONDS = 1.0;
+    static const uint16_t SRC_WIDTH = 480;
+    static const uint16_t SRC_HEIGHT = 270;
+    vector<uint8_t> source(size_t(SRC_WIDTH) * SRC_HEIGHT * Resampler::NUM_COMPONENTS);
+    uint32_t state = createRandomState(0);
+    for (uint8_t& value : source)
+    {
+        value = static_cast<uint8_t>(randomFloat(state) * 256.0f);
+    }
+
+    std::cout
+        << "# Benchmarking resampling from " << SRC_WIDTH << "x" << SRC_HEIGHT << " on "
+        << std::thread::hardware_concurrency() << " threads." << std::endl;
+    std::cout << "output,method,seconds,megapixels_per_second,speedup" << std::endl;
+
+    for (uint8_t scale : { 8, 16 })
+    {
+        const uint32_t width = SRC_WIDTH * scale;
+        const uint32_t height = SRC_HEIGHT * scale;
+        vector<uint8_t> destination(size_t(width) * height * Resampler::NUM_COMPONENTS);
+
+        // Time each method, running it repeatedly until the minimum time has passed, and report the
+        // average time along with the speedup relative to the reference loop.
+        double loopSeconds = 0.0;
+        for (int method = -1; method <= static_cast<int>(ResampleFilter::Lanczos); method++)
+        {
+            ResampleFilter filter = static_cast<ResampleFilter>(std::max(method, 0));
+            Resampler resampler(SRC_WIDTH, SRC_HEIGHT, width, height, filter);
+            double totalSeconds = 0.0;
+            int runCount = 0;
+            while (totalSeconds < MIN_SECONDS)
+            {
+                auto startTime = std::chrono::high_resolution_clock::now();
+                if (method < 0)
+                {
+                    scaleImageLoop(source.data(), SRC_WIDTH, SRC_HEIGHT, scale, destination.data());
+                }
+                else
+                {
+                    resampler.resample(source.data(), destination.data());
+                }
+                auto endTime = std::chrono::high_resolution_clock::now();
+                totalSeconds += std::chrono::duration<double>(endTime - startTime).count();
+                runCount++;
+            }
+
+            double seconds = totalSeconds / runCount;
+            loopSeconds = method < 0 ? seconds : loopSeconds;
+            std::cout
+                << width << "x" << height << ","
+                << (method < 0 ? "loop" : resampleFilterName(filter)) << "," << seconds << ","
+                << width * height / seconds / 1.0e6 << "," << loopSeconds / seconds << std::endl;
+        }
+    }
+}
+
+// Runs a PNG writing benchmark, saving 4K (3840x2160) and 16K (15360x8640) images with
+// stb_image_write and with PNGWriter (through Image::savePNG), and writing the time and file size
+// for each as CSV lines. The images are enlarged from a render of the default scene with the
+// Lanczos filter, so that they have realistic content: smooth gradients with some noise.
+void benchmarkPNG()
+{
+    // Render the default scene at a low resolution.
+    RenderSettings settings;
+    settings.samples = 4;
+    Scene scene;
+    scene.addSphere(Vec3(0.0f, 0.0f, -1.0f), 0.5f);
+    scene.addSphere(Vec3(0.0f, -100.5f, -1.0f), 100.0f);
+    Framebuffer framebuffer(settings.width, settings.height);
+    render(scene, Camera(settings.aspect()), framebuffer, settings, false);
+    Image source(settings.width, settings.height);
+    source.setFromFramebuffer(framebuffer);
+
+    std::cout
+        << "# Benchmarking PNG writing on " << std::thread::hardware_concurrency() << " threads."
+        << std::endl;
+    std::cout << "output,writer,seconds,megapixels_per_second,bytes" << std::endl;
+
+    static const char* FILE_PATH = "benchmark.png";
+    for (uint32_t scale : { 8, 32 })
+    {
+        const uint32_t width = settings.width * scale;
+        const uint32_t height = settings.height * scale;
+        Image image(width, height);
+        Resampler resampler(
+            settings.width, settings.height, width, height, ResampleFilter::Lanczos);
+        resampler.resample(source.getImageData(), image.getImageData());
+
+        for (int writer = 0; writer < 2; writer++)
+        {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            if (writer == 0)
+            {
+                ::stbi_write_png(FILE_PATH, width, height, Resampler::NUM_COMPONENTS,
+                    image.getImageData(), width * Resampler::NUM_COMPONENTS);
+            }
+            else
+            {
+                image.savePNG(FILE_PATH);
+            }
+            auto endTime = std::chrono::high_resolution_clock::now();
+            double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+            std::ifstream file(FILE_PATH, std::ios::binary | std::ios::ate);
+            std::cout
+                << width << "x" << height << "," << (writer == 0 ? "stb" : "luma") << ","
+                << seconds << "," << double(width) * height / seconds / 1.0e6 << ","
+                << file.tellg() << std::endl;
+        }
+    }
+    std::remove(FILE_PATH);
+}
+
+} // namespace Luma
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "Scene.h"
+#include "Sphere.h"
+
+#include <fstream>
+
+namespace Luma {
+
+// The header at the start of a binary scene file.
+//
+// The file layout is the header, followed by a table of sections, followed by the data for each
+// section. The data for each section starts at an offset that is a multiple of SECTION_ALIGNMENT,
+// so that it can be used directly (i.e. without copying) when the file is memory mapped. All values
+// are little-endian, matching the platforms Luma runs on.
+struct BinarySceneHeader
+{
+    // The identifier for binary scene files, at the start of every file.
+    static constexpr char MAGIC[8] = { 'L', 'U', 'M', 'A', 'S', 'C', 'N', '\0' };
+
+    // The current version of the file layout. This is incremented when the layout changes in a way
+    // that older code can't read, i.e. not when adding a new section type.
+    static const uint32_t VERSION = 1;
+
+    // The alignment of section data in the file, in bytes: the size of a cache line.
+    static const uint64_t SECTION_ALIGNMENT = 64;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    uint8_t reserved[48];
+};
+static_assert(sizeof(BinarySceneHeader) == 64, "The binary scene header must be 64 bytes.");
+
+// The types of sections in a binary scene file. Sections of unknown types are ignored when loading,
+// so that new types can be added without changing the version.
+enum class BinarySectionType : uint32_t
+{
+    Spheres = 1, // An array of SphereData.
+};
+
+// An entry in the section table of a binary scene file, describing an array of elements.
+struct BinarySceneSection
+{
+    BinarySectionType type;
+    uint32_t elementSize;
+    uint64_t offset;
+    uint64_t count;
+    uint8_t reserved[8];
+};
+static_assert(sizeof(BinarySceneSection) == 32, "A binary scene section must be 32 bytes.");
+
+// Loads and saves binary scene files. Unlike scene description files (see SceneParser.h), these
+// contain only scene geometry, in a form that can be used by a scene directly: loading maps the file
+// into memory and the scene uses the arrays in the file as its storage, with no per-element parsing,
+// copying, or allocation.
+class BinaryScene
+{
+public:
+    // Returns whether the file at the specified path is a binary scene file, i.e. it starts with
+    // the binary scene identifier.
+    static bool isBinarySceneFile(const string& filePath)
+    {
+        char magic[sizeof(BinarySceneHeader::MAGIC)] = {};
+        std::ifstream file(filePath, std::ios::binary);
+        file.read(magic, sizeof(magic));
+
+        return file && ::memcmp(magic, BinarySceneHeader::MAGIC, sizeof(magic)) == 0;
+    }
+
+    // Loads the binary scene file at the specified path, adding its elements to the scene. Returns
+    // whether the file was loaded successfully; if not, error() describes the problem.
+    bool load(const string& filePath, Scene& scene)
+    {
+        m_error.clear();
+
+        // Map the file into memory.
+        shared_ptr<MappedFile> pFile = MappedFile::openRead(filePath);
+        if (!pFile)
+        {
+            return fail("Unable to open \"" + filePath + "\".");
+        }
+
+        // Validate the header and the section table.
+        const uint8_t* pData = pFile->data();
+        const size_t fileSize = pFile->size();
+        const BinarySceneHeader* pHeader = reinterpret_cast<const BinarySceneHeader*>(pData);
+        if (fileSize < sizeof(BinarySceneHeader)
+            || ::memcmp(pHeader->magic, BinarySceneHeader::MAGIC, sizeof(pHeader->magic)) != 0)
+        {
+            return fail("\"" + filePath + "\" is not a binary scene file.");
+        }
+        if (pHeader->version != BinarySceneHeader::VERSION)
+        {
+            return fail("\"" + filePath + "\" has unsupported version "
+                + std::to_string(pHeader->version) + ".");
+        }
+        const uint64_t tableSize = pHeader->sectionCount * sizeof(BinarySceneSection);
+        if (tableSize > fileSize - sizeof(BinarySceneHeader))
+        {
+            return fail("\"" + filePath + "\" has an invalid section table.");
+        }
+
+        // Hand each known section to the scene, after checking that it lies within the file and is
+        // properly aligned.
+        const BinarySceneSection* pSections =
+            reinterpret_cast<const BinarySceneSection*>(pData + sizeof(BinarySceneHeader));
+        for (uint32_t i = 0; i < pHeader->sectionCount; i++)
+        {
+            const BinarySceneSection& section = pSections[i];
+            if (section.type != BinarySectionType::Spheres)
+            {
+                continue;
+            }
+
+            if (section.elementSize != sizeof(SphereData)
+                || section.offset % BinarySceneHeader::SECTION_ALIGNMENT != 0
+                || section.offset > fileSize
+                || section.count > (fileSize - section.offset) / sizeof(SphereData))
+            {
+                return fail("\"" + filePath + "\" has an invalid sphere section.");
+            }
+
+            const SphereData* pSpheres =
+                reinterpret_cast<const SphereData*>(pData + section.offset);
+            scene.addSpheres(pSpheres, static_cast<size_t>(section.count), pFile);
+        }
+
+        return true;
+    }
+
+    // Saves the geometry of the scene to a binary scene file at the specified path. Returns whether
+    // the file was saved successfully; if not, error() describes the problem.
+    //
+    // NOTE: Binary scene files only store spheres, so a scene with any other elements (e.g. lights)
+    // is not saved, rather than saving a file that would render differently.
+    bool save(const string& filePath, const Scene& scene)
+    {
+        m_error.clear();
+        if (scene.size() != scene.sphereCount())
+        {
+            return fail("The scene has elements other than spheres (e.g. lights), which binary "
+                "scene files can't store.");
+        }
+
+        std::ofstream file(filePath, std::ios::binary);
+        if (!file)
+        {
+            return fail("Unable to create \"" + filePath + "\".");
+        }
+
+        // Write the header.
+        BinarySceneHeader header = {};
+        ::memcpy(header.magic, BinarySceneHeader::MAGIC, sizeof(header.magic));
+        header.version = BinarySceneHeader::VERSION;
+        header.sectionCount = 1;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        // Write the section table, with the section data following it at an aligned offset.
+        uint64_t tableEnd = sizeof(header) + header.sectionCount * sizeof(BinarySceneSection);
+        BinarySceneSection spheres = {};
+        spheres.type = BinarySectionType::Spheres;
+        spheres.elementSize = sizeof(SphereData);
+        spheres.offset = alignOffset(tableEnd);
+        spheres.count = scene.sphereCount();
+        file.write(reinterpret_cast<const char*>(&spheres), sizeof(spheres));
+
+        // Write padding up to the aligned offset, and then the section data.
+        static const char PADDING[BinarySceneHeader::SECTION_ALIGNMENT] = {};
+        file.write(PADDING, spheres.offset - tableEnd);
+        file.write(reinterpret_cast<const char*>(scene.spheres()),
+            scene.sphereCount() * sizeof(SphereData));
+
+        if (!file)
+        {
+            return fail("Unable to write \"" + filePath + "\".");
+        }
+
+        return true;
+    }
+
+    // Returns a description of the error from the last call to load() or save(), if any.
+    const string& error() const { return m_error; }
+
+private:
+    string m_error;
+
+    // Records the specified error, and returns false for convenience.
+    bool fail(const string& error)
+    {
+        m_error = error;
+
+        return false;
+    }
+
+    // Rounds the specified file offset up to the section alignment.
+    static uint64_t alignOffset(uint64_t offset)
+    {
+        const uint64_t alignment = BinarySceneHeader::SECTION_ALIGNMENT;
+
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+};
+
+} // namespace Luma
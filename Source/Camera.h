@@ -1,41 +1,217 @@
 #pragma once
 
 #include "Ray.h"
+#include "RayBuffer.h"
 #include "Vec3.h"
 
+#include <emmintrin.h>
+
 namespace Luma {
 
-// A camera for generating primary rays for rendering.
+// The properties of a camera. The defaults are a pinhole camera at the origin facing the -Z axis,
+// with a vertical field of view of 90 degrees.
+struct CameraSettings
+{
+    // The position of the camera (the eye), the point it looks at, and the up direction, which must
+    // not be parallel to the view direction.
+    Vec3 position = Vec3(0.0f, 0.0f, 0.0f);
+    Vec3 lookAt = Vec3(0.0f, 0.0f, -1.0f);
+    Vec3 up = Vec3(0.0f, 1.0f, 0.0f);
+
+    // The vertical field of view, in degrees.
+    float verticalFOV = 90.0f;
+
+    // The diameter of the lens (the aperture), for depth of field, or zero for a pinhole camera
+    // with everything in focus. This is in scene units, like the focus distance.
+    float aperture = 0.0f;
+
+    // The distance from the camera to the plane in focus, or zero to focus on the look-at point.
+    float focusDistance = 0.0f;
+
+    // Returns whether the settings define a valid camera, i.e. a view direction that is not zero
+    // or parallel to the up direction, a field of view between 0 and 180 degrees, and a lens
+    // that is not negative.
+    bool isValid() const
+    {
+        const Vec3 forward = lookAt - position;
+        const Vec3 side = cross(forward, up);
+
+        return dot(forward, forward) > 0.0f && dot(side, side) > 0.0f
+            && verticalFOV > 0.0f && verticalFOV < 180.0f
+            && aperture >= 0.0f && focusDistance >= 0.0f;
+    }
+};
+
+// A camera for generating primary rays for rendering: a pinhole camera, or a thin lens camera with
+// depth of field if the settings have an aperture.
+//
+// NOTE: The camera basis and the image plane are computed once in the constructor, so generating a
+// ray only needs a few multiply-adds and a normalization. The image plane is one unit in front of
+// the camera, with its lower left corner at the start vector and its edges along the horizontal
+// and vertical vectors. For a thin lens, the same plane is also stored scaled to the focus
+// distance (the focus plane), so a lens ray only adds the offset on the lens to a pinhole ray.
 class Camera
 {
 public:
-    // Constructor.
-    Camera(float aspect) : m_aspect(aspect) {}
+    // Constructor, with the specified settings and the aspect ratio of the image.
+    Camera(const CameraSettings& settings, float aspect) : m_origin(settings.position)
+    {
+        assert(settings.isValid());
+
+        // Compute an orthonormal basis for the camera: the view (forward) direction, and the right
+        // and up directions of the image.
+        Vec3 forward = settings.lookAt - settings.position;
+        forward.normalize();
+        Vec3 right = cross(forward, settings.up);
+        right.normalize();
+        const Vec3 up = cross(right, forward);
+
+        // Compute the image plane from the field of view.
+        //
+        // NOTE: The tangent is computed with double precision, so that the default 90 degree field
+        // of view gives exactly a half height of one.
+        const float halfHeight =
+            static_cast<float>(std::tan(settings.verticalFOV * M_PI / 360.0));
+        const float halfWidth = aspect * halfHeight;
+        m_start = forward - right * halfWidth - up * halfHeight;
+        m_horizontal = right * (2.0f * halfWidth);
+        m_vertical = up * (2.0f * halfHeight);
+
+        // Compute the lens, with axes along the image axes, and the focus plane.
+        const float lensRadius = 0.5f * settings.aperture;
+        const float focusDistance = settings.focusDistance > 0.0f
+            ? settings.focusDistance : (settings.lookAt - settings.position).length();
+        m_hasLens = lensRadius > 0.0f;
+        m_lensRight = right * lensRadius;
+        m_lensUp = up * lensRadius;
+        m_focusStart = m_start * focusDistance;
+        m_focusHorizontal = m_horizontal * focusDistance;
+        m_focusVertical = m_vertical * focusDistance;
+    }
+
+    // Constructor, for the default settings and the specified aspect ratio of the image.
+    Camera(float aspect) : Camera(CameraSettings(), aspect) {}
 
     // Computes a ray from the camera with the specified U (horizontal) and V (vertical) offsets in
-    // the camera image plane.
+    // the camera image plane, from zero to one.
     Ray getRay(float u, float v) const
     {
-        // Define the camera with an eye position at the origin, and facing the -Z axis.
-        // TODO: The camera is currently hardcoded, but will later support standard properties.
-        static Vec3 origin(0.0f, 0.0f, 0.0f);
-        static Vec3 start(-m_aspect, -1.0f, -1.0f);
-        static float viewWidth = m_aspect * 2.0f;
-        static float viewHeight = 2.0f;
-
         // Prepare a ray direction offset from the start (lower left) corner of the image plane.
-        Vec3 direction(
-            start.x() + u * viewWidth,
-            start.y() + v * viewHeight,
-            start.z());
+        Vec3 direction = m_start + m_horizontal * u + m_vertical * v;
         direction.normalize();
-        
+
         // Return a ray with the direction and the camera's origin.
-        return Ray(origin, direction);
+        return Ray(m_origin, direction);
+    }
+
+    // Returns whether the camera has a lens, i.e. whether rays need a lens position.
+    bool hasLens() const { return m_hasLens; }
+
+    // Computes a ray from the camera with the specified U (horizontal) and V (vertical) offsets in
+    // the camera image plane, from zero to one, through the specified position on the lens, in
+    // the unit disk (e.g. from sampleDisk()). This is only needed if the camera has a lens.
+    Ray getRay(float u, float v, float lensX, float lensY) const
+    {
+        // Start the ray at the position on the lens, and aim it at the point on the focus plane
+        // that a ray through the center of the lens would reach, so that the point is in focus.
+        const Vec3 offset = m_lensRight * lensX + m_lensUp * lensY;
+        Vec3 direction = m_focusStart + m_focusHorizontal * u + m_focusVertical * v - offset;
+        direction.normalize();
+
+        return Ray(m_origin + offset, direction);
+    }
+
+    // Computes the specified number of rays from the camera, like getRay(), with the U and V
+    // offsets in the specified arrays, and the lens positions in the specified arrays if the camera
+    // has a lens (otherwise they can be null). The rays are stored in the specified buffer, from
+    // the specified index.
+    //
+    // NOTE: The rays are computed four at a time with SSE2, with each lane computing a ray. The
+    // operations are the same as in getRay(), in the same order, so the rays are exactly the same.
+    void getRays(const float* pU, const float* pV, const float* pLensX, const float* pLensY,
+        size_t count, RayBuffer& rays, size_t first) const
+    {
+        assert(!m_hasLens || (pLensX && pLensY));
+        assert(first + count <= rays.size());
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 u = _mm_loadu_ps(pU + i);
+            const __m128 v = _mm_loadu_ps(pV + i);
+            __m128 origin[3];
+            __m128 direction[3];
+            if (m_hasLens)
+            {
+                // Offset the origin by the position on the lens, and aim at the focus plane.
+                const __m128 lensX = _mm_loadu_ps(pLensX + i);
+                const __m128 lensY = _mm_loadu_ps(pLensY + i);
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    const __m128 offset = _mm_add_ps(
+                        _mm_mul_ps(splat(m_lensRight, axis), lensX),
+                        _mm_mul_ps(splat(m_lensUp, axis), lensY));
+                    direction[axis] = _mm_sub_ps(planePoint(m_focusStart, m_focusHorizontal,
+                        m_focusVertical, axis, u, v), offset);
+                    origin[axis] = _mm_add_ps(splat(m_origin, axis), offset);
+                }
+            }
+            else
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    direction[axis] = planePoint(m_start, m_horizontal, m_vertical, axis, u, v);
+                    origin[axis] = splat(m_origin, axis);
+                }
+            }
+
+            // Normalize the directions, and store the rays.
+            const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(direction[0], direction[0]), _mm_mul_ps(direction[1], direction[1])),
+                _mm_mul_ps(direction[2], direction[2])));
+            for (int axis = 0; axis < 3; axis++)
+            {
+                _mm_storeu_ps(rays.origin(axis) + first + i, origin[axis]);
+                _mm_storeu_ps(
+                    rays.direction(axis) + first + i, _mm_div_ps(direction[axis], length));
+            }
+        }
+
+        // Compute any remaining rays individually.
+        for (; i < count; i++)
+        {
+            rays.setRay(first + i,
+                m_hasLens ? getRay(pU[i], pV[i], pLensX[i], pLensY[i]) : getRay(pU[i], pV[i]));
+        }
     }
 
 private:
-    float m_aspect;
+    Vec3 m_origin;
+    Vec3 m_start;
+    Vec3 m_horizontal;
+    Vec3 m_vertical;
+    bool m_hasLens;
+    Vec3 m_lensRight;
+    Vec3 m_lensUp;
+    Vec3 m_focusStart;
+    Vec3 m_focusHorizontal;
+    Vec3 m_focusVertical;
+
+    // Returns a SIMD value with the specified component of the specified vector in each lane.
+    static __m128 splat(const Vec3& vector, int axis)
+    {
+        return _mm_set1_ps(axis == 0 ? vector.x() : axis == 1 ? vector.y() : vector.z());
+    }
+
+    // Returns the specified component of the points on the plane with the specified start
+    // (corner) and edges, at the specified U and V offsets, i.e. start + horizontal * u +
+    // vertical * v.
+    static __m128 planePoint(const Vec3& start, const Vec3& horizontal, const Vec3& vertical,
+        int axis, __m128 u, __m128 v)
+    {
+        return _mm_add_ps(_mm_add_ps(splat(start, axis), _mm_mul_ps(splat(horizontal, axis), u)),
+            _mm_mul_ps(splat(vertical, axis), v));
+    }
 };
 
 } // namespace Luma
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "Framebuffer.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Trace.h"
+
+#include <condition_variable>
+#include <fstream>
+
+namespace Luma {
+
+// The header at the start of a checkpoint file.
+//
+// The file layout is the header, followed by the sample count of every pixel (32-bit), followed by
+// the radiance of every pixel (three 32-bit floats), both in the order used by Framebuffer, for the
+// rendered region of the image. All values are little-endian, matching the platforms Luma runs on.
+struct CheckpointHeader
+{
+    // The identifier for checkpoint files, at the start of every file.
+    static constexpr char MAGIC[8] = { 'L', 'U', 'M', 'A', 'C', 'K', 'P', '\0' };
+
+    // The current version of the file layout.
+    static const uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t cropX;
+    uint32_t cropY;
+    uint32_t cropWidth;
+    uint32_t cropHeight;
+    int32_t maxDepth;
+    uint64_t sceneHash;
+    uint32_t frame;
+    uint8_t reserved[12];
+};
+static_assert(sizeof(CheckpointHeader) == 64, "The checkpoint header must be 64 bytes.");
+
+// Returns a hash of the geometry of the scene and the camera settings, which is stored in
+// checkpoints to make sure that a render is continued with the same scene and view.
+//
+// NOTE: This is the 64-bit FNV-1a hash of the sphere data, the camera settings, and the lights.
+// Hashing is done once per render, and takes a fraction of the time needed to load or generate the
+// spheres.
+inline uint64_t computeSceneHash(const Scene& scene, const CameraSettings& camera)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto addData = [&hash](const void* pData, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ static_cast<const uint8_t*>(pData)[i]) * 0x100000001B3ull;
+        }
+    };
+    addData(scene.spheres(), scene.sphereCount() * sizeof(SphereData));
+    const float cameraData[] =
+    {
+        camera.position.x(), camera.position.y(), camera.position.z(),
+        camera.lookAt.x(), camera.lookAt.y(), camera.lookAt.z(),
+        camera.up.x(), camera.up.y(), camera.up.z(),
+        camera.verticalFOV, camera.aperture, camera.focusDistance
+    };
+    addData(cameraData, sizeof(cameraData));
+    vector<float> lightData;
+    for (const shared_ptr<Light>& pLight : scene.lights())
+    {
+        pLight->getParameters(lightData);
+    }
+    addData(lightData.data(), lightData.size() * sizeof(float));
+
+    return hash ^ scene.size();
+}
+
+// Saves and loads render checkpoints: the state of a partially rendered framebuffer, so that a
+// render that is interrupted (e.g. a crash, or a preempted machine) can be continued later instead
+// of starting over. A checkpoint stores the radiance and sample count of every pixel. No other
+// sampler state is needed, since the samples of each pixel are determined by the pixel index and
+// sample index (see PixelSampler), so continuing a render gives exactly the same image as rendering
+// it without interruption.
+class Checkpoint
+{
+public:
+    // Constructor, for checkpoints of renders with the image dimensions, crop window, maximum
+    // depth, and frame number of the specified settings, and the specified scene hash. A checkpoint
+    // can only be loaded for a render with the same values.
+    Checkpoint(const RenderSettings& settings, uint64_t sceneHash)
+    {
+        ::memset(&m_header, 0, sizeof(m_header));
+        ::memcpy(m_header.magic, CheckpointHeader::MAGIC, sizeof(m_header.magic));
+        m_header.version = CheckpointHeader::VERSION;
+        m_header.width = settings.width;
+        m_header.height = settings.height;
+        m_header.cropX = settings.isCropped() ? settings.cropX : 0;
+        m_header.cropY = settings.isCropped() ? settings.cropY : 0;
+        m_header.cropWidth = settings.renderWidth();
+        m_header.cropHeight = settings.renderHeight();
+        m_header.maxDepth = settings.maxDepth;
+        m_header.sceneHash = sceneHash;
+        m_header.frame = settings.frame;
+    }
+
+    // Saves a checkpoint of the specified framebuffer, which may be in the middle of rendering, to
+    // the specified path. Returns whether the file was saved successfully; if not, error()
+    // describes the problem.
+    //
+    // NOTE: The framebuffer is copied and written one row of tiles at a time (see
+    // Framebuffer::snapshot()), so rendering only pauses briefly for each row, and the memory used
+    // is that of a row of tiles, not the whole image, which may be far larger than memory if the
+    // framebuffer is stored in a file. The checkpoint is written to a temporary file which then
+    // replaces any existing file, so that there is always a complete checkpoint on disk, even if
+    // the process is terminated while writing.
+    bool save(const string& filePath, const Framebuffer& framebuffer)
+    {
+        m_error.clear();
+        assert(framebuffer.width() == m_header.cropWidth);
+        assert(framebuffer.height() == m_header.cropHeight);
+
+        const string tempPath = filePath + ".tmp";
+        {
+            // Write the sample counts and radiance of each row of tiles at their offsets in the
+            // file, after the header.
+            std::ofstream file(tempPath, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+            const uint64_t width = framebuffer.width();
+            const uint64_t radianceOffset =
+                sizeof(m_header) + width * framebuffer.height() * sizeof(uint32_t);
+            vector<float> radiance;
+            vector<uint32_t> sampleCounts;
+            for (uint32_t y = 0; y < framebuffer.height() && file; y += Framebuffer::TILE_SIZE)
+            {
+                const uint32_t rowCount =
+                    std::min(Framebuffer::TILE_SIZE, framebuffer.height() - y);
+                framebuffer.snapshot(y, rowCount, radiance, sampleCounts);
+                file.seekp(sizeof(m_header) + y * width * sizeof(uint32_t));
+                file.write(reinterpret_cast<const char*>(sampleCounts.data()),
+                    sampleCounts.size() * sizeof(uint32_t));
+                file.seekp(radianceOffset
+                    + y * width * Framebuffer::NUM_COMPONENTS * sizeof(float));
+                file.write(reinterpret_cast<const char*>(radiance.data()),
+                    radiance.size() * sizeof(float));
+            }
+            file.flush();
+            if (!file)
+            {
+                return fail("Unable to write \"" + tempPath + "\".");
+            }
+        }
+
+        if (!::MoveFileExA(tempPath.c_str(), filePath.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            return fail("Unable to replace \"" + filePath + "\".");
+        }
+
+        return true;
+    }
+
+    // Loads the checkpoint at the specified path into the framebuffer, which must have the
+    // dimensions of the checkpoint. Returns whether the checkpoint was loaded successfully; if
+    // not, error() describes the problem.
+    bool load(const string& filePath, Framebuffer& framebuffer)
+    {
+        m_error.clear();
+        assert(framebuffer.width() == m_header.cropWidth);
+        assert(framebuffer.height() == m_header.cropHeight);
+
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file)
+        {
+            return fail("Unable to open \"" + filePath + "\".");
+        }
+
+        // Validate the header against the current render.
+        CheckpointHeader header = {};
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!file || ::memcmp(header.magic, CheckpointHeader::MAGIC, sizeof(header.magic)) != 0)
+        {
+            return fail("\"" + filePath + "\" is not a checkpoint file.");
+        }
+        if (header.version != CheckpointHeader::VERSION)
+        {
+            return fail("\"" + filePath + "\" has unsupported version "
+                + std::to_string(header.version) + ".");
+        }
+        if (header.width != m_header.width || header.height != m_header.height
+            || header.cropX != m_header.cropX || header.cropY != m_header.cropY
+            || header.cropWidth != m_header.cropWidth || header.cropHeight != m_header.cropHeight
+            || header.maxDepth != m_header.maxDepth || header.frame != m_header.frame)
+        {
+            return fail("\"" + filePath + "\" has different render settings.");
+        }
+        if (header.sceneHash != m_header.sceneHash)
+        {
+            return fail("\"" + filePath + "\" is for a different scene.");
+        }
+
+        // Read the sample counts and radiance directly into the framebuffer.
+        const uint64_t pixelCount = uint64_t(m_header.cropWidth) * m_header.cropHeight;
+        file.read(reinterpret_cast<char*>(framebuffer.getSampleCounts()),
+            pixelCount * sizeof(uint32_t));
+        file.read(reinterpret_cast<char*>(framebuffer.getData()),
+            pixelCount * Framebuffer::NUM_COMPONENTS * sizeof(float));
+        if (!file)
+        {
+            framebuffer.clearSampleCounts();
+            return fail("\"" + filePath + "\" is incomplete.");
+        }
+
+        return true;
+    }
+
+    // Returns a description of the error from the last call to save() or load(), if any.
+    const string& error() const { return m_error; }
+
+private:
+    CheckpointHeader m_header;
+    string m_error;
+
+    // Records the specified error message, returning false for convenience.
+    bool fail(const string& message)
+    {
+        m_error = message;
+
+        return false;
+    }
+};
+
+// Saves checkpoints of a framebuffer periodically while it is being rendered, on a background
+// thread. Checkpoints are saved from the time the writer is created until stop() is called.
+//
+// NOTE: Rendering only pauses while each row of tiles is copied (see Checkpoint::save()), which is
+// limited by memory bandwidth, and not while the copy is written to disk.
+class CheckpointWriter
+{
+public:
+    // Constructor, which starts saving checkpoints of the framebuffer to the specified path with
+    // the specified interval.
+    CheckpointWriter(const Checkpoint& checkpoint, const string& filePath, double intervalSeconds,
+        const Framebuffer& framebuffer) :
+        m_checkpoint(checkpoint), m_filePath(filePath), m_framebuffer(framebuffer)
+    {
+        m_thread = std::thread([this, intervalSeconds]()
+        {
+            Tracer::setThreadName("Checkpoint");
+            const auto interval = std::chrono::duration<double>(intervalSeconds);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_condition.wait_for(lock, interval, [this]() { return m_stopped; }))
+            {
+                // Save the checkpoint without holding the lock, so that stop() is not blocked.
+                lock.unlock();
+                save();
+                lock.lock();
+            }
+        });
+    }
+
+    // Destructor.
+    ~CheckpointWriter() { stop(); }
+
+    // Stops saving checkpoints, waiting for any checkpoint being saved to finish.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_condition.notify_one();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    // Returns the number of checkpoints saved.
+    uint32_t savedCount() const { return m_savedCount; }
+
+private:
+    Checkpoint m_checkpoint;
+    string m_filePath;
+    const Framebuffer& m_framebuffer;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopped = false;
+    std::atomic<uint32_t> m_savedCount{ 0 };
+
+    // Saves a checkpoint of the current state of the framebuffer.
+    //
+    // NOTE: A failure is reported but does not stop rendering, since the next checkpoint may
+    // succeed, e.g. if disk space is freed.
+    void save()
+    {
+        TraceScope scope("Save checkpoint");
+        if (m_checkpoint.save(m_filePath, m_framebuffer))
+        {
+            m_savedCount++;
+        }
+        else
+        {
+            std::cerr << std::endl << m_checkpoint.error() << std::endl;
+        }
+    }
+
+    // Copying is not supported, since the thread refers to the object.
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+};
+
+} // namespace Luma
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <emmintrin.h>
+
+namespace Luma {
+
+// The encodings (transfer functions) that can be used to convert linear color values to and from
+// the nonlinear values stored in 8-bit images.
+enum class ColorEncoding
+{
+    Gamma22, // A pure power function with a gamma of 2.2, which approximates sRGB.
+    sRGB,    // The exact sRGB transfer function: a linear segment near black and a 2.4 power curve.
+};
+
+// Returns the name of the specified color encoding, as used in scene files.
+inline const char* colorEncodingName(ColorEncoding encoding)
+{
+    return encoding == ColorEncoding::sRGB ? "srgb" : "gamma";
+}
+
+// Parses the name of a color encoding, returning whether the name was valid.
+inline bool parseColorEncoding(const string& name, ColorEncoding& encoding)
+{
+    for (ColorEncoding candidate : { ColorEncoding::Gamma22, ColorEncoding::sRGB })
+    {
+        if (name == colorEncodingName(candidate))
+        {
+            encoding = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Encodes a linear value with the specified encoding, i.e. applies gamma correction.
+inline float encodeColor(float value, ColorEncoding encoding)
+{
+    if (encoding == ColorEncoding::Gamma22)
+    {
+        return std::pow(value, 1.0f / 2.2f);
+    }
+
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Decodes an encoded value with the specified encoding, giving a linear value.
+inline float decodeColor(float value, ColorEncoding encoding)
+{
+    if (encoding == ColorEncoding::Gamma22)
+    {
+        return std::pow(value, 2.2f);
+    }
+
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// Converts whole buffers of color components between linear floating-point values and encoded 8-bit
+// values, using lookup tables instead of evaluating a power function for every component. Use get()
+// to access the converter for an encoding.
+//
+// NOTE: Encoding fuses the transfer function, clamping, and quantization into a single lookup. The
+// table is indexed by the exponent and the top mantissa bits of the (clamped) float value, so its
+// buckets are narrow near black where the curves are steep. Each bucket is narrow enough to contain
+// at most one boundary between 8-bit values, so each entry stores the 8-bit value at the start of
+// the bucket and the threshold where the next value starts; a single comparison then gives the exact
+// result. This matches evaluating the transfer function, clamping to [0, 1], and scaling by 255.99
+// for every input, including negative and NaN values (which give zero). The clamping and index
+// computations are done four components at a time with SSE2.
+class ColorConverter
+{
+public:
+    // Returns the converter for the specified encoding, which is created on first use.
+    static const ColorConverter& get(ColorEncoding encoding)
+    {
+        static const ColorConverter GAMMA22(ColorEncoding::Gamma22);
+        static const ColorConverter SRGB(ColorEncoding::sRGB);
+
+        return encoding == ColorEncoding::sRGB ? SRGB : GAMMA22;
+    }
+
+    // Encodes, clamps, and quantizes the specified number of linear components to 8-bit values.
+    void encode(const float* pSrc, uint8_t* pDst, size_t count) const
+    {
+        const __m128 minValue = _mm_set1_ps(MIN_VALUE);
+        const __m128 maxValue = _mm_set1_ps(1.0f);
+        const __m128i minBits = _mm_set1_epi32(MIN_BITS);
+        alignas(16) float values[4];
+        alignas(16) int32_t indices[4];
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            // Clamp the values (NaN gives the minimum), and compute their table indices.
+            __m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pSrc + i), minValue), maxValue);
+            __m128i index = _mm_srli_epi32(
+                _mm_sub_epi32(_mm_castps_si128(value), minBits), MANTISSA_SHIFT);
+            _mm_store_ps(values, value);
+            _mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+
+            for (int j = 0; j < 4; j++)
+            {
+                pDst[i + j] = lookup(values[j], indices[j]);
+            }
+        }
+        for (; i < count; i++)
+        {
+            pDst[i] = encode(pSrc[i]);
+        }
+    }
+
+    // Encodes, clamps, and quantizes a single linear component to an 8-bit value.
+    uint8_t encode(float value) const
+    {
+        // NOTE: The comparisons are written so that NaN gives the minimum value.
+        value = value > MIN_VALUE ? (value < 1.0f ? value : 1.0f) : MIN_VALUE;
+        int32_t bits = 0;
+        ::memcpy(&bits, &value, sizeof(bits));
+
+        return lookup(value, (bits - MIN_BITS) >> MANTISSA_SHIFT);
+    }
+
+    // Decodes the specified number of 8-bit components to linear values.
+    void decode(const uint8_t* pSrc, float* pDst, size_t count) const
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            pDst[i] = m_decodeTable[pSrc[i]];
+        }
+    }
+
+private:
+    // The smallest value in the encoding table; smaller values encode to zero with both encodings.
+    // The buckets are distinguished by the exponent and the top nine bits of the mantissa.
+    static constexpr float MIN_VALUE = 1.0f / (1 << 18);
+    static const int32_t MIN_BITS = (127 - 18) << 23;
+    static const int MANTISSA_SHIFT = 23 - 9;
+    static const size_t TABLE_SIZE = (size_t(18) << 9) + 1;
+
+    vector<uint8_t> m_codes;
+    vector<float> m_thresholds;
+    float m_decodeTable[256];
+
+    // Constructor, which creates the tables for the specified encoding.
+    ColorConverter(ColorEncoding encoding) : m_codes(TABLE_SIZE), m_thresholds(TABLE_SIZE)
+    {
+        // The reference conversion, which the table must match exactly.
+        auto quantize = [encoding](int32_t bits)
+        {
+            float value = 0.0f;
+            ::memcpy(&value, &bits, sizeof(value));
+            const float COMPONENT_SCALE = 255.99f;
+
+            return static_cast<uint8_t>(
+                clamp(encodeColor(value, encoding), 0.0f, 1.0f) * COMPONENT_SCALE);
+        };
+
+        // For each bucket, store the value at the start, and find the threshold (if any) where the
+        // next value starts with a binary search over the float values in the bucket.
+        for (size_t i = 0; i < TABLE_SIZE; i++)
+        {
+            const int32_t first = MIN_BITS + static_cast<int32_t>(i << MANTISSA_SHIFT);
+            const int32_t last = first + (1 << MANTISSA_SHIFT) - 1;
+            m_codes[i] = quantize(first);
+            m_thresholds[i] = FLT_MAX;
+            if (i + 1 < TABLE_SIZE && quantize(last) != m_codes[i])
+            {
+                assert(quantize(last) == m_codes[i] + 1);
+                int32_t low = first;
+                int32_t high = last;
+                while (low < high)
+                {
+                    int32_t middle = low + (high - low) / 2;
+                    if (quantize(middle) == m_codes[i])
+                    {
+                        low = middle + 1;
+                    }
+                    else
+                    {
+                        high = middle;
+                    }
+                }
+                ::memcpy(&m_thresholds[i], &low, sizeof(float));
+            }
+        }
+
+        for (int i = 0; i < 256; i++)
+        {
+            m_decodeTable[i] = decodeColor(i / 255.0f, encoding);
+        }
+    }
+
+    // Returns the 8-bit value for a clamped value with the specified table index.
+    uint8_t lookup(float value, int32_t index) const
+    {
+        return m_codes[index] + (value >= m_thresholds[index] ? 1 : 0);
+    }
+};
+
+} // namespace Luma
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "Utils.h"
+
+// Define LUMA_COST_HEATMAP as 1 (e.g. in the project's preprocessor definitions) to count the cost
+// of rendering each pixel, for the "heatmap" statement. Otherwise the counting is compiled out, and
+// has no cost at all.
+#ifndef LUMA_COST_HEATMAP
+#define LUMA_COST_HEATMAP 0
+#endif
+
+namespace Luma {
+
+// Whether the cost of rendering is counted; see LUMA_COST_HEATMAP.
+constexpr bool COST_COUNTING = LUMA_COST_HEATMAP != 0;
+
+// The measures of the cost of rendering a pixel.
+enum class CostMetric
+{
+    Tests,      // Ray-primitive intersection tests.
+    Traversals, // Rays traced through the scene, i.e. calls to intersect the scene.
+    Bounces,    // Path segments that hit a surface and continue.
+};
+
+// Returns the name of the specified cost metric, as used in scene files.
+inline const char* costMetricName(CostMetric metric)
+{
+    static const char* NAMES[] = { "tests", "traversals", "bounces" };
+
+    return NAMES[static_cast<int>(metric)];
+}
+
+// Parses the name of a cost metric, returning whether the name was valid.
+inline bool parseCostMetric(const string& name, CostMetric& metric)
+{
+    for (CostMetric candidate : { CostMetric::Tests, CostMetric::Traversals, CostMetric::Bounces })
+    {
+        if (name == costMetricName(candidate))
+        {
+            metric = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The cost of rendering a pixel, or part of one.
+struct PixelCost
+{
+    uint32_t tests = 0;
+    uint32_t traversals = 0;
+    uint32_t bounces = 0;
+
+    // Returns the value of the specified metric.
+    uint32_t get(CostMetric metric) const
+    {
+        return metric == CostMetric::Tests ? tests
+            : metric == CostMetric::Traversals ? traversals : bounces;
+    }
+
+    // Adds the costs of another pixel or part of a pixel, e.g. to sum the cost of several passes.
+    PixelCost& operator+=(const PixelCost& other)
+    {
+        tests += other.tests;
+        traversals += other.traversals;
+        bounces += other.bounces;
+
+        return *this;
+    }
+};
+
+// Counts the cost of the work done by the current thread, if enabled with LUMA_COST_HEATMAP. The
+// work is counted where it is done, e.g. in Scene::intersect(), without passing counters through
+// every function, and each thread has separate counts so there is no contention.
+class CostCounter
+{
+public:
+    // Counts a ray traced through the scene, with the specified number of intersection tests.
+    static void countTraversal(size_t tests)
+    {
+        if constexpr (COST_COUNTING)
+        {
+            PixelCost& cost = getCost();
+            cost.traversals++;
+            cost.tests += static_cast<uint32_t>(tests);
+        }
+    }
+
+    // Counts a path segment that hit a surface.
+    static void countBounce()
+    {
+        if constexpr (COST_COUNTING)
+        {
+            getCost().bounces++;
+        }
+    }
+
+    // Returns the cost counted on the current thread since the last call, and resets it.
+    static PixelCost take()
+    {
+        PixelCost result;
+        if constexpr (COST_COUNTING)
+        {
+            std::swap(result, getCost());
+        }
+
+        return result;
+    }
+
+private:
+    // Returns the cost counted on the current thread.
+    static PixelCost& getCost()
+    {
+        static thread_local PixelCost cost;
+
+        return cost;
+    }
+};
+
+// The cost of rendering each pixel of a framebuffer, for a heatmap. This has the dimensions of the
+// framebuffer, i.e. the rendered region of the image.
+class CostMap
+{
+public:
+    // Constructor.
+    CostMap(uint32_t width, uint32_t height) :
+        m_width(width), m_height(height), m_costs(size_t(width) * height)
+    {
+    }
+
+    // Returns the dimensions of the map.
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+
+    // Sets the cost of the pixel at the specified position, e.g. from CostCounter::take().
+    void set(uint32_t x, uint32_t y, const PixelCost& cost)
+    {
+        m_costs[size_t(y) * m_width + x] = cost;
+    }
+
+    // Returns the cost of the pixel at the specified position.
+    const PixelCost& get(uint32_t x, uint32_t y) const { return m_costs[size_t(y) * m_width + x]; }
+
+    // Returns the maximum value of the specified metric over all pixels.
+    uint32_t getMax(CostMetric metric) const
+    {
+        uint32_t result = 0;
+        for (const PixelCost& cost : m_costs)
+        {
+            result = std::max(result, cost.get(metric));
+        }
+
+        return result;
+    }
+
+    // Returns the mean value of the specified metric over all pixels.
+    double getMean(CostMetric metric) const
+    {
+        double total = 0.0;
+        for (const PixelCost& cost : m_costs)
+        {
+            total += cost.get(metric);
+        }
+
+        return m_costs.empty() ? 0.0 : total / m_costs.size();
+    }
+
+    // Clears the costs, e.g. before rendering another frame.
+    void clear() { std::fill(m_costs.begin(), m_costs.end(), PixelCost()); }
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    vector<PixelCost> m_costs;
+};
+
+// Returns the false color for the specified value in [0.0, 1.0] in a heatmap, as 8-bit RGB values.
+//
+// NOTE: This is a piecewise linear approximation of the "inferno" color map, which goes from black
+// through purple and orange to yellow. It is perceptually uniform and readable in grayscale, so
+// equal differences in cost look equally different anywhere in the range.
+inline void getHeatmapColor(float value, uint8_t* pColor)
+{
+    static const uint8_t STOPS[][3] =
+    {
+        { 0, 0, 4 }, { 40, 11, 84 }, { 101, 21, 110 }, { 159, 42, 99 },
+        { 212, 72, 66 }, { 245, 125, 21 }, { 250, 193, 39 }, { 252, 255, 164 },
+    };
+    static const int LAST_STOP = sizeof(STOPS) / sizeof(STOPS[0]) - 1;
+
+    const float position = clamp(value, 0.0f, 1.0f) * LAST_STOP;
+    const int stop = std::min(static_cast<int>(position), LAST_STOP - 1);
+    const float t = position - stop;
+    for (int i = 0; i < 3; i++)
+    {
+        pColor[i] = static_cast<uint8_t>(lerp<float>(STOPS[stop][i], STOPS[stop + 1][i], t) + 0.5f);
+    }
+}
+
+} // namespace Luma
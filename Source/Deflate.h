@@ -0,0 +1,409 @@
+#pragma once
+
+namespace Luma {
+
+// Updates an Adler-32 checksum (as used by zlib streams) with the specified data. The initial
+// checksum value is 1.
+inline uint32_t adler32(uint32_t adler, const uint8_t* pData, size_t size)
+{
+    // The sums are reduced modulo the base only every few thousand bytes, which is the most that
+    // can be added without overflowing 32 bits.
+    static const uint32_t BASE = 65521;
+    static const size_t MAX_BLOCK = 5552;
+    uint32_t sum1 = adler & 0xffff;
+    uint32_t sum2 = adler >> 16;
+    while (size > 0)
+    {
+        size_t blockSize = std::min(size, MAX_BLOCK);
+        size -= blockSize;
+        for (size_t i = 0; i < blockSize; i++)
+        {
+            sum1 += *pData++;
+            sum2 += sum1;
+        }
+        sum1 %= BASE;
+        sum2 %= BASE;
+    }
+
+    return (sum2 << 16) | sum1;
+}
+
+// Combines the Adler-32 checksums of two consecutive pieces of data, where the second piece has the
+// specified size, giving the checksum of all the data. This allows the checksums of pieces to be
+// computed in parallel.
+inline uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2)
+{
+    // The first sum of the combined data is the sum of the first sums (less the initial value of
+    // one), and the second sum adds the first sum of the first piece once for each byte of the
+    // second piece.
+    static const uint64_t BASE = 65521;
+    const uint64_t remainder = size2 % BASE;
+    const uint64_t sum1 = ((adler1 & 0xffff) + (adler2 & 0xffff) + BASE - 1) % BASE;
+    const uint64_t sum2 =
+        (remainder * (adler1 & 0xffff) + (adler1 >> 16) + (adler2 >> 16) + BASE - remainder) % BASE;
+
+    return static_cast<uint32_t>((sum2 << 16) | sum1);
+}
+
+// Updates a CRC-32 checksum (as used by PNG chunks) with the specified data. The initial checksum
+// value is 0.
+inline uint32_t crc32(uint32_t crc, const uint8_t* pData, size_t size)
+{
+    // Create the lookup table for each byte value, on first use.
+    static const vector<uint32_t> TABLE = []()
+    {
+        vector<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                value = (value & 1) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            }
+            table[i] = value;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = TABLE[(crc ^ pData[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+// A streaming compressor for the deflate format (RFC 1951), as used by zlib streams and PNG files.
+// Data can be compressed in pieces of any size, and the output for each piece is available right
+// away, so that large outputs never need to be held in memory.
+//
+// NOTE: This uses LZ77 matching with hash chains over the standard 32 KB window, and the fixed
+// Huffman codes. Like the compressor in stb_image_write, this gives a reasonable compression ratio
+// while being much simpler than dynamic Huffman codes.
+class Deflater
+{
+public:
+    // The ways the output can be flushed after compressing a piece of data.
+    enum class Flush
+    {
+        None,   // Data may be held back for better matches with the next piece.
+        Sync,   // All data is output, ending on a byte boundary; more data can follow.
+        Finish, // All data is output and the stream is ended.
+    };
+
+    // Constructor, with the maximum number of hash chain entries to check for each match. Higher
+    // values give better compression but take longer.
+    Deflater(int maxChainLength = 16) :
+        m_maxChainLength(maxChainLength), m_head(HASH_SIZE, -1), m_previous(WINDOW_SIZE, -1) {}
+
+    // Sets the preset dictionary, i.e. data that can be referenced by matches but is not itself
+    // output. This must be called before any data is compressed. Only the last 32 KB are used.
+    void setDictionary(const uint8_t* pData, size_t size)
+    {
+        assert(m_buffer.empty());
+
+        size_t start = size > WINDOW_SIZE ? size - WINDOW_SIZE : 0;
+        m_buffer.assign(pData + start, pData + size);
+        for (size_t i = 0; i + MIN_MATCH <= m_buffer.size(); i++)
+        {
+            insertHash(i);
+        }
+        m_position = m_buffer.size();
+    }
+
+    // Compresses the specified data, appending any available compressed output to the output
+    // buffer, and flushing the output as specified.
+    void compress(const uint8_t* pData, size_t size, Flush flush, vector<uint8_t>& output)
+    {
+        assert(!m_finished);
+
+        // Start a (non-final) block with fixed Huffman codes if needed.
+        if (!m_blockStarted)
+        {
+            writeBits(0, 1);
+            writeBits(1, 2);
+            m_blockStarted = true;
+        }
+
+        // Add the data to the buffer and compress it. Unless the output is flushed, the last bytes
+        // are held back so that matches can always be as long as possible.
+        m_buffer.insert(m_buffer.end(), pData, pData + size);
+        size_t limit = m_buffer.size();
+        if (flush == Flush::None)
+        {
+            limit = limit > MAX_MATCH ? limit - MAX_MATCH : 0;
+        }
+        compressBuffer(limit);
+
+        // Flush the output if requested. A sync flush ends the block and adds an empty stored block,
+        // which ends on a byte boundary. A finish ends the block and adds an empty final block.
+        if (flush != Flush::None)
+        {
+            writeLiteral(END_OF_BLOCK);
+            if (flush == Flush::Sync)
+            {
+                writeBits(0, 3);
+                alignBits();
+                writeBits(0x0000, 16);
+                writeBits(0xffff, 16);
+            }
+            else
+            {
+                writeBits(1, 1);
+                writeBits(1, 2);
+                writeLiteral(END_OF_BLOCK);
+                alignBits();
+                m_finished = true;
+            }
+            m_blockStarted = false;
+        }
+        flushBytes(output);
+
+        // Discard data that is no longer in the window. This is only done once enough data can be
+        // discarded, to avoid moving the buffer contents too often.
+        if (m_position > 2 * WINDOW_SIZE)
+        {
+            size_t discard = m_position - WINDOW_SIZE;
+            m_buffer.erase(m_buffer.begin(), m_buffer.begin() + discard);
+            m_base += discard;
+            m_position -= discard;
+        }
+    }
+
+private:
+    static constexpr size_t WINDOW_SIZE = 32768;
+    static const size_t HASH_SIZE = 1 << 15;
+    static const size_t MIN_MATCH = 3;
+    static constexpr size_t MAX_MATCH = 258;
+    static const int END_OF_BLOCK = 256;
+
+    int m_maxChainLength;
+
+    // The data buffer, with the (absolute) stream position of its first byte, and the index of the
+    // next byte to compress. The buffer contains the previous 32 KB of data (the window) as well.
+    vector<uint8_t> m_buffer;
+    int64_t m_base = 0;
+    size_t m_position = 0;
+
+    // The hash chains: the most recent stream position for each hash of three bytes, and the
+    // previous position with the same hash for each position in the window.
+    vector<int64_t> m_head;
+    vector<int64_t> m_previous;
+
+    // The pending output: whole bytes, and bits which do not yet make up a whole byte.
+    vector<uint8_t> m_pendingBytes;
+    uint32_t m_bits = 0;
+    int m_bitCount = 0;
+
+    bool m_blockStarted = false;
+    bool m_finished = false;
+
+    // Compresses the buffer from the current position up to the specified limit, using matches
+    // with previous data where possible and literals otherwise.
+    void compressBuffer(size_t limit)
+    {
+        while (m_position < limit)
+        {
+            if (m_buffer.size() - m_position < MIN_MATCH)
+            {
+                writeLiteral(m_buffer[m_position++]);
+                continue;
+            }
+
+            // Find the longest match at the current position. If the match at the next position
+            // is longer, output a literal instead (i.e. "lazy" matching). This is skipped for long
+            // matches, which are unlikely to be improved on, like zlib does.
+            static const size_t MAX_LAZY_LENGTH = 32;
+            size_t distance = 0;
+            size_t length = findMatch(m_position, distance);
+            insertHash(m_position);
+            if (length >= MIN_MATCH && length < MAX_LAZY_LENGTH
+                && m_buffer.size() - m_position > MIN_MATCH)
+            {
+                size_t nextDistance = 0;
+                if (findMatch(m_position + 1, nextDistance) > length)
+                {
+                    length = 0;
+                }
+            }
+
+            if (length < MIN_MATCH)
+            {
+                writeLiteral(m_buffer[m_position++]);
+                continue;
+            }
+
+            // Output the match, and add the matched positions to the hash chains.
+            writeMatch(length, distance);
+            for (size_t i = 1; i < length && m_position + i + MIN_MATCH <= m_buffer.size(); i++)
+            {
+                insertHash(m_position + i);
+            }
+            m_position += length;
+        }
+    }
+
+    // Computes the hash of the three bytes at the specified buffer index.
+    uint32_t hash(size_t index) const
+    {
+        const uint8_t* p = &m_buffer[index];
+        uint32_t value = (p[0] << 16) | (p[1] << 8) | p[2];
+
+        return (value * 2654435761u) >> 17;
+    }
+
+    // Adds the specified buffer index to the hash chains.
+    void insertHash(size_t index)
+    {
+        int64_t position = m_base + index;
+        uint32_t key = hash(index);
+        m_previous[position & (WINDOW_SIZE - 1)] = m_head[key];
+        m_head[key] = position;
+    }
+
+    // Finds the longest match for the data at the specified buffer index among the previous data in
+    // the window, returning the match length and distance (zero if there is no match).
+    size_t findMatch(size_t index, size_t& distance) const
+    {
+        const int64_t position = m_base + index;
+        const int64_t minPosition = std::max(m_base, position - static_cast<int64_t>(WINDOW_SIZE));
+        const size_t maxLength = std::min(MAX_MATCH, m_buffer.size() - index);
+        const uint8_t* pData = &m_buffer[index];
+
+        size_t bestLength = 0;
+        int64_t candidate = m_head[hash(index)];
+        for (int chain = 0; chain < m_maxChainLength && candidate >= minPosition; chain++)
+        {
+            const uint8_t* pCandidate = &m_buffer[static_cast<size_t>(candidate - m_base)];
+            if (pCandidate[bestLength] == pData[bestLength])
+            {
+                size_t length = 0;
+                while (length < maxLength && pCandidate[length] == pData[length])
+                {
+                    length++;
+                }
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    distance = static_cast<size_t>(position - candidate);
+                    if (length == maxLength)
+                    {
+                        break;
+                    }
+                }
+            }
+            candidate = m_previous[candidate & (WINDOW_SIZE - 1)];
+        }
+
+        return bestLength;
+    }
+
+    // Writes the specified number of bits (up to 16) to the output, least significant bit first.
+    // Whole bytes are moved to the pending output right away.
+    void writeBits(uint32_t value, int count)
+    {
+        m_bits |= value << m_bitCount;
+        m_bitCount += count;
+        while (m_bitCount >= 8)
+        {
+            m_pendingBytes.push_back(static_cast<uint8_t>(m_bits));
+            m_bits >>= 8;
+            m_bitCount -= 8;
+        }
+    }
+
+    // Writes a Huffman code, which is stored most significant bit first.
+    void writeCode(uint32_t code, int count)
+    {
+        writeBits(reverseBits(code, count), count);
+    }
+
+    // Reverses the order of the specified number of low bits of a value.
+    static uint32_t reverseBits(uint32_t value, int count)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < count; i++)
+        {
+            reversed = (reversed << 1) | ((value >> i) & 1);
+        }
+
+        return reversed;
+    }
+
+    // Writes a literal / length symbol with the fixed Huffman codes.
+    //
+    // NOTE: The codes are bit-reversed once into a table, as reversing them for every symbol would
+    // take much of the compression time.
+    void writeLiteral(int symbol)
+    {
+        struct Code
+        {
+            uint16_t bits;
+            uint8_t count;
+        };
+        static const vector<Code> CODES = []()
+        {
+            vector<Code> codes(288);
+            for (int i = 0; i < 288; i++)
+            {
+                uint32_t code = 0;
+                uint8_t count = 0;
+                if (i < 144) { code = 0x30 + i; count = 8; }
+                else if (i < 256) { code = 0x190 + i - 144; count = 9; }
+                else if (i < 280) { code = i - 256; count = 7; }
+                else { code = 0xc0 + i - 280; count = 8; }
+                codes[i] = { static_cast<uint16_t>(reverseBits(code, count)), count };
+            }
+            return codes;
+        }();
+
+        writeBits(CODES[symbol].bits, CODES[symbol].count);
+    }
+
+    // Writes a match with the specified length and distance, with the fixed Huffman codes.
+    void writeMatch(size_t length, size_t distance)
+    {
+        static const uint16_t LENGTH_BASE[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+            31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t LENGTH_EXTRA[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3,
+            3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const uint16_t DISTANCE_BASE[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97,
+            129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+            24577 };
+        static const uint8_t DISTANCE_EXTRA[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        int lengthCode = 28;
+        while (LENGTH_BASE[lengthCode] > length)
+        {
+            lengthCode--;
+        }
+        writeLiteral(257 + lengthCode);
+        writeBits(static_cast<uint32_t>(length - LENGTH_BASE[lengthCode]), LENGTH_EXTRA[lengthCode]);
+
+        int distanceCode = 29;
+        while (DISTANCE_BASE[distanceCode] > distance)
+        {
+            distanceCode--;
+        }
+        writeCode(distanceCode, 5);
+        writeBits(static_cast<uint32_t>(distance - DISTANCE_BASE[distanceCode]),
+            DISTANCE_EXTRA[distanceCode]);
+    }
+
+    // Pads the output bits with zeros to a byte boundary.
+    void alignBits()
+    {
+        writeBits(0, (8 - m_bitCount) & 7);
+    }
+
+    // Appends the pending output bytes to the output buffer.
+    void flushBytes(vector<uint8_t>& output)
+    {
+        output.insert(output.end(), m_pendingBytes.begin(), m_pendingBytes.end());
+        m_pendingBytes.clear();
+    }
+};
+
+} // namespace Luma
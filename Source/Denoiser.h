@@ -0,0 +1,177 @@
+#pragma once
+
+#include "AOV.h"
+#include "Framebuffer.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <ppl.h>
+
+namespace Luma {
+
+// An edge-avoiding à-trous wavelet denoiser (Dammertz et al., "Edge-Avoiding À-Trous Wavelet
+// Transform for fast Global Illumination Filtering", 2010), which smooths the noise of an image
+// rendered with few samples per pixel while keeping the edges of surfaces, guided by the AOVs of
+// the image (see AOVBuffer). This allows rendering with several times fewer samples for a similar
+// quality, at the cost of some blurring of fine detail in the lighting.
+//
+// Each pass filters the image with a 5x5 B-spline kernel, with the taps spread further apart in
+// each pass (1, 2, 4, ... pixels), so a few passes cover a large area with few taps. Each tap is
+// weighted by how similar its color, normal, albedo, and depth are to those of the filtered pixel,
+// so that the filter does not blur across edges. The noisy color is trusted less in later passes,
+// since it has already been smoothed.
+//
+// NOTE: The radiance is divided by the albedo before filtering (demodulated), so that only the
+// lighting is filtered, and then multiplied again afterward, which keeps the colors of surfaces
+// sharp. The passes run in parallel over the rows of the image, and need two float copies of the
+// image in memory, in addition to the framebuffer and AOVs.
+class Denoiser
+{
+public:
+    // The maximum number of filter passes. The taps of the last pass are 2^(passes - 1) pixels
+    // apart, so more passes would mostly reach outside any image, and the color weight scale of
+    // each pass would eventually overflow.
+    static const uint32_t MAX_PASSES = 10;
+
+    // Constructor, with the number of filter passes, from one to MAX_PASSES.
+    Denoiser(uint32_t passes = 5) : m_passes(passes)
+    {
+        assert(passes >= 1 && passes <= MAX_PASSES);
+    }
+
+    // Denoises the radiance in the specified framebuffer in place, guided by the specified AOVs,
+    // which must have the same dimensions.
+    void denoise(Framebuffer& framebuffer, const AOVBuffer& aovs) const
+    {
+        assert(framebuffer.width() == aovs.width() && framebuffer.height() == aovs.height());
+        TraceScope scope("Denoise");
+        const uint32_t width = framebuffer.width();
+        const uint32_t height = framebuffer.height();
+        const size_t rowSize = size_t(width) * 3;
+
+        // Demodulate the radiance by the albedo, where the albedo is not (almost) zero.
+        vector<float> input(rowSize * height);
+        vector<float> output(rowSize * height);
+        const float* pAlbedo = aovs.albedo();
+        Concurrency::parallel_for(0u, height, [&](uint32_t y)
+        {
+            const float* pRow = framebuffer.getRow(y);
+            for (size_t i = y * rowSize; i < (y + 1) * rowSize; i++)
+            {
+                input[i] = pRow[i - y * rowSize] / getDivisor(pAlbedo[i]);
+            }
+        });
+
+        // Filter the image with each pass, alternating between the buffers.
+        for (uint32_t pass = 0; pass < m_passes; pass++)
+        {
+            const int step = 1 << pass;
+            const float colorScale =
+                1.0f / (COLOR_SIGMA * COLOR_SIGMA * std::ldexp(1.0f, -static_cast<int>(pass)));
+            Concurrency::parallel_for(0u, height, [&](uint32_t y)
+            {
+                for (uint32_t x = 0; x < width; x++)
+                {
+                    filterPixel(aovs, input.data(), x, y, step, colorScale,
+                        &output[(size_t(y) * width + x) * 3]);
+                }
+            });
+            std::swap(input, output);
+        }
+
+        // Modulate the filtered lighting by the albedo, and store it in the framebuffer.
+        Concurrency::parallel_for(0u, height, [&](uint32_t y)
+        {
+            float* pRow = framebuffer.getRow(y);
+            for (size_t i = y * rowSize; i < (y + 1) * rowSize; i++)
+            {
+                pRow[i - y * rowSize] = input[i] * getDivisor(pAlbedo[i]);
+            }
+        });
+    }
+
+private:
+    // The standard deviations of the differences for the edge-stopping weights: the color
+    // (lighting) in the first pass, the normal, the albedo, and the depth relative to the depth of
+    // the pixel for each pixel of distance.
+    static constexpr float COLOR_SIGMA = 1.0f;
+    static constexpr float NORMAL_SIGMA = 0.3f;
+    static constexpr float ALBEDO_SIGMA = 0.1f;
+    static constexpr float DEPTH_SIGMA = 0.02f;
+
+    uint32_t m_passes;
+
+    // Returns the value to divide the radiance by to demodulate it, for the specified albedo
+    // component: the albedo, or one if it is (almost) zero.
+    static float getDivisor(float albedo) { return albedo > 1e-3f ? albedo : 1.0f; }
+
+    // Returns the squared distance between two colors or vectors, stored as three floats.
+    static float distanceSquared(const float* pA, const float* pB)
+    {
+        const float d0 = pA[0] - pB[0];
+        const float d1 = pA[1] - pB[1];
+        const float d2 = pA[2] - pB[2];
+
+        return d0 * d0 + d1 * d1 + d2 * d2;
+    }
+
+    // Filters the pixel at the specified position of the specified image, with the taps of the
+    // kernel the specified step apart and the specified color weight scale, writing the result
+    // to the specified output pixel. Taps outside the image are skipped.
+    void filterPixel(const AOVBuffer& aovs, const float* pImage, uint32_t x, uint32_t y, int step,
+        float colorScale, float* pOutput) const
+    {
+        static const float KERNEL[] =
+            { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+        static const float NORMAL_SCALE = 1.0f / (NORMAL_SIGMA * NORMAL_SIGMA);
+        static const float ALBEDO_SCALE = 1.0f / (ALBEDO_SIGMA * ALBEDO_SIGMA);
+        const int width = static_cast<int>(aovs.width());
+        const int height = static_cast<int>(aovs.height());
+        const size_t center = size_t(y) * width + x;
+        const float* pColor = &pImage[center * 3];
+        const float* pNormal = &aovs.normal()[center * 3];
+        const float* pAlbedo = &aovs.albedo()[center * 3];
+        const float depth = aovs.depth()[center];
+        const float depthScale = 1.0f / (DEPTH_SIGMA * step * std::max(depth, 1e-3f));
+
+        float sum[3] = {};
+        float weightSum = 0.0f;
+        for (int j = -2; j <= 2; j++)
+        {
+            const int tapY = static_cast<int>(y) + j * step;
+            if (tapY < 0 || tapY >= height)
+            {
+                continue;
+            }
+            for (int i = -2; i <= 2; i++)
+            {
+                const int tapX = static_cast<int>(x) + i * step;
+                if (tapX < 0 || tapX >= width)
+                {
+                    continue;
+                }
+
+                // Weight the tap by the kernel, and by the similarity of each guide value.
+                const size_t tap = size_t(tapY) * width + tapX;
+                const float* pTapColor = &pImage[tap * 3];
+                const float exponent =
+                    distanceSquared(pColor, pTapColor) * colorScale
+                    + distanceSquared(pNormal, &aovs.normal()[tap * 3]) * NORMAL_SCALE
+                    + distanceSquared(pAlbedo, &aovs.albedo()[tap * 3]) * ALBEDO_SCALE
+                    + std::abs(depth - aovs.depth()[tap]) * depthScale;
+                const float weight = KERNEL[i + 2] * KERNEL[j + 2] * std::exp(-exponent);
+                sum[0] += pTapColor[0] * weight;
+                sum[1] += pTapColor[1] * weight;
+                sum[2] += pTapColor[2] * weight;
+                weightSum += weight;
+            }
+        }
+
+        // The center tap always has a positive weight, so the sum is never zero.
+        pOutput[0] = sum[0] / weightSum;
+        pOutput[1] = sum[1] / weightSum;
+        pOutput[2] = sum[2] / weightSum;
+    }
+};
+
+} // namespace Luma
@@ -0,0 +1,579 @@
+#pragma once
+
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Renderer.h"
+#include "Socket.h"
+#include "Trace.h"
+
+#include <condition_variable>
+#include <deque>
+#include <sstream>
+
+namespace Luma {
+
+// Distributed rendering: a coordinator process splits the image into tiles and hands them to worker
+// processes over sockets (see Socket), which render the tiles and send back the radiance as floats.
+// The coordinator merges the tiles into its framebuffer, and saves the output (and checkpoints) as
+// for a local render. Workers can run on other machines with TCP addresses, or on the same machine
+// with a Unix domain socket, e.g. to test the protocol. Each worker process loads the scene itself,
+// so only tiles and pixels are sent, and the scene is checked with a hash (see computeSceneHash()).
+//
+// Each worker process opens one connection per thread, and each connection renders one tile at a
+// time. The protocol on a connection is lines of text, with binary data after a result line:
+//
+//   Coordinator: render <width> <height> <samples> <max depth> <frame> <scene hash>
+//   Worker:      ready                     (or "error <message>" for a different scene)
+//   Coordinator: tile <index> <x> <y> <width> <height>          (in image coordinates)
+//   Worker:      result <index> <ray count>, followed by width * height * 3 floats
+//   ...
+//   Coordinator: done                      (or "next" if there is another frame to render)
+//
+// For an animation, workers connect again after receiving "next", and the coordinator keeps
+// listening between frames, so workers keep their scene for all the frames. Workers also connect
+// again if a connection is lost, e.g. when a coordinator is restarted to resume a render.
+//
+// NOTE: Every sample depends only on the pixel and sample index (see PixelSampler), so a tile gives
+// the same radiance on any worker, and the image is identical to a local render. This makes it safe
+// to render a tile more than once, which is how failures and slow workers are handled: a tile held
+// by a connection that is lost is handed out again, and once no tiles are left to hand out, idle
+// workers are given copies of the tiles that have been outstanding longest ("backup" tiles). The
+// first result for a tile is used, and any later copies are discarded. This means a single slow or
+// unresponsive machine does not hold up the end of a render.
+//
+// The coordinator only hands out tiles and merges results; it does not render tiles itself, so it
+// can run on a machine that is also running a worker.
+
+// A coordinator for distributed rendering, which hands out tiles to workers (see RenderWorker).
+// The image dimensions, samples, and maximum depth are sent to the workers, so they only need to be
+// set for the coordinator.
+class RenderCoordinator
+{
+public:
+    // Renders the framebuffer with the specified settings on workers connecting to the specified
+    // socket address, until every tile has been rendered. The scene hash must match that of the
+    // workers. Tiles in which every pixel already has the number of samples in the settings, e.g.
+    // from a checkpoint, are skipped; other tiles are rendered from the first sample. Returns
+    // whether the render was completed; if not, error() describes the problem. If there are more
+    // frames to render, the workers are told to connect again for the next frame, which is rendered
+    // with the next call.
+    bool render(const string& address, Framebuffer& framebuffer, const RenderSettings& settings,
+        uint64_t sceneHash, bool moreFrames = false)
+    {
+        m_error.clear();
+        m_pFramebuffer = &framebuffer;
+        m_pSettings = &settings;
+        m_sceneHash = sceneHash;
+        m_stats = RenderStats();
+        m_duplicateTiles = 0;
+        m_workerCount = 0;
+        m_moreFrames = moreFrames;
+
+        // Listen for workers, unless already listening on the address for an earlier frame.
+        if (!m_listenSocket.isValid() || address != m_address)
+        {
+            m_listenSocket = Socket::listen(address);
+            m_address = address;
+            if (!m_listenSocket.isValid())
+            {
+                return fail("Unable to listen on \"" + address + "\".");
+            }
+        }
+
+        // Queue the tiles that need rendering, in the tile order of the settings.
+        const vector<uint32_t> tileOrder = getTileOrder(framebuffer, settings);
+        m_tiles.assign(tileOrder.size(), TileState());
+        m_pending.clear();
+        for (uint32_t tileIndex : tileOrder)
+        {
+            if (isTileComplete(tileIndex))
+            {
+                m_tiles[tileIndex].done = true;
+                framebuffer.finishTile(tileIndex);
+            }
+            else
+            {
+                m_pending.push_back(tileIndex);
+            }
+        }
+        m_remainingTiles = static_cast<uint32_t>(m_pending.size());
+        const uint32_t tileCount = m_remainingTiles;
+
+        std::cout
+            << "Rendering " << settings.width << "x" << settings.height << " at "
+            << settings.samples << " samples per pixel with workers on \"" << address
+            << "\"..." << std::endl;
+
+        // Accept worker connections until all tiles are rendered, serving each connection on a
+        // separate thread, and report progress once a second.
+        auto startTime = std::chrono::high_resolution_clock::now();
+        auto prevTime = startTime;
+        vector<std::thread> threads;
+        while (m_remainingTiles > 0)
+        {
+            Socket worker = m_listenSocket.accept(ACCEPT_TIMEOUT_MILLISECONDS);
+            if (worker.isValid())
+            {
+                m_workerCount++;
+                threads.emplace_back(
+                    [this](Socket socket) { serveWorker(socket); }, std::move(worker));
+            }
+
+            auto nextTime = std::chrono::high_resolution_clock::now();
+            if (std::chrono::duration<double>(nextTime - prevTime).count() >= 1.0)
+            {
+                const uint32_t completed = tileCount - m_remainingTiles;
+                updateProgress(tileCount > 0 ? static_cast<float>(completed) / tileCount : 1.0f);
+                prevTime = nextTime;
+            }
+        }
+
+        // Wait for the connections to finish; they are sent "done" once all tiles are rendered.
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        m_stats.seconds = std::chrono::duration<double>(endTime - startTime).count();
+        updateProgress(1.0f);
+        std::cout << std::endl;
+        std::cout
+            << std::setprecision(3)
+            << "Completed in " << m_stats.seconds << " seconds with " << m_workerCount
+            << " worker connections (" << m_duplicateTiles << " duplicate tiles)." << std::endl;
+
+        return true;
+    }
+
+    // Returns the statistics for the last render, with the rays traced by all the workers.
+    const RenderStats& stats() const { return m_stats; }
+
+    // Returns a description of the error from the last call to render(), if any.
+    const string& error() const { return m_error; }
+
+private:
+    // The state of a tile: whether it has been rendered, the number of connections rendering it,
+    // and when it was first handed out, as a sequence number.
+    struct TileState
+    {
+        bool done = false;
+        uint32_t copies = 0;
+        uint64_t dispatchSequence = 0;
+    };
+
+    // The time to wait for a connection or a result before checking whether the render is done.
+    static const int ACCEPT_TIMEOUT_MILLISECONDS = 100;
+
+    // The time allowed for receiving the rest of a reply once it has started to arrive, after
+    // which the worker is treated as lost.
+    static const int REPLY_TIMEOUT_MILLISECONDS = 10000;
+
+    // The maximum number of connections rendering the same tile at the same time.
+    static const uint32_t MAX_TILE_COPIES = 3;
+
+    Socket m_listenSocket;
+    string m_address;
+    Framebuffer* m_pFramebuffer = nullptr;
+    const RenderSettings* m_pSettings = nullptr;
+    uint64_t m_sceneHash = 0;
+    bool m_moreFrames = false;
+    RenderStats m_stats;
+    string m_error;
+
+    // The tile states and the queue of tiles to hand out, which are shared by the threads, and the
+    // number of tiles not rendered yet.
+    vector<TileState> m_tiles;
+    std::deque<uint32_t> m_pending;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::atomic<uint32_t> m_remainingTiles{ 0 };
+    uint64_t m_nextDispatchSequence = 0;
+    uint32_t m_duplicateTiles = 0;
+    uint32_t m_workerCount = 0;
+
+    // Records the specified error message, returning false for convenience.
+    bool fail(const string& message)
+    {
+        m_error = message;
+
+        return false;
+    }
+
+    // Returns whether every pixel of the specified tile already has enough samples.
+    bool isTileComplete(uint32_t tileIndex) const
+    {
+        const Tile tile = m_pFramebuffer->getTile(tileIndex);
+        for (uint32_t y = tile.y; y < tile.y + tile.height; y++)
+        {
+            for (uint32_t x = tile.x; x < tile.x + tile.width; x++)
+            {
+                if (m_pFramebuffer->getSampleCount(x, y) < m_pSettings->samples)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // Gets the next tile for a connection to render, waiting until there is one. This is the next
+    // pending tile, or a copy of an outstanding tile if there are no pending tiles. Returns false
+    // if all tiles have been rendered.
+    bool assignTile(uint32_t& tileIndex)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_remainingTiles > 0)
+        {
+            // Take the next pending tile, skipping any that were rendered after being queued again.
+            while (!m_pending.empty())
+            {
+                tileIndex = m_pending.front();
+                m_pending.pop_front();
+                TileState& state = m_tiles[tileIndex];
+                if (!state.done)
+                {
+                    state.copies++;
+                    state.dispatchSequence = m_nextDispatchSequence++;
+                    return true;
+                }
+            }
+
+            // Otherwise copy the outstanding tile with the fewest copies, which has been
+            // outstanding the longest.
+            const TileState* pBest = nullptr;
+            for (const TileState& state : m_tiles)
+            {
+                if (!state.done && state.copies > 0 && state.copies < MAX_TILE_COPIES
+                    && (!pBest || state.copies < pBest->copies
+                        || (state.copies == pBest->copies
+                            && state.dispatchSequence < pBest->dispatchSequence)))
+                {
+                    pBest = &state;
+                }
+            }
+            if (pBest)
+            {
+                tileIndex = static_cast<uint32_t>(pBest - m_tiles.data());
+                m_tiles[tileIndex].copies++;
+                return true;
+            }
+
+            // Wait for a tile to be rendered or released.
+            m_condition.wait(lock);
+        }
+
+        return false;
+    }
+
+    // Releases a tile that a connection will not render, e.g. because it was lost. The tile is
+    // handed out again first, unless it has been rendered or another connection is rendering it.
+    void releaseTile(uint32_t tileIndex)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        TileState& state = m_tiles[tileIndex];
+        state.copies--;
+        if (!state.done && state.copies == 0)
+        {
+            m_pending.push_front(tileIndex);
+        }
+        m_condition.notify_all();
+    }
+
+    // Stores the radiance rendered for a tile in the framebuffer, if it is the first result for the
+    // tile, and adds the number of rays traced to the statistics.
+    void completeTile(uint32_t tileIndex, const vector<float>& radiance, uint64_t rayCount)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            TileState& state = m_tiles[tileIndex];
+            state.copies--;
+            m_stats.rayCount += rayCount;
+            if (state.done)
+            {
+                m_duplicateTiles++;
+                return;
+            }
+            state.done = true;
+        }
+
+        // Commit the tile outside of the lock, as only this thread can commit it. The tile is
+        // only counted as rendered once it is in the framebuffer, so that the framebuffer is
+        // complete when the render finishes.
+        TraceScope scope("Merge tile", "index", tileIndex);
+        const Tile tile = m_pFramebuffer->getTile(tileIndex);
+        const vector<uint32_t> sampleCounts(
+            size_t(tile.width) * tile.height, m_pSettings->samples);
+        m_pFramebuffer->commitTile(tile, radiance.data(), sampleCounts.data());
+        m_pFramebuffer->finishTile(tileIndex);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_remainingTiles--;
+        }
+        m_condition.notify_all();
+    }
+
+    // Waits for data on a connection, until it arrives or all tiles have been rendered. Returns
+    // whether there is data, in which case the rest of the reply must be received within a time
+    // limit (see REPLY_TIMEOUT_MILLISECONDS).
+    //
+    // NOTE: A worker can take any amount of time to render a tile, since a copy of the tile can be
+    // rendered by another worker meanwhile, but once a reply has started it is sent all at once.
+    // The time limit means that a worker that stops partway through a reply, e.g. because its
+    // machine failed without closing the connection, can't hold up the end of the render.
+    bool waitForWorker(Socket& socket)
+    {
+        while (m_remainingTiles > 0)
+        {
+            if (socket.waitReadable(ACCEPT_TIMEOUT_MILLISECONDS))
+            {
+                socket.setReceiveTimeout(REPLY_TIMEOUT_MILLISECONDS);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Serves a worker connection: sends the render settings, and then hands out tiles and receives
+    // their results until all tiles are rendered or the connection is lost.
+    void serveWorker(Socket& socket)
+    {
+        Tracer::setThreadName("Connection");
+        const RenderSettings& settings = *m_pSettings;
+        string line;
+        std::ostringstream header;
+        header
+            << "render " << settings.width << " " << settings.height << " " << settings.samples
+            << " " << settings.maxDepth << " " << settings.frame << " " << m_sceneHash << "\n";
+        if (!socket.sendText(header.str()) || !waitForWorker(socket) || !socket.receiveLine(line)
+            || line != "ready")
+        {
+            if (line.compare(0, 6, "error ") == 0)
+            {
+                std::cerr << std::endl << "Worker rejected the render: " << line.substr(6)
+                    << std::endl;
+            }
+            return;
+        }
+
+        uint32_t tileIndex = 0;
+        vector<float> radiance;
+        while (assignTile(tileIndex))
+        {
+            // Send the tile in image coordinates, i.e. offset by the crop window.
+            const Tile tile = m_pFramebuffer->getTile(tileIndex);
+            std::ostringstream request;
+            request
+                << "tile " << tileIndex << " " << settings.cropX + tile.x << " "
+                << settings.cropY + tile.y << " " << tile.width << " " << tile.height << "\n";
+
+            // Receive the result. If every tile is rendered while waiting (including this one,
+            // e.g. by a copy on a faster worker), the connection is abandoned. If the result stops
+            // arriving partway through, the connection is treated as lost, and the tile is
+            // released to be rendered by another connection.
+            radiance.resize(size_t(tile.width) * tile.height * Framebuffer::NUM_COMPONENTS);
+            uint32_t resultIndex = 0;
+            uint64_t rayCount = 0;
+            string tag;
+            bool received = socket.sendText(request.str()) && waitForWorker(socket)
+                && socket.receiveLine(line);
+            if (received)
+            {
+                std::istringstream result(line);
+                received = (result >> tag >> resultIndex >> rayCount) && tag == "result"
+                    && resultIndex == tileIndex
+                    && socket.receiveAll(radiance.data(), radiance.size() * sizeof(float));
+            }
+            if (!received)
+            {
+                releaseTile(tileIndex);
+                return;
+            }
+            completeTile(tileIndex, radiance, rayCount);
+        }
+
+        socket.sendText(m_moreFrames ? "next\n" : "done\n");
+    }
+};
+
+// A worker for distributed rendering, which renders tiles for a coordinator; see
+// RenderCoordinator.
+class RenderWorker
+{
+public:
+    // Renders tiles of the specified element (scene) for the coordinator at the specified socket
+    // address, until it has no more tiles. The scene hash must match that of the coordinator, and
+    // the image dimensions, samples, and maximum depth are taken from the coordinator. Connecting
+    // is retried for a while, so workers can be started before the coordinator. Returns whether
+    // any tiles were rendered; if not, error() describes the problem.
+    bool run(const string& address, const Element& element, const RenderSettings& settings,
+        uint64_t sceneHash)
+    {
+        m_error.clear();
+        m_tileCount = 0;
+        m_stats = RenderStats();
+
+        // Open a connection per thread, each rendering one tile at a time.
+        std::cout << "Rendering tiles for \"" << address << "\"..." << std::endl;
+        auto startTime = std::chrono::high_resolution_clock::now();
+        const unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+        vector<std::thread> threads;
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            threads.emplace_back(
+                [&]() { serveCoordinator(address, element, settings, sceneHash); });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+        m_stats.seconds = std::chrono::duration<double>(endTime - startTime).count();
+        if (m_tileCount == 0)
+        {
+            return fail(m_error.empty() ? "No tiles were rendered for \"" + address + "\"."
+                : m_error);
+        }
+        std::cout
+            << std::setprecision(3)
+            << "Rendered " << m_tileCount << " tiles in " << m_stats.seconds << " seconds."
+            << std::endl;
+
+        return true;
+    }
+
+    // Returns the statistics for the last run, with the rays traced by this worker.
+    const RenderStats& stats() const { return m_stats; }
+
+    // Returns a description of the error from the last call to run(), if any.
+    const string& error() const { return m_error; }
+
+private:
+    // The time to keep trying to connect to the coordinator, and the time between attempts.
+    static const int CONNECT_TIMEOUT_MILLISECONDS = 10000;
+    static const int CONNECT_RETRY_MILLISECONDS = 200;
+
+    RenderStats m_stats;
+    std::atomic<uint32_t> m_tileCount{ 0 };
+    std::mutex m_mutex;
+    string m_error;
+
+    // Records the specified error message, returning false for convenience.
+    bool fail(const string& message)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = message;
+
+        return false;
+    }
+
+    // Renders tiles for the coordinator, for each frame it renders. If the connection is lost, e.g.
+    // because the coordinator abandoned a copy of a tile or was restarted, the worker connects
+    // again, until the coordinator can no longer be reached.
+    void serveCoordinator(const string& address, const Element& element,
+        const RenderSettings& settings, uint64_t sceneHash)
+    {
+        Tracer::setThreadName("Worker");
+        while (serveFrame(address, element, settings, sceneHash))
+        {
+        }
+    }
+
+    // Connects to the coordinator and renders tiles until it has no more tiles or the connection
+    // is lost. Returns whether to connect again, i.e. whether the coordinator has another frame to
+    // render or the connection was lost.
+    bool serveFrame(const string& address, const Element& element, RenderSettings settings,
+        uint64_t sceneHash)
+    {
+        // Connect, retrying until the coordinator is listening.
+        Socket socket;
+        for (int elapsed = 0; !socket.isValid(); elapsed += CONNECT_RETRY_MILLISECONDS)
+        {
+            socket = Socket::connect(address);
+            if (!socket.isValid() && elapsed >= CONNECT_TIMEOUT_MILLISECONDS)
+            {
+                fail("Unable to connect to \"" + address + "\".");
+                return false;
+            }
+            if (!socket.isValid())
+            {
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(CONNECT_RETRY_MILLISECONDS));
+            }
+        }
+
+        // Receive the render settings, and check that the scene is the same.
+        string line;
+        string tag;
+        uint64_t coordinatorHash = 0;
+        if (!socket.receiveLine(line))
+        {
+            return true;
+        }
+        std::istringstream header(line);
+        if (!(header >> tag >> settings.width >> settings.height >> settings.samples
+            >> settings.maxDepth >> settings.frame >> coordinatorHash) || tag != "render"
+            || settings.width == 0 || settings.height == 0 || settings.samples == 0)
+        {
+            fail("Invalid render settings from \"" + address + "\".");
+            return false;
+        }
+        if (coordinatorHash != sceneHash)
+        {
+            socket.sendText("error The scene is different.\n");
+            fail("The scene is different from the scene of \"" + address + "\".");
+            return false;
+        }
+        socket.sendText("ready\n");
+        Camera camera(settings.camera, settings.aspect());
+
+        // Render the tiles, until the coordinator is done with the frame.
+        vector<float> radiance;
+        while (socket.receiveLine(line) && line != "done" && line != "next")
+        {
+            uint32_t tileIndex = 0, x = 0, y = 0, width = 0, height = 0;
+            std::istringstream request(line);
+            if (!(request >> tag >> tileIndex >> x >> y >> width >> height) || tag != "tile"
+                || uint64_t(x) + width > settings.width || uint64_t(y) + height > settings.height)
+            {
+                fail("Invalid tile from \"" + address + "\".");
+                return false;
+            }
+
+            // Render each pixel of the tile, in image coordinates.
+            TraceScope scope("Tile", "index", tileIndex);
+            uint64_t rayCount = 0;
+            radiance.resize(size_t(width) * height * Framebuffer::NUM_COMPONENTS);
+            float* pPixel = radiance.data();
+            for (uint32_t row = y; row < y + height; row++)
+            {
+                for (uint32_t column = x; column < x + width; column++)
+                {
+                    Vec3 pixel = renderPixel(element, camera, settings, column, row, 0, rayCount);
+                    pixel /= settings.samples;
+                    *pPixel++ = pixel.r();
+                    *pPixel++ = pixel.g();
+                    *pPixel++ = pixel.b();
+                }
+            }
+
+            // Send the result, or connect again if the connection has been lost.
+            const string result =
+                "result " + std::to_string(tileIndex) + " " + std::to_string(rayCount) + "\n";
+            if (!socket.sendText(result)
+                || !socket.sendAll(radiance.data(), radiance.size() * sizeof(float)))
+            {
+                return true;
+            }
+            m_tileCount++;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.rayCount += rayCount;
+        }
+
+        return line != "done";
+    }
+};
+
+} // namespace Luma
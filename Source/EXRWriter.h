@@ -0,0 +1,343 @@
+#pragma once
+
+#include "Framebuffer.h"
+#include "Image.h"
+
+#include <fstream>
+#include <ppl.h>
+
+namespace Luma {
+
+// Converts a 32-bit float value to a 16-bit ("half") float value, rounding to the nearest value
+// (with ties to even) like a hardware conversion. Values too large for a half become infinity.
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits = 0;
+    ::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    uint32_t absBits = bits & 0x7fffffff;
+
+    // Handle infinity and NaN, keeping NaN a NaN, and values that round up to infinity (65520).
+    if (absBits >= 0x7f800000)
+    {
+        return sign | 0x7c00 | (absBits > 0x7f800000 ? 0x0200 : 0);
+    }
+    if (absBits >= 0x477ff000)
+    {
+        return sign | 0x7c00;
+    }
+
+    // Handle values that are zero or subnormal as halfs, i.e. less than 2^-14. The full float
+    // mantissa (with the implicit leading one) is shifted down to the half subnormal range.
+    if (absBits < 0x38800000)
+    {
+        if (absBits < 0x33000000)
+        {
+            return sign;
+        }
+        uint32_t exponent = absBits >> 23;
+        uint32_t mantissa = (absBits & 0x007fffff) | 0x00800000;
+        uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+        {
+            half++;
+        }
+
+        return sign | static_cast<uint16_t>(half);
+    }
+
+    // Handle normal values, by rebiasing the exponent and rounding the mantissa. Rounding up may
+    // carry into the exponent, which is also correct.
+    uint32_t half = (absBits - 0x38000000) >> 13;
+    uint32_t remainder = absBits & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        half++;
+    }
+
+    return sign | static_cast<uint16_t>(half);
+}
+
+// The compression methods supported for OpenEXR files, with their values in the file format.
+enum class EXRCompression : uint8_t
+{
+    None = 0, // No compression.
+    ZIP = 3,  // Deflate compression of blocks of 16 scanlines, or of whole tiles.
+};
+
+// A writer for OpenEXR image files with half-float RGB channels, from a framebuffer. The image can
+// be stored as scanlines or as tiles, optionally compressed with the EXR "ZIP" method.
+//
+// NOTE: This writes only the subset of OpenEXR needed for rendered images, so no external library
+// is required. See "The OpenEXR File Layout" at https://openexr.com for details of the format.
+class EXRWriter
+{
+public:
+    // Constructor, with the compression method and the tile size in pixels. A tile size of zero
+    // writes scanlines instead of tiles.
+    EXRWriter(EXRCompression compression = EXRCompression::ZIP, uint32_t tileSize = 0) :
+        m_compression(compression), m_tileSize(tileSize) {}
+
+    // Sets the dimensions of the whole image (the display window) and the position of the
+    // framebuffer in it, for a framebuffer that contains only a region of the image, e.g. a crop
+    // window. The file then records where the region belongs, so that applications can place it
+    // in the whole image. By default, the framebuffer is the whole image.
+    void setDisplayWindow(uint32_t width, uint32_t height, uint32_t x, uint32_t y)
+    {
+        m_displayWidth = width;
+        m_displayHeight = height;
+        m_dataX = x;
+        m_dataY = y;
+    }
+
+    // Writes the framebuffer to an OpenEXR file at the specified path. Returns whether the file was
+    // written successfully.
+    bool write(const string& filePath, const Framebuffer& framebuffer) const
+    {
+        std::ofstream file(filePath, std::ios::binary);
+
+        return write(file, framebuffer);
+    }
+
+    // Writes the framebuffer as an OpenEXR file to the specified stream, which must be opened in
+    // binary mode. Returns whether the file was written successfully.
+    //
+    // NOTE: Chunks (blocks of scanlines or tiles) are converted to halfs directly from the
+    // framebuffer and compressed independently, so they are processed in parallel.
+    bool write(std::ostream& file, const Framebuffer& framebuffer) const
+    {
+        // Determine the chunk layout: blocks of scanlines, or tiles.
+        const uint32_t width = framebuffer.width();
+        const uint32_t height = framebuffer.height();
+        const bool tiled = m_tileSize > 0;
+        const uint32_t chunkWidth = tiled ? m_tileSize : width;
+        const uint32_t chunkHeight =
+            tiled ? m_tileSize : (m_compression == EXRCompression::ZIP ? 16 : 1);
+        const uint32_t chunksX = (width + chunkWidth - 1) / chunkWidth;
+        const uint32_t chunksY = (height + chunkHeight - 1) / chunkHeight;
+        const uint32_t chunkCount = chunksX * chunksY;
+
+        // Encode the chunks in parallel. Each chunk starts with its own small header: the tile
+        // coordinates and level for a tile, or the first scanline for a block of scanlines.
+        vector<vector<uint8_t>> chunks(chunkCount);
+        Concurrency::parallel_for(uint32_t(0), chunkCount, [&](uint32_t index)
+        {
+            uint32_t tileX = index % chunksX;
+            uint32_t tileY = index / chunksX;
+            uint32_t x = tileX * chunkWidth;
+            uint32_t y = tileY * chunkHeight;
+            uint32_t chunkPixelsX = std::min(chunkWidth, width - x);
+            uint32_t chunkPixelsY = std::min(chunkHeight, height - y);
+
+            vector<uint8_t>& chunk = chunks[index];
+            if (tiled)
+            {
+                appendValue(chunk, static_cast<int32_t>(tileX));
+                appendValue(chunk, static_cast<int32_t>(tileY));
+                appendValue(chunk, int32_t(0));
+                appendValue(chunk, int32_t(0));
+            }
+            else
+            {
+                appendValue(chunk, static_cast<int32_t>(m_dataY + y));
+            }
+            encodeChunk(framebuffer, x, y, chunkPixelsX, chunkPixelsY, chunk);
+        });
+
+        // Write the file: the header, the table of chunk offsets, and then the chunks.
+        if (!file)
+        {
+            return false;
+        }
+        vector<uint8_t> header = createHeader(width, height, tiled);
+        file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+        uint64_t offset = header.size() + chunkCount * sizeof(uint64_t);
+        for (const vector<uint8_t>& chunk : chunks)
+        {
+            file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+            offset += chunk.size();
+        }
+        for (const vector<uint8_t>& chunk : chunks)
+        {
+            file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+        }
+        file.flush();
+
+        return static_cast<bool>(file);
+    }
+
+private:
+    EXRCompression m_compression;
+    uint32_t m_tileSize;
+    uint32_t m_displayWidth = 0;
+    uint32_t m_displayHeight = 0;
+    uint32_t m_dataX = 0;
+    uint32_t m_dataY = 0;
+
+    // Appends the bytes of a value to a buffer, in little-endian order like the platform.
+    template<class T>
+    static void appendValue(vector<uint8_t>& buffer, const T& value)
+    {
+        const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(&value);
+        buffer.insert(buffer.end(), pBytes, pBytes + sizeof(T));
+    }
+
+    // Appends a null-terminated string to a buffer.
+    static void appendString(vector<uint8_t>& buffer, const char* value)
+    {
+        buffer.insert(buffer.end(), value, value + ::strlen(value) + 1);
+    }
+
+    // Appends an attribute to a header buffer, i.e. its name, type name, size, and value.
+    template<class T>
+    static void appendAttribute(
+        vector<uint8_t>& buffer, const char* name, const char* type, const T& value)
+    {
+        appendString(buffer, name);
+        appendString(buffer, type);
+        appendValue(buffer, static_cast<int32_t>(sizeof(T)));
+        appendValue(buffer, value);
+    }
+
+    // Creates the file header: the magic number, the version and flags, and the attributes.
+    vector<uint8_t> createHeader(uint32_t width, uint32_t height, bool tiled) const
+    {
+        vector<uint8_t> header;
+        static const uint32_t MAGIC = 20000630;
+        static const uint32_t VERSION = 2;
+        static const uint32_t TILED_FLAG = 0x200;
+        appendValue(header, MAGIC);
+        appendValue(header, VERSION | (tiled ? TILED_FLAG : 0));
+
+        // Write the channel list, which must be in alphabetical order. Each channel has a name, a
+        // pixel type (1 is half), a linear flag and padding, and X and Y sampling rates.
+        static const char* CHANNEL_NAMES[] = { "B", "G", "R" };
+        vector<uint8_t> channels;
+        for (const char* name : CHANNEL_NAMES)
+        {
+            appendString(channels, name);
+            appendValue(channels, int32_t(1));
+            appendValue(channels, uint32_t(0));
+            appendValue(channels, int32_t(1));
+            appendValue(channels, int32_t(1));
+        }
+        channels.push_back(0);
+        appendString(header, "channels");
+        appendString(header, "chlist");
+        appendValue(header, static_cast<int32_t>(channels.size()));
+        header.insert(header.end(), channels.begin(), channels.end());
+
+        // Write the remaining required attributes. The data window is the framebuffer, and the
+        // display window is the whole image, which is the same unless a display window was set.
+        struct Box2i { int32_t xMin, yMin, xMax, yMax; };
+        struct V2f { float x, y; };
+        const int32_t dataX = static_cast<int32_t>(m_dataX);
+        const int32_t dataY = static_cast<int32_t>(m_dataY);
+        Box2i dataWindow = { dataX, dataY,
+            dataX + static_cast<int32_t>(width) - 1, dataY + static_cast<int32_t>(height) - 1 };
+        Box2i displayWindow = { 0, 0,
+            static_cast<int32_t>(m_displayWidth ? m_displayWidth : width) - 1,
+            static_cast<int32_t>(m_displayHeight ? m_displayHeight : height) - 1 };
+        appendAttribute(header, "compression", "compression", static_cast<uint8_t>(m_compression));
+        appendAttribute(header, "dataWindow", "box2i", dataWindow);
+        appendAttribute(header, "displayWindow", "box2i", displayWindow);
+        appendAttribute(header, "lineOrder", "lineOrder", uint8_t(0));
+        appendAttribute(header, "pixelAspectRatio", "float", 1.0f);
+        appendAttribute(header, "screenWindowCenter", "v2f", V2f{ 0.0f, 0.0f });
+        appendAttribute(header, "screenWindowWidth", "float", 1.0f);
+
+        // Write the tile description for a tiled image: the tile size and the level mode, where
+        // zero is a single level (no mipmaps).
+        if (tiled)
+        {
+            appendString(header, "tiles");
+            appendString(header, "tiledesc");
+            appendValue(header, int32_t(9));
+            appendValue(header, m_tileSize);
+            appendValue(header, m_tileSize);
+            header.push_back(0);
+        }
+
+        // End the header with an empty attribute name.
+        header.push_back(0);
+
+        return header;
+    }
+
+    // Encodes a chunk of the framebuffer with the specified position and size, appending the data
+    // size and the (possibly compressed) data to the chunk buffer.
+    void encodeChunk(const Framebuffer& framebuffer,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height, vector<uint8_t>& chunk) const
+    {
+        // Convert the pixels to halfs. For each scanline, all of the values for each channel are
+        // stored together, with the channels in alphabetical order (B, G, R).
+        vector<uint16_t> pixels(size_t(width) * height * Framebuffer::NUM_COMPONENTS);
+        uint16_t* pDst = pixels.data();
+        for (uint32_t line = 0; line < height; line++)
+        {
+            const float* pRow = framebuffer.getRow(y + line);
+            pRow += size_t(x) * Framebuffer::NUM_COMPONENTS;
+            for (int channel = 2; channel >= 0; channel--)
+            {
+                for (uint32_t i = 0; i < width; i++)
+                {
+                    *pDst++ = floatToHalf(pRow[i * Framebuffer::NUM_COMPONENTS + channel]);
+                }
+            }
+        }
+        const uint8_t* pRaw = reinterpret_cast<const uint8_t*>(pixels.data());
+        const int rawSize = static_cast<int>(pixels.size() * sizeof(uint16_t));
+
+        // Compress the data if requested. The data is stored uncompressed if compression does not
+        // make it smaller, as specified by the format.
+        if (m_compression == EXRCompression::ZIP)
+        {
+            vector<uint8_t> predicted = predictZIP(pRaw, rawSize);
+            int compressedSize = 0;
+            static const int COMPRESSION_LEVEL = 8;
+            uint8_t* pCompressed = ::stbi_zlib_compress(
+                predicted.data(), rawSize, &compressedSize, COMPRESSION_LEVEL);
+            if (pCompressed && compressedSize < rawSize)
+            {
+                appendValue(chunk, static_cast<int32_t>(compressedSize));
+                chunk.insert(chunk.end(), pCompressed, pCompressed + compressedSize);
+                STBIW_FREE(pCompressed);
+                return;
+            }
+            STBIW_FREE(pCompressed);
+        }
+
+        appendValue(chunk, static_cast<int32_t>(rawSize));
+        chunk.insert(chunk.end(), pRaw, pRaw + rawSize);
+    }
+
+    // Prepares data for EXR "ZIP" compression, which improves the compression ratio of the data:
+    // the bytes are reordered with all of the low bytes of the halfs first, followed by all of the
+    // high bytes, and each byte is then replaced with its difference from the previous byte.
+    static vector<uint8_t> predictZIP(const uint8_t* pData, int size)
+    {
+        vector<uint8_t> result(size);
+        uint8_t* pLow = result.data();
+        uint8_t* pHigh = result.data() + (size + 1) / 2;
+        for (int i = 0; i < size; i++)
+        {
+            *((i & 1) ? pHigh++ : pLow++) = pData[i];
+        }
+
+        int previous = result[0];
+        for (int i = 1; i < size; i++)
+        {
+            int current = result[i];
+            result[i] = static_cast<uint8_t>(current - previous + (128 + 256));
+            previous = current;
+        }
+
+        return result;
+    }
+};
+
+} // namespace Luma
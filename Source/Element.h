@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Ray.h"
+#include "Vec3.h"
+
+namespace Luma {
+
+class Light;
+
+// A structure storing the data for a hit (ray-element intersection). The ID identifies the element
+// that was hit within a scene, starting from one; it is set by Scene. The light is the light that
+// was hit, if the element is a light; it is also set by Scene.
+struct Hit
+{
+    float t;
+    Vec3 position;
+    Vec3 normal;
+    uint32_t id;
+    const Light* pLight = nullptr;
+};
+
+// An interface for any element that can be intersected by a ray.
+class Element
+{
+public:
+    // Intersects the ray with the element, returns whether an intersection was found. If so, the
+    // hit value is update with properties of the intersection.
+    virtual bool intersect(const Ray& ray, Hit& hit) const = 0;
+
+    // Returns whether the ray intersects the element anywhere in its range, e.g. whether a shadow
+    // ray is blocked. Unlike intersect(), this doesn't need the closest intersection, so it can
+    // stop at the first one found.
+    virtual bool occluded(const Ray& ray) const
+    {
+        Hit hit;
+        return intersect(ray, hit);
+    }
+
+    // Returns the lights of the element, for sampling them explicitly (see Light). By default an
+    // element has no lights.
+    virtual const vector<shared_ptr<Light>>& lights() const
+    {
+        static const vector<shared_ptr<Light>> NO_LIGHTS;
+        return NO_LIGHTS;
+    }
+};
+
+} // namespace Luma
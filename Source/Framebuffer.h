@@ -0,0 +1,263 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "Vec3.h"
+
+#include <fstream>
+#include <shared_mutex>
+
+namespace Luma {
+
+// A rectangle of pixels in a framebuffer, rendered as a unit.
+struct Tile
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// A buffer of linear radiance values, with three floating-point (RGB) components per pixel. This is
+// the direct output of rendering, before any gamma correction, clamping, or quantization, so it can
+// be saved to high dynamic range image formats without losing any information. The buffer also
+// stores the number of samples taken for each pixel, where the radiance is the average of those
+// samples, so that rendering can continue from a partially rendered buffer, e.g. from a checkpoint.
+//
+// The buffer is divided into square tiles, which are rendered in order from the top left, and
+// reported as finished with finishTile(). The buffer data can be stored in memory, or in a memory
+// mapped file for images that are too large for memory (e.g. gigapixel images). With a file, each
+// row of tiles is written back to the file ("spilled") as soon as all of its tiles are finished, so
+// that the operating system can reuse that memory, and the memory used while rendering is bounded.
+//
+// NOTE: Pixels are stored in rows from the top of the image to the bottom, like Image, so that the
+// image can be saved by reading the rows sequentially from either kind of storage. All sizes and
+// offsets are computed with 64 bits, so the pixel count is not limited by the dimension type. The
+// sample counts are stored after the radiance, in the same order.
+class Framebuffer
+{
+public:
+    static const uint8_t NUM_COMPONENTS = 3;
+    static constexpr uint32_t TILE_SIZE = 64;
+
+    // Constructor, with an optional file used to store the buffer data, which must have the size
+    // returned by dataSize(). If no file is specified, the data is stored in memory.
+    Framebuffer(uint32_t width, uint32_t height, shared_ptr<MappedFile> pFile = nullptr) :
+        m_width(width), m_height(height), m_pFile(pFile)
+    {
+        if (m_pFile)
+        {
+            assert(m_pFile->size() >= dataSize(width, height));
+            m_pData = reinterpret_cast<float*>(m_pFile->data());
+            m_pSampleCounts = reinterpret_cast<uint32_t*>(m_pFile->data() + radianceSize());
+
+            // Initialize the number of unfinished tiles in each row of tiles.
+            m_unfinishedTiles.reset(new std::atomic<uint32_t>[tilesY()]);
+            resetUnfinishedTiles();
+        }
+        else
+        {
+            m_memory.resize(dataSize(width, height));
+            m_pData = reinterpret_cast<float*>(m_memory.data());
+            m_pSampleCounts = reinterpret_cast<uint32_t*>(m_memory.data() + radianceSize());
+        }
+    }
+
+    // Returns the size of the data for a buffer with the specified dimensions, in bytes. This
+    // includes the radiance and the sample counts.
+    static uint64_t dataSize(uint32_t width, uint32_t height)
+    {
+        return uint64_t(width) * height * (NUM_COMPONENTS * sizeof(float) + sizeof(uint32_t));
+    }
+
+    // Returns the width of the buffer, in pixels.
+    uint32_t width() const { return m_width; }
+
+    // Returns the height of the buffer, in pixels.
+    uint32_t height() const { return m_height; }
+
+    // Returns whether the buffer data is stored in a file rather than memory.
+    bool isSpilled() const { return m_pFile != nullptr; }
+
+    // Returns the buffer data.
+    float* getData() { return m_pData; }
+    const float* getData() const { return m_pData; }
+
+    // Returns the number of samples taken for each pixel, in the same order as the radiance. These
+    // are all zero for a new buffer.
+    uint32_t* getSampleCounts() { return m_pSampleCounts; }
+    const uint32_t* getSampleCounts() const { return m_pSampleCounts; }
+
+    // Returns the number of samples taken for the specified pixel.
+    uint32_t getSampleCount(uint32_t x, uint32_t y) const
+    {
+        return m_pSampleCounts[uint64_t(y) * m_width + x];
+    }
+
+    // Resets the sample counts of all pixels to zero, so that the buffer is rendered again, e.g.
+    // for the next frame of an animation. Every tile is then unfinished again (see finishTile()).
+    void clearSampleCounts()
+    {
+        std::fill(m_pSampleCounts, m_pSampleCounts + uint64_t(m_width) * m_height, 0u);
+        resetUnfinishedTiles();
+    }
+
+    // Returns the start of the specified row of the buffer, where row 0 is the top of the image.
+    float* getRow(uint32_t y) { return m_pData + rowOffset(y); }
+    const float* getRow(uint32_t y) const { return m_pData + rowOffset(y); }
+
+    // Stores the specified radiance at the specified pixel.
+    void setPixel(uint32_t x, uint32_t y, const Vec3& radiance)
+    {
+        float* pPixel = getRow(y) + size_t(x) * NUM_COMPONENTS;
+        pPixel[0] = radiance.r();
+        pPixel[1] = radiance.g();
+        pPixel[2] = radiance.b();
+    }
+
+    // Returns the number of tiles in each row and column of tiles, and in total.
+    uint32_t tilesX() const { return (m_width + TILE_SIZE - 1) / TILE_SIZE; }
+    uint32_t tilesY() const { return (m_height + TILE_SIZE - 1) / TILE_SIZE; }
+    uint32_t tileCount() const { return tilesX() * tilesY(); }
+
+    // Returns the tile with the specified index, where tiles are numbered in rows from the top left.
+    // Tiles at the right and bottom edges may be smaller than the tile size.
+    Tile getTile(uint32_t index) const
+    {
+        Tile tile;
+        tile.x = index % tilesX() * TILE_SIZE;
+        tile.y = index / tilesX() * TILE_SIZE;
+        tile.width = std::min(TILE_SIZE, m_width - tile.x);
+        tile.height = std::min(TILE_SIZE, m_height - tile.y);
+
+        return tile;
+    }
+
+    // Stores the radiance and sample counts for the pixels of the specified tile, with rows of
+    // tile.width pixels. This can be called from any thread, for different tiles.
+    //
+    // NOTE: This holds a shared lock while storing the values, so that snapshot() can copy rows of
+    // the buffer with each tile either fully committed or not at all. Committing a tile only takes
+    // a few microseconds, so the lock is rarely contended.
+    void commitTile(const Tile& tile, const float* pRadiance, const uint32_t* pSampleCounts)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_commitMutex);
+        const size_t rowComponents = size_t(tile.width) * NUM_COMPONENTS;
+        for (uint32_t row = 0; row < tile.height; row++)
+        {
+            const uint32_t y = tile.y + row;
+            ::memcpy(getRow(y) + size_t(tile.x) * NUM_COMPONENTS, pRadiance + row * rowComponents,
+                rowComponents * sizeof(float));
+            ::memcpy(m_pSampleCounts + uint64_t(y) * m_width + tile.x,
+                pSampleCounts + size_t(row) * tile.width, size_t(tile.width) * sizeof(uint32_t));
+        }
+    }
+
+    // Copies the radiance and sample counts of the specified number of rows, starting with the
+    // specified row, e.g. to save a checkpoint while rendering continues. The copy is consistent
+    // for rows of tiles: every tile within the rows is copied as of its last commit.
+    void snapshot(uint32_t y, uint32_t rowCount, vector<float>& radiance,
+        vector<uint32_t>& sampleCounts) const
+    {
+        assert(y + rowCount <= m_height);
+        const uint64_t pixelCount = uint64_t(m_width) * rowCount;
+        radiance.resize(pixelCount * NUM_COMPONENTS);
+        sampleCounts.resize(pixelCount);
+
+        std::unique_lock<std::shared_mutex> lock(m_commitMutex);
+        const float* pRadiance = m_pData + rowOffset(y);
+        const uint32_t* pSampleCounts = m_pSampleCounts + uint64_t(y) * m_width;
+        std::copy(pRadiance, pRadiance + radiance.size(), radiance.begin());
+        std::copy(pSampleCounts, pSampleCounts + pixelCount, sampleCounts.begin());
+    }
+
+    // Reports that the tile with the specified index has been rendered. This can be called from any
+    // thread. When the buffer is stored in a file and this is the last tile in its row of tiles,
+    // the rows of the tiles are written back to the file.
+    void finishTile(uint32_t index)
+    {
+        if (!m_pFile)
+        {
+            return;
+        }
+
+        const uint32_t row = index / tilesX();
+        if (--m_unfinishedTiles[row] == 0)
+        {
+            const Tile tile = getTile(index);
+            m_pFile->flush(rowOffset(tile.y) * sizeof(float),
+                size_t(tile.height) * m_width * NUM_COMPONENTS * sizeof(float));
+            m_pFile->flush(radianceSize() + uint64_t(tile.y) * m_width * sizeof(uint32_t),
+                size_t(tile.height) * m_width * sizeof(uint32_t));
+        }
+    }
+
+    // Saves the buffer as a PFM (portable float map) file to the specified path. Returns whether the
+    // file was saved successfully.
+    bool savePFM(const string& filePath) const
+    {
+        std::ofstream file(filePath, std::ios::binary);
+
+        return savePFM(file);
+    }
+
+    // Writes the buffer as a PFM file to the specified stream, which must be opened in binary mode.
+    // Returns whether the file was written successfully.
+    //
+    // NOTE: PFM is a very simple format: a text header followed by the raw little-endian floats, with
+    // rows stored from the bottom of the image to the top. The rows are written directly from the
+    // buffer, without any intermediate copy.
+    bool savePFM(std::ostream& file) const
+    {
+        if (!file)
+        {
+            return false;
+        }
+
+        // Write the header, where a negative scale indicates little-endian data.
+        file << "PF\n" << m_width << " " << m_height << "\n-1.0\n";
+
+        // Write the rows, starting from the bottom.
+        const std::streamsize rowSize = std::streamsize(m_width) * NUM_COMPONENTS * sizeof(float);
+        for (uint32_t row = 0; row < m_height; row++)
+        {
+            file.write(reinterpret_cast<const char*>(getRow(m_height - row - 1)), rowSize);
+        }
+        file.flush();
+
+        return static_cast<bool>(file);
+    }
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    float* m_pData = nullptr;
+    uint32_t* m_pSampleCounts = nullptr;
+    mutable std::shared_mutex m_commitMutex;
+
+    // The storage for the data: either memory or a mapped file, with the number of unfinished tiles
+    // in each row of tiles for the latter.
+    vector<uint8_t> m_memory;
+    shared_ptr<MappedFile> m_pFile;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_unfinishedTiles;
+
+    // Sets the number of unfinished tiles in each row of tiles to the number of tiles in a row, if
+    // the buffer is stored in a file.
+    void resetUnfinishedTiles()
+    {
+        for (uint32_t row = 0; m_unfinishedTiles && row < tilesY(); row++)
+        {
+            m_unfinishedTiles[row] = tilesX();
+        }
+    }
+
+    // Returns the offset of the specified row in the buffer data, in floats.
+    size_t rowOffset(uint32_t y) const { return size_t(y) * m_width * NUM_COMPONENTS; }
+
+    // Returns the size of the radiance in the buffer data, i.e. the offset of the sample counts.
+    uint64_t radianceSize() const
+    {
+        return uint64_t(m_width) * m_height * NUM_COMPONENTS * sizeof(float);
+    }
+};
+
+} // namespace Luma
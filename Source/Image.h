@@ -3,93 +3,140 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image/stb_image_write.h"
 
+#include "Color.h"
+#include "Framebuffer.h"
+#include "MappedFile.h"
+#include "PNGWriter.h"
+#include "Resample.h"
+#include "Utils.h"
+
 namespace Luma {
 
 class Image
 {
 public:
-    // Constructor.
-    Image(uint16_t width, uint16_t height) : m_width(width), m_height(height)
+    // Constructor, with an optional file used to store the image data, which must have the size
+    // returned by dataSize(). If no file is specified, the data is stored in memory.
+    Image(uint32_t width, uint32_t height, shared_ptr<MappedFile> pFile = nullptr) :
+        m_width(width), m_height(height), m_pFile(pFile)
     {
-        // Create the image buffer.
-        size_t bufferSize = m_width * m_height * NUM_COMPONENTS;
-        m_pImageData = new uint8_t[bufferSize];
+        // Create the image buffer, or use the file.
+        if (m_pFile)
+        {
+            assert(m_pFile->size() >= dataSize(width, height));
+            m_pImageData = m_pFile->data();
+        }
+        else
+        {
+            m_pImageData = new uint8_t[dataSize(width, height)];
+        }
     }
 
     // Destructor.
     ~Image()
     {
-        delete[] m_pImageData;
+        if (!m_pFile)
+        {
+            delete[] m_pImageData;
+        }
         m_pImageData = nullptr;
     }
 
+    // Returns the size of the data for an image with the specified dimensions, in bytes.
+    static uint64_t dataSize(uint32_t width, uint32_t height)
+    {
+        return uint64_t(width) * height * NUM_COMPONENTS;
+    }
+
     // Returns the image data buffer.
     uint8_t* getImageData() { return m_pImageData; }
 
-    // Saves the image as a PNG file to the specified path, with an optional scale to enlarge the
-    // image.
-    void savePNG(string sFilePath, uint8_t scale = 1)
+    // Sets the image data from the linear radiance in the specified framebuffer, which must have
+    // the same dimensions as the image. The radiance is encoded (gamma corrected) with the specified
+    // encoding, clamped, and quantized, with the rows converted in parallel.
+    void setFromFramebuffer(
+        const Framebuffer& framebuffer, ColorEncoding encoding = ColorEncoding::Gamma22)
     {
-        uint8_t* pImageData = m_pImageData;
-        uint16_t width = m_width;
-        uint16_t height = m_height;
-
-        // Resize the image by the specified scale if one is specified.
-        if (scale > 1)
-        {
-            pImageData = scaleImage(scale);
-            width *= scale;
-            height *= scale;
-        }
-
-        // Write the image buffer to the output file path, and delete the image buffer.
-        ::stbi_write_png(
-            sFilePath.c_str(), width, height, NUM_COMPONENTS, pImageData, width * NUM_COMPONENTS);
+        assert(framebuffer.width() == m_width && framebuffer.height() == m_height);
 
-        // Delete the scaled image buffer if it was created.
-        if (scale > 1)
+        const ColorConverter& converter = ColorConverter::get(encoding);
+        const size_t rowSize = size_t(m_width) * NUM_COMPONENTS;
+        Concurrency::parallel_for(0u, m_height, [&](uint32_t y)
         {
-            delete[] pImageData;
-        }
+            converter.encode(framebuffer.getRow(y), &m_pImageData[y * rowSize], rowSize);
+        });
     }
 
-private:
-    static const uint8_t NUM_COMPONENTS = 3;
+    // Saves the image as a PNG file to the specified path, with an optional scale and resample
+    // filter to resize the image. Returns whether the file was saved successfully.
+    bool savePNG(
+        string sFilePath, float scale = 1.0f, ResampleFilter filter = ResampleFilter::Nearest)
+    {
+        std::ofstream file(sFilePath, std::ios::binary);
 
-    uint8_t* m_pImageData = nullptr;
-    uint16_t m_width;
-    uint16_t m_height;
+        return savePNG(file, scale, filter);
+    }
 
-    // Scales (enlarges) an image buffer by the specified scale factor, returning a new buffer.
-    uint8_t* scaleImage(uint8_t scale)
+    // Writes the image as a PNG file to the specified stream, which must be opened in binary mode,
+    // with an optional scale and resample filter to resize the image. Returns whether the file was
+    // written successfully.
+    //
+    // NOTE: The file is written one row at a time with PNGWriter, so the whole resized image is
+    // never held in memory. With the nearest filter and an integer scale, each enlarged row is
+    // simply written "scale" times; otherwise the resized image is computed in bands of rows.
+    bool savePNG(
+        std::ostream& stream, float scale = 1.0f, ResampleFilter filter = ResampleFilter::Nearest)
     {
-        // Create the destination buffer, as a multiple of the source buffer, e.g. 240x135 with a
-        // scale of 8 becomes 1920x1080.
-        uint16_t destWidth = m_width * scale;
-        uint16_t destHeight = m_height * scale;
-        size_t destBufferSize = destWidth * destHeight * NUM_COMPONENTS;
-        uint8_t* pDestData = new uint8_t[destBufferSize];
-
-        // Iterate the destination image pixels, copying the appropriate source image pixel for each.
-        uint8_t* pDst = pDestData;
-        for (uint16_t y = 0; y < destHeight; y++)
+        const uint32_t width = std::max(1u, static_cast<uint32_t>(std::lround(m_width * scale)));
+        const uint32_t height = std::max(1u, static_cast<uint32_t>(std::lround(m_height * scale)));
+        PNGWriter writer;
+        if (!writer.open(stream, width, height))
         {
-            // Get the start of the relevant scanline from the source image, i.e. advance the source
-            // scanline every "scale" scanlines (e.g. 8) of the destination image.
-            const uint8_t* pSrc = &m_pImageData[(y / scale) * m_width * NUM_COMPONENTS];
+            return false;
+        }
 
-            // Iterate the pixels of the destination image, copying the pixels of source image. The
-            // source image pointer is advanced every "scale" (e.g. 8) pixels of the destination image.
-            for (uint16_t x = 0; x < destWidth; x++)
+        const size_t rowSize = size_t(width) * NUM_COMPONENTS;
+        if (filter == ResampleFilter::Nearest && width % m_width == 0
+            && width / m_width * m_height == height)
+        {
+            const uint32_t integerScale = width / m_width;
+            vector<uint8_t> row(rowSize);
+            for (uint32_t y = 0; y < m_height; y++)
             {
-                ::memcpy(pDst, pSrc, NUM_COMPONENTS);
-                pDst += NUM_COMPONENTS;
-                pSrc += (x + 1) % scale == 0 ? NUM_COMPONENTS : 0;
+                const uint8_t* pSrc = &m_pImageData[size_t(y) * m_width * NUM_COMPONENTS];
+                Resampler::replicateRow(pSrc, m_width, integerScale, row.data());
+                for (uint32_t i = 0; i < integerScale; i++)
+                {
+                    writer.writeRow(row.data());
+                }
+            }
+        }
+        else
+        {
+            static const uint32_t BAND_HEIGHT = 64;
+            Resampler resampler(m_width, m_height, width, height, filter);
+            vector<uint8_t> band(rowSize * BAND_HEIGHT);
+            for (uint32_t firstRow = 0; firstRow < height; firstRow += BAND_HEIGHT)
+            {
+                const uint32_t rowCount = std::min(BAND_HEIGHT, height - firstRow);
+                resampler.resampleRows(m_pImageData, firstRow, rowCount, band.data());
+                for (uint32_t i = 0; i < rowCount; i++)
+                {
+                    writer.writeRow(&band[size_t(i) * rowSize]);
+                }
             }
         }
 
-        return pDestData;
+        return writer.close();
     }
+
+private:
+    static const uint8_t NUM_COMPONENTS = 3;
+
+    uint8_t* m_pImageData = nullptr;
+    uint32_t m_width;
+    uint32_t m_height;
+    shared_ptr<MappedFile> m_pFile;
 };
 
 } // namespace Luma
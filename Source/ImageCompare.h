@@ -0,0 +1,464 @@
+#pragma once
+
+#include "Framebuffer.h"
+#include "Utils.h"
+
+#include <fstream>
+#include <ppl.h>
+
+namespace Luma {
+
+// The differences between a rendered image and a reference image.
+struct ImageErrors
+{
+    // The mean squared error of the linear radiance, over all pixels and components, and its root.
+    double mse = 0.0;
+    double rmse = 0.0;
+
+    // The relative mean squared error, i.e. with each squared error divided by the squared
+    // reference value (plus a small constant), so that errors in dark regions count as much as
+    // errors in bright regions.
+    double relMSE = 0.0;
+
+    // The peak signal-to-noise ratio in decibels, with a peak value of 1.0; higher is better.
+    double psnr = 0.0;
+
+    // The mean FLIP error, in [0.0, 1.0], which estimates how different the images look when
+    // flipping between them; see FlipMetric.
+    double flip = 0.0;
+
+    // Returns the equal-time error for a render that took the specified time: the relative MSE
+    // multiplied by the time. The error of an unbiased Monte Carlo render is inversely proportional
+    // to the number of samples, so this is roughly independent of the sample count, and compares
+    // the efficiency of renderers: an optimization must lower this (i.e. be faster for the same
+    // error, or have less error for the same time) to be an improvement.
+    double equalTimeError(double seconds) const { return relMSE * seconds; }
+};
+
+// An implementation of the FLIP image difference metric (Andersson et al., "FLIP: A Difference
+// Evaluator for Alternating Images", 2020), for low dynamic range images. The images are filtered
+// with contrast sensitivity functions of the human visual system for an observer at a given
+// distance (in pixels per degree), then compared with a perceptual color difference, which is
+// increased where edges and points differ. The result is a per-pixel error in [0.0, 1.0].
+//
+// NOTE: The images are the linear radiance clamped to [0.0, 1.0], i.e. as shown on a display. The
+// filters are separable (the spatial filters are sums of Gaussians), so they are applied to rows
+// and then columns, which is much faster than the equivalent 2D filters.
+class FlipMetric
+{
+public:
+    // The default number of pixels per degree: a 0.7 m wide 4K monitor viewed from 0.7 m.
+    static constexpr float DEFAULT_PIXELS_PER_DEGREE = 67.0f;
+
+    // Returns the mean FLIP error of the specified test image compared with the specified reference
+    // image, which are both linear RGB with the specified dimensions, stored in rows from the top.
+    static double compute(const float* pTest, const float* pReference, uint32_t width,
+        uint32_t height, float pixelsPerDegree = DEFAULT_PIXELS_PER_DEGREE)
+    {
+        FlipMetric metric(width, height, pixelsPerDegree);
+        Plane testColor = metric.toYCxCz(pTest);
+        Plane referenceColor = metric.toYCxCz(pReference);
+        Plane testFeatures = metric.getFeatures(testColor);
+        Plane referenceFeatures = metric.getFeatures(referenceColor);
+        metric.filterColor(testColor);
+        metric.filterColor(referenceColor);
+
+        // Combine the color and feature differences for each pixel, and compute the mean.
+        const size_t pixelCount = size_t(width) * height;
+        const float maxColorError = std::pow(getHyAB(getHuntLab(Vec3f{ 0.0f, 1.0f, 0.0f }),
+            getHuntLab(Vec3f{ 0.0f, 0.0f, 1.0f })), COLOR_EXPONENT);
+        double total = 0.0;
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            const float colorError = redistributeColorError(std::pow(
+                getHyAB(getHuntLab(fromYCxCz(&testColor[i * 3])),
+                    getHuntLab(fromYCxCz(&referenceColor[i * 3]))), COLOR_EXPONENT),
+                maxColorError);
+            const float featureError = std::pow(std::max(
+                std::abs(testFeatures[i * 2] - referenceFeatures[i * 2]),
+                std::abs(testFeatures[i * 2 + 1] - referenceFeatures[i * 2 + 1]))
+                / std::sqrt(2.0f), FEATURE_EXPONENT);
+            total += std::pow(colorError, 1.0f - featureError);
+        }
+
+        return pixelCount > 0 ? total / pixelCount : 0.0;
+    }
+
+private:
+    // An RGB, XYZ, or Lab color.
+    struct Vec3f
+    {
+        float x, y, z;
+    };
+
+    // Per-pixel values with a number of components, in rows from the top.
+    using Plane = vector<float>;
+
+    // The constants of the metric, from the paper.
+    static constexpr float COLOR_EXPONENT = 0.7f;
+    static constexpr float FEATURE_EXPONENT = 0.5f;
+    static constexpr float ERROR_CUTOFF = 0.4f;
+    static constexpr float ERROR_CUTOFF_VALUE = 0.95f;
+    static constexpr float FEATURE_WIDTH = 0.082f;
+
+    // The D65 white point, in XYZ.
+    static constexpr float WHITE_X = 0.950428545f;
+    static constexpr float WHITE_Y = 1.0f;
+    static constexpr float WHITE_Z = 1.088900371f;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    float m_pixelsPerDegree;
+
+    // Constructor.
+    FlipMetric(uint32_t width, uint32_t height, float pixelsPerDegree) :
+        m_width(width), m_height(height), m_pixelsPerDegree(pixelsPerDegree)
+    {
+    }
+
+    // Converts linear RGB to XYZ, and back.
+    static Vec3f rgbToXYZ(const Vec3f& c)
+    {
+        return {
+            0.4124564f * c.x + 0.3575761f * c.y + 0.1804375f * c.z,
+            0.2126729f * c.x + 0.7151522f * c.y + 0.0721750f * c.z,
+            0.0193339f * c.x + 0.1191920f * c.y + 0.9503041f * c.z };
+    }
+    static Vec3f xyzToRGB(const Vec3f& c)
+    {
+        return {
+            3.2404542f * c.x - 1.5371385f * c.y - 0.4985314f * c.z,
+            -0.9692660f * c.x + 1.8760108f * c.y + 0.0415560f * c.z,
+            0.0556434f * c.x - 0.2040259f * c.y + 1.0572252f * c.z };
+    }
+
+    // Converts an image from linear RGB (clamped to [0.0, 1.0]) to the YyCxCz opponent color space,
+    // a linearized form of CIELab, where the spatial filters are applied.
+    Plane toYCxCz(const float* pImage) const
+    {
+        const size_t pixelCount = size_t(m_width) * m_height;
+        Plane result(pixelCount * 3);
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            const float* pPixel = &pImage[i * 3];
+            const Vec3f xyz = rgbToXYZ({ clamp(pPixel[0], 0.0f, 1.0f),
+                clamp(pPixel[1], 0.0f, 1.0f), clamp(pPixel[2], 0.0f, 1.0f) });
+            result[i * 3] = 116.0f * xyz.y / WHITE_Y - 16.0f;
+            result[i * 3 + 1] = 500.0f * (xyz.x / WHITE_X - xyz.y / WHITE_Y);
+            result[i * 3 + 2] = 200.0f * (xyz.y / WHITE_Y - xyz.z / WHITE_Z);
+        }
+
+        return result;
+    }
+
+    // Converts a YyCxCz color to linear RGB, clamped to [0.0, 1.0].
+    static Vec3f fromYCxCz(const float* pColor)
+    {
+        const float y = (pColor[0] + 16.0f) / 116.0f;
+        const Vec3f rgb = xyzToRGB({ (pColor[1] / 500.0f + y) * WHITE_X, y * WHITE_Y,
+            (y - pColor[2] / 200.0f) * WHITE_Z });
+
+        return { clamp(rgb.x, 0.0f, 1.0f), clamp(rgb.y, 0.0f, 1.0f), clamp(rgb.z, 0.0f, 1.0f) };
+    }
+
+    // Converts linear RGB to CIELab, with the chroma scaled by the lightness (the Hunt effect:
+    // colors are less distinct when dark).
+    static Vec3f getHuntLab(const Vec3f& rgb)
+    {
+        const Vec3f xyz = rgbToXYZ(rgb);
+        auto f = [](float t)
+        {
+            static const float DELTA = 6.0f / 29.0f;
+            return t > DELTA * DELTA * DELTA
+                ? std::cbrt(t) : t / (3.0f * DELTA * DELTA) + 4.0f / 29.0f;
+        };
+        const float fx = f(xyz.x / WHITE_X);
+        const float fy = f(xyz.y / WHITE_Y);
+        const float fz = f(xyz.z / WHITE_Z);
+        const float l = 116.0f * fy - 16.0f;
+
+        return { l, 0.01f * l * 500.0f * (fx - fy), 0.01f * l * 200.0f * (fy - fz) };
+    }
+
+    // Returns the HyAB color difference of two Lab colors, which is better than Euclidean distance
+    // for large differences.
+    static float getHyAB(const Vec3f& a, const Vec3f& b)
+    {
+        const float da = a.y - b.y;
+        const float db = a.z - b.z;
+
+        return std::abs(a.x - b.x) + std::sqrt(da * da + db * db);
+    }
+
+    // Maps a color error to [0.0, 1.0], using more of the range for small errors.
+    static float redistributeColorError(float error, float maxError)
+    {
+        const float cutoff = ERROR_CUTOFF * maxError;
+        if (error < cutoff)
+        {
+            return ERROR_CUTOFF_VALUE / cutoff * error;
+        }
+
+        return ERROR_CUTOFF_VALUE
+            + (error - cutoff) / (maxError - cutoff) * (1.0f - ERROR_CUTOFF_VALUE);
+    }
+
+    // Filters the specified component of a plane in place with a separable kernel: the horizontal
+    // kernel on rows and then the vertical kernel on columns, with the pixels at the image edges
+    // extended. Both kernels have the same (odd) size, centered on the pixel.
+    void filterSeparable(const Plane& source, uint32_t componentCount, uint32_t component,
+        const vector<float>& horizontal, const vector<float>& vertical, float* pResult,
+        uint32_t resultStride) const
+    {
+        const int radius = static_cast<int>(horizontal.size() / 2);
+        vector<float> rows(size_t(m_width) * m_height);
+        Concurrency::parallel_for(0u, m_height, [&](uint32_t y)
+        {
+            for (uint32_t x = 0; x < m_width; x++)
+            {
+                float sum = 0.0f;
+                for (int k = -radius; k <= radius; k++)
+                {
+                    const int sx = clamp(static_cast<int>(x) + k, 0, static_cast<int>(m_width) - 1);
+                    sum += horizontal[k + radius]
+                        * source[(size_t(y) * m_width + sx) * componentCount + component];
+                }
+                rows[size_t(y) * m_width + x] = sum;
+            }
+        });
+        Concurrency::parallel_for(0u, m_height, [&](uint32_t y)
+        {
+            for (uint32_t x = 0; x < m_width; x++)
+            {
+                float sum = 0.0f;
+                for (int k = -radius; k <= radius; k++)
+                {
+                    const int sy =
+                        clamp(static_cast<int>(y) + k, 0, static_cast<int>(m_height) - 1);
+                    sum += vertical[k + radius] * rows[size_t(sy) * m_width + x];
+                }
+                pResult[(size_t(y) * m_width + x) * resultStride] = sum;
+            }
+        });
+    }
+
+    // Filters a YyCxCz plane in place with the contrast sensitivity function of each channel
+    // (achromatic, red-green, blue-yellow). Each is a sum of two Gaussians in visual degrees, and
+    // each Gaussian is filtered separately and then summed, normalized so the 2D kernel sums to
+    // one.
+    void filterColor(Plane& plane) const
+    {
+        static const float A1[] = { 1.0f, 1.0f, 34.1f };
+        static const float B1[] = { 0.0047f, 0.0053f, 0.04f };
+        static const float A2[] = { 0.0f, 0.0f, 13.5f };
+        static const float B2[] = { 1e-5f, 1e-5f, 0.025f };
+        const float maxB = 0.04f;
+        const int radius = static_cast<int>(
+            std::ceil(3.0f * std::sqrt(maxB / (2.0f * PI * PI)) * m_pixelsPerDegree));
+
+        const Plane source = plane;
+        vector<float> second(size_t(m_width) * m_height);
+        for (uint32_t channel = 0; channel < 3; channel++)
+        {
+            // Create the 1D kernel for each Gaussian, and get the sum of each 2D kernel.
+            vector<float> kernel1(2 * radius + 1), kernel2(2 * radius + 1);
+            float sum1 = 0.0f, sum2 = 0.0f;
+            for (int k = -radius; k <= radius; k++)
+            {
+                const float x = k / m_pixelsPerDegree;
+                kernel1[k + radius] = std::exp(-PI * PI * x * x / B1[channel]);
+                kernel2[k + radius] = std::exp(-PI * PI * x * x / B2[channel]);
+                sum1 += kernel1[k + radius];
+                sum2 += kernel2[k + radius];
+            }
+            const float weight1 = A1[channel] * std::sqrt(PI / B1[channel]);
+            const float weight2 = A2[channel] * std::sqrt(PI / B2[channel]);
+            const float total = weight1 * sum1 * sum1 + weight2 * sum2 * sum2;
+
+            filterSeparable(source, 3, channel, kernel1, kernel1, &plane[channel], 3);
+            if (weight2 > 0.0f)
+            {
+                filterSeparable(source, 3, channel, kernel2, kernel2, second.data(), 1);
+            }
+            for (size_t i = 0; i < second.size(); i++)
+            {
+                plane[i * 3 + channel] = (weight1 * plane[i * 3 + channel]
+                    + (weight2 > 0.0f ? weight2 * second[i] : 0.0f)) / total;
+            }
+        }
+    }
+
+    // Returns the edge and point features of a YyCxCz plane: the magnitudes of the first and second
+    // derivatives of the (normalized) achromatic channel, filtered with derivatives of a Gaussian,
+    // as two components per pixel.
+    Plane getFeatures(const Plane& color) const
+    {
+        const float sigma = 0.5f * FEATURE_WIDTH * m_pixelsPerDegree;
+        const int radius = static_cast<int>(std::ceil(3.0f * sigma));
+        const size_t pixelCount = size_t(m_width) * m_height;
+
+        // Create the Gaussian kernel and its first and second derivatives, with the positive and
+        // negative weights of the derivatives each summing to one.
+        vector<float> gaussian(2 * radius + 1), first(2 * radius + 1), second(2 * radius + 1);
+        for (int k = -radius; k <= radius; k++)
+        {
+            const float g = std::exp(-(k * k) / (2.0f * sigma * sigma));
+            gaussian[k + radius] = g;
+            first[k + radius] = -k * g;
+            second[k + radius] = (k * k / (sigma * sigma) - 1.0f) * g;
+        }
+        auto normalize = [](vector<float>& kernel, bool signedWeights)
+        {
+            float positive = 0.0f, negative = 0.0f;
+            for (float weight : kernel)
+            {
+                (weight > 0.0f ? positive : negative) += weight;
+            }
+            for (float& weight : kernel)
+            {
+                weight /= !signedWeights ? positive : weight > 0.0f ? positive : -negative;
+            }
+        };
+        normalize(gaussian, false);
+        normalize(first, true);
+        normalize(second, true);
+
+        // Get the achromatic channel, normalized to [0.0, 1.0].
+        Plane luminance(pixelCount);
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            luminance[i] = (color[i * 3] + 16.0f) / 116.0f;
+        }
+
+        // Filter in each direction, and combine the results as magnitudes.
+        vector<float> dx(pixelCount), dy(pixelCount), dxx(pixelCount), dyy(pixelCount);
+        filterSeparable(luminance, 1, 0, first, gaussian, dx.data(), 1);
+        filterSeparable(luminance, 1, 0, gaussian, first, dy.data(), 1);
+        filterSeparable(luminance, 1, 0, second, gaussian, dxx.data(), 1);
+        filterSeparable(luminance, 1, 0, gaussian, second, dyy.data(), 1);
+        Plane result(pixelCount * 2);
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            result[i * 2] = std::sqrt(dx[i] * dx[i] + dy[i] * dy[i]);
+            result[i * 2 + 1] = std::sqrt(dxx[i] * dxx[i] + dyy[i] * dyy[i]);
+        }
+
+        return result;
+    }
+};
+
+// Compares rendered images with a reference image, e.g. a high sample count render of the same
+// scene, to check that a change to sampling or traversal does not change the image, and to judge
+// an optimization by its error for the time spent rather than by speed alone.
+//
+// NOTE: The reference is a PFM file, as saved by Luma with a ".pfm" output path, so that it has the
+// linear radiance without any encoding or resizing.
+class ImageComparer
+{
+public:
+    // Loads the reference image from the PFM file at the specified path. Returns whether the file
+    // was loaded successfully; if not, error() describes the problem.
+    bool load(const string& filePath)
+    {
+        m_error.clear();
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file)
+        {
+            return fail("Unable to open \"" + filePath + "\".");
+        }
+
+        // Read the header: the "PF" identifier for color images, the dimensions, and the scale,
+        // which is negative for little-endian data. The header ends with a single whitespace
+        // character.
+        string identifier;
+        float scale = 0.0f;
+        file >> identifier >> m_width >> m_height >> scale;
+        file.get();
+        if (!file || identifier != "PF" || m_width == 0 || m_height == 0 || scale == 0.0f)
+        {
+            return fail("\"" + filePath + "\" is not a color PFM file.");
+        }
+
+        // Read the rows, which are stored from the bottom of the image to the top.
+        const size_t rowSize = size_t(m_width) * Framebuffer::NUM_COMPONENTS;
+        m_reference.resize(rowSize * m_height);
+        for (uint32_t row = 0; row < m_height; row++)
+        {
+            file.read(reinterpret_cast<char*>(&m_reference[(m_height - row - 1) * rowSize]),
+                rowSize * sizeof(float));
+        }
+        if (!file)
+        {
+            return fail("\"" + filePath + "\" is incomplete.");
+        }
+        if (scale > 0.0f)
+        {
+            for (float& value : m_reference)
+            {
+                uint8_t* pBytes = reinterpret_cast<uint8_t*>(&value);
+                std::swap(pBytes[0], pBytes[3]);
+                std::swap(pBytes[1], pBytes[2]);
+            }
+        }
+
+        return true;
+    }
+
+    // Returns the dimensions of the reference image.
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+
+    // Compares the specified framebuffer with the reference image, which must have the same
+    // dimensions.
+    ImageErrors compare(const Framebuffer& framebuffer) const
+    {
+        assert(framebuffer.width() == m_width && framebuffer.height() == m_height);
+
+        // Copy the framebuffer, which may be stored in a file, and accumulate the errors.
+        const size_t rowSize = size_t(m_width) * Framebuffer::NUM_COMPONENTS;
+        vector<float> image(rowSize * m_height);
+        for (uint32_t y = 0; y < m_height; y++)
+        {
+            ::memcpy(&image[y * rowSize], framebuffer.getRow(y), rowSize * sizeof(float));
+        }
+        static const double REL_MSE_EPSILON = 0.01;
+        double squaredError = 0.0, relativeError = 0.0;
+        for (size_t i = 0; i < image.size(); i++)
+        {
+            const double difference = double(image[i]) - m_reference[i];
+            squaredError += difference * difference;
+            const double reference = m_reference[i];
+            relativeError +=
+                difference * difference / (reference * reference + REL_MSE_EPSILON);
+        }
+
+        ImageErrors errors;
+        errors.mse = squaredError / image.size();
+        errors.rmse = std::sqrt(errors.mse);
+        errors.relMSE = relativeError / image.size();
+        errors.psnr = errors.mse > 0.0 ? 10.0 * std::log10(1.0 / errors.mse)
+            : std::numeric_limits<double>::infinity();
+        errors.flip = FlipMetric::compute(image.data(), m_reference.data(), m_width, m_height);
+
+        return errors;
+    }
+
+    // Returns a description of the error from the last call to load(), if any.
+    const string& error() const { return m_error; }
+
+private:
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    vector<float> m_reference;
+    string m_error;
+
+    // Records the specified error message, returning false for convenience.
+    bool fail(const string& message)
+    {
+        m_error = message;
+
+        return false;
+    }
+};
+
+} // namespace Luma
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "ImageCompare.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "SceneParser.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace Luma {
+
+// Runs the image regression tests listed in the manifest file at the specified path, and reports
+// the result of each test on the console. Returns whether every test passed.
+//
+// Each test renders a scene file at its own settings and compares the image with a reference image
+// of the same scene rendered with many more samples (see ImageComparer). The test fails if the
+// relative MSE exceeds the maximum for the test, which catches changes that add bias (e.g. a wrong
+// density or weight) or noise, while allowing changes that only move the noise around. Each line of
+// the manifest is a test, with these values:
+//
+//   <scene file> <reference PFM file> <maximum relative MSE>
+//
+// Paths are relative to the directory of the manifest. Blank lines and lines starting with "#" are
+// ignored.
+//
+// NOTE: A render shares its samples with a reference of the same scene (see the --compare option),
+// so its error is lower than that of an independent render with the same number of samples. The
+// maximum errors are set a few times higher than the error of the current renderer, so they are
+// not sensitive to small changes in the sampling.
+inline bool runImageTests(const string& manifestPath)
+{
+    std::ifstream manifest(manifestPath);
+    if (!manifest)
+    {
+        std::cerr << "Unable to open \"" << manifestPath << "\"." << std::endl;
+        return false;
+    }
+    const std::filesystem::path directory = std::filesystem::path(manifestPath).parent_path();
+
+    uint32_t testCount = 0;
+    uint32_t failedCount = 0;
+    string line;
+    for (uint32_t lineNumber = 1; std::getline(manifest, line); lineNumber++)
+    {
+        // Parse the test, skipping blank lines and comments.
+        std::istringstream values(line);
+        string sceneFile, referenceFile;
+        double maxRelMSE = 0.0;
+        if (!(values >> sceneFile) || sceneFile[0] == '#')
+        {
+            continue;
+        }
+        if (!(values >> referenceFile >> maxRelMSE) || maxRelMSE <= 0.0)
+        {
+            std::cerr
+                << "Invalid test in \"" << manifestPath << "\" at line " << lineNumber << "."
+                << std::endl;
+            return false;
+        }
+        testCount++;
+
+        // Load the scene and the reference image. A test that can't be run fails.
+        Scene scene;
+        RenderSettings settings;
+        ImageComparer comparer;
+        string error;
+        const string scenePath = (directory / sceneFile).string();
+        if (!loadSceneFile(scenePath, scene, settings, error))
+        {
+            std::cout << "FAIL " << sceneFile << ": " << error << std::endl;
+            failedCount++;
+            continue;
+        }
+        if (!comparer.load((directory / referenceFile).string()))
+        {
+            std::cout << "FAIL " << sceneFile << ": " << comparer.error() << std::endl;
+            failedCount++;
+            continue;
+        }
+        if (comparer.width() != settings.renderWidth()
+            || comparer.height() != settings.renderHeight())
+        {
+            std::cout
+                << "FAIL " << sceneFile << ": the reference image is " << comparer.width() << "x"
+                << comparer.height() << ", not " << settings.renderWidth() << "x"
+                << settings.renderHeight() << "." << std::endl;
+            failedCount++;
+            continue;
+        }
+
+        // Render the scene, and compare the image with the reference.
+        Framebuffer framebuffer(settings.renderWidth(), settings.renderHeight());
+        Camera camera(settings.camera, settings.aspect());
+        const RenderStats stats = render(scene, camera, framebuffer, settings, false);
+        const ImageErrors errors = comparer.compare(framebuffer);
+        const bool passed = errors.relMSE <= maxRelMSE;
+        failedCount += passed ? 0 : 1;
+        std::cout
+            << (passed ? "PASS " : "FAIL ") << sceneFile << ": relative MSE " << errors.relMSE
+            << " (maximum " << maxRelMSE << "), FLIP " << errors.flip << ", "
+            << stats.seconds << " seconds." << std::endl;
+    }
+
+    std::cout << testCount - failedCount << " of " << testCount << " tests passed." << std::endl;
+
+    return testCount > 0 && failedCount == 0;
+}
+
+} // namespace Luma
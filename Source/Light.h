@@ -0,0 +1,299 @@
+#pragma once
+
+#include "Element.h"
+#include "Ray.h"
+#include "Sphere.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+namespace Luma {
+
+// A sample of the light arriving at a point from a light source, for sampling lights explicitly
+// (next event estimation).
+struct LightSample
+{
+    // The (unit) direction from the point to the sampled point on the light, and the distance.
+    Vec3 direction;
+    float distance;
+
+    // The radiance emitted toward the point.
+    Vec3 radiance;
+
+    // The probability density of sampling the direction, with respect to solid angle.
+    float pdf;
+};
+
+// An interface for light sources: elements that emit light, and that can be sampled explicitly
+// from a point in the scene. Lights are also elements, so that rays can hit them, e.g. camera rays
+// or rays sampled from a surface, which then see their emitted radiance.
+//
+// NOTE: The probability densities are with respect to solid angle at the point being lit, so that
+// they can be compared with the densities of directions sampled from a surface, e.g. for multiple
+// importance sampling. A light must give the same density for a direction from pdf() as it does
+// from sample().
+class Light : public Element
+{
+public:
+    // Returns the radiance emitted by the light from the specified hit, toward the origin of a ray
+    // with the specified direction.
+    virtual Vec3 emitted(const Hit& hit, const Vec3& direction) const = 0;
+
+    // Samples a point on the light, as seen from the specified position, with the specified
+    // uniform random numbers in [0.0, 1.0). Returns whether the sample can contribute light, i.e.
+    // whether the point faces the position; if so, the sample is updated with the properties of the
+    // sample.
+    virtual bool sample(const Vec3& position, float u1, float u2, LightSample& sample) const = 0;
+
+    // Returns the probability density (with respect to solid angle) that sample() would choose
+    // the specified (unit) direction from the specified position, for a ray in that direction that
+    // hits the light with the specified hit.
+    virtual float pdf(const Vec3& position, const Vec3& direction, const Hit& hit) const = 0;
+
+    // Appends the values that define the light to the specified array, e.g. to hash the scene.
+    virtual void getParameters(vector<float>& parameters) const = 0;
+};
+
+// Computes two unit axes perpendicular to the specified unit vector and to each other, e.g. to
+// place points on a disk or directions in a cone around the vector.
+inline void getPerpendicularAxes(const Vec3& axis, Vec3& tangent, Vec3& bitangent)
+{
+    // Start with any vector that is not parallel to the axis.
+    const Vec3 other = std::abs(axis.x()) < 0.9f ? Vec3(1.0f, 0.0f, 0.0f) : Vec3(0.0f, 1.0f, 0.0f);
+    tangent = cross(axis, other).normalize();
+    bitangent = cross(axis, tangent);
+}
+
+// A light shaped as a disk, which emits a constant radiance from its front side, i.e. the side its
+// normal faces. This is a simple area light, e.g. for a lamp in a ceiling or a softbox.
+//
+// NOTE: The disk is sampled uniformly by area, with the concentric mapping (see sampleDisk()), and
+// the density is converted to solid angle with the distance and the angle at the light.
+class DiskLight : public Light
+{
+public:
+    // Constructor, with the center, normal (the direction that the light faces), radius, and
+    // emitted radiance of the disk.
+    DiskLight(const Vec3& center, const Vec3& normal, float radius, const Vec3& emission) :
+        m_center(center), m_normal(normal), m_radius(radius), m_emission(emission)
+    {
+        // Compute the axes of the disk, perpendicular to the normal.
+        m_normal.normalize();
+        getPerpendicularAxes(m_normal, m_tangent, m_bitangent);
+    }
+
+    // Overrides Element::intersect(). Both sides of the disk can be hit, and block light.
+    virtual bool intersect(const Ray& ray, Hit& hit) const override
+    {
+        // Intersect the plane of the disk, and check that the point is within the radius.
+        const float cosTheta = dot(ray.direction(), m_normal);
+        if (cosTheta == 0.0f)
+        {
+            return false;
+        }
+        const float t = dot(m_center - ray.origin(), m_normal) / cosTheta;
+        if (t < ray.tMin() || t > ray.tMax())
+        {
+            return false;
+        }
+        const Vec3 position = ray.at(t);
+        const Vec3 offset = position - m_center;
+        if (dot(offset, offset) > m_radius * m_radius)
+        {
+            return false;
+        }
+
+        hit.t = t;
+        hit.position = position;
+        hit.normal = m_normal;
+
+        return true;
+    }
+
+    // Overrides Light::emitted(). Only the front side emits light.
+    virtual Vec3 emitted(const Hit&, const Vec3& direction) const override
+    {
+        return dot(direction, m_normal) < 0.0f ? m_emission : Vec3();
+    }
+
+    // Overrides Light::sample().
+    virtual bool sample(
+        const Vec3& position, float u1, float u2, LightSample& sample) const override
+    {
+        // Choose a point on the disk, and compute the direction and distance to it.
+        float x = 0.0f, y = 0.0f;
+        sampleDisk(u1, u2, x, y);
+        const Vec3 point = m_center + (m_tangent * x + m_bitangent * y) * m_radius;
+        const Vec3 delta = point - position;
+        const float distanceSquared = dot(delta, delta);
+        sample.distance = std::sqrt(distanceSquared);
+        sample.direction = delta / sample.distance;
+
+        // Skip the point if the back of the disk faces the position. Otherwise convert the density
+        // by area (one over the area) to solid angle.
+        const float cosLight = -dot(sample.direction, m_normal);
+        if (cosLight <= 0.0f)
+        {
+            return false;
+        }
+        sample.pdf = distanceSquared / (cosLight * area());
+        sample.radiance = m_emission;
+
+        return true;
+    }
+
+    // Overrides Light::pdf().
+    virtual float pdf(const Vec3& position, const Vec3& direction, const Hit& hit) const override
+    {
+        const float cosLight = -dot(direction, m_normal);
+        if (cosLight <= 0.0f)
+        {
+            return 0.0f;
+        }
+        const Vec3 delta = hit.position - position;
+
+        return dot(delta, delta) / (cosLight * area());
+    }
+
+    // Overrides Light::getParameters().
+    virtual void getParameters(vector<float>& parameters) const override
+    {
+        parameters.insert(parameters.end(), { m_center.x(), m_center.y(), m_center.z(),
+            m_normal.x(), m_normal.y(), m_normal.z(), m_radius,
+            m_emission.r(), m_emission.g(), m_emission.b() });
+    }
+
+private:
+    Vec3 m_center;
+    Vec3 m_normal;
+    float m_radius;
+    Vec3 m_emission;
+    Vec3 m_tangent;
+    Vec3 m_bitangent;
+
+    // Returns the area of the disk.
+    float area() const { return PI * m_radius * m_radius; }
+};
+
+// A light shaped as a sphere, which emits a constant radiance from its surface, e.g. for a light
+// bulb or a distant sun.
+//
+// NOTE: The sphere is sampled by the solid angle it subtends, i.e. a uniform direction in the cone
+// from the point being lit that just contains the sphere (a spherical cap of directions), rather
+// than a point on its surface. Every sampled direction then hits the visible side of the sphere,
+// and the density is the same for all of them, so a small or distant sphere has far less variance
+// than sampling by area, where most points are on the far side or seen at a grazing angle. Points
+// inside the sphere can't see its (outward facing) surface, and receive no light from it.
+class SphereLight : public Light
+{
+public:
+    // Constructor, with the center, radius, and emitted radiance of the sphere.
+    SphereLight(const Vec3& center, float radius, const Vec3& emission) :
+        m_center(center), m_radius(radius), m_emission(emission)
+    {
+    }
+
+    // Overrides Element::intersect().
+    virtual bool intersect(const Ray& ray, Hit& hit) const override
+    {
+        return intersectSphere(m_center, m_radius, ray, hit);
+    }
+
+    // Overrides Light::emitted(). Only the outside of the sphere emits light.
+    virtual Vec3 emitted(const Hit& hit, const Vec3& direction) const override
+    {
+        return dot(direction, hit.normal) < 0.0f ? m_emission : Vec3();
+    }
+
+    // Overrides Light::sample().
+    virtual bool sample(
+        const Vec3& position, float u1, float u2, LightSample& sample) const override
+    {
+        // Compute the cone of directions to the sphere, skipping points inside it.
+        const Vec3 delta = m_center - position;
+        const float distanceSquared = dot(delta, delta);
+        float oneMinusCosMax = 0.0f;
+        if (!getCone(distanceSquared, oneMinusCosMax))
+        {
+            return false;
+        }
+
+        // Choose a direction uniformly in the cone, i.e. with a cosine of the angle to the center
+        // distributed uniformly between the cosine of the cone angle and one, and a uniform angle
+        // around the center.
+        const float distance = std::sqrt(distanceSquared);
+        const Vec3 axis = delta / distance;
+        Vec3 tangent, bitangent;
+        getPerpendicularAxes(axis, tangent, bitangent);
+        const float cosTheta = 1.0f - u1 * oneMinusCosMax;
+        const float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+        const float phi = 2.0f * PI * u2;
+        sample.direction =
+            axis * cosTheta + (tangent * std::cos(phi) + bitangent * std::sin(phi)) * sinTheta;
+
+        // Compute the distance to the near side of the sphere in that direction, clamping the
+        // discriminant for directions at the edge of the cone.
+        const float discriminant =
+            m_radius * m_radius - distanceSquared * sinTheta * sinTheta;
+        sample.distance = distance * cosTheta - std::sqrt(std::max(discriminant, 0.0f));
+        sample.radiance = m_emission;
+        sample.pdf = 1.0f / (2.0f * PI * oneMinusCosMax);
+
+        return true;
+    }
+
+    // Overrides Light::pdf(). Any direction that hits the sphere is in the cone.
+    virtual float pdf(const Vec3& position, const Vec3&, const Hit&) const override
+    {
+        const Vec3 delta = m_center - position;
+        float oneMinusCosMax = 0.0f;
+
+        return getCone(dot(delta, delta), oneMinusCosMax) ? 1.0f / (2.0f * PI * oneMinusCosMax)
+                                                          : 0.0f;
+    }
+
+    // Overrides Light::getParameters().
+    virtual void getParameters(vector<float>& parameters) const override
+    {
+        parameters.insert(parameters.end(), { m_center.x(), m_center.y(), m_center.z(), m_radius,
+            m_emission.r(), m_emission.g(), m_emission.b() });
+    }
+
+private:
+    Vec3 m_center;
+    float m_radius;
+    Vec3 m_emission;
+
+    // Computes one minus the cosine of the angle of the cone that contains the sphere, from a
+    // point at the specified squared distance from its center. Returns whether the point is
+    // outside the sphere; if not, there is no cone.
+    //
+    // NOTE: For a small or distant sphere the cosine is very close to one, and subtracting it from
+    // one would lose most of the precision, so a Taylor series of 1 - sqrt(1 - x) is used instead.
+    bool getCone(float distanceSquared, float& oneMinusCosMax) const
+    {
+        const float sinSquaredMax = m_radius * m_radius / distanceSquared;
+        if (sinSquaredMax >= 1.0f)
+        {
+            return false;
+        }
+        oneMinusCosMax = sinSquaredMax < 1e-3f
+            ? sinSquaredMax * (0.5f + sinSquaredMax * 0.125f)
+            : 1.0f - std::sqrt(1.0f - sinSquaredMax);
+
+        return true;
+    }
+};
+
+// Returns the multiple importance sampling weight for a sample taken with a strategy with the
+// specified density, when another strategy with the other specified density could also have taken
+// it. This is the power heuristic with an exponent of two, from Veach's thesis (1997), which gives
+// most of the weight to the strategy with the higher density.
+inline float powerHeuristic(float pdf, float otherPdf)
+{
+    const float squared = pdf * pdf;
+    const float otherSquared = otherPdf * otherPdf;
+
+    return squared > 0.0f ? squared / (squared + otherSquared) : 0.0f;
+}
+
+} // namespace Luma
@@ -0,0 +1,133 @@
+#pragma once
+
+namespace Luma {
+
+// A file mapped into memory, so that its contents can be accessed directly without reading them
+// into a separate buffer. Pages of the file are loaded by the operating system as they are used, and
+// for writable files, modified pages are written back to the file by the operating system, so the
+// file can be much larger than the available memory.
+class MappedFile
+{
+public:
+    // Opens the file at the specified path and maps all of it for reading. Returns null if the file
+    // could not be opened or mapped, e.g. if it doesn't exist or is empty.
+    static shared_ptr<MappedFile> openRead(const string& filePath)
+    {
+        shared_ptr<MappedFile> pFile(new MappedFile());
+        pFile->m_hFile = ::CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (pFile->m_hFile == INVALID_HANDLE_VALUE)
+        {
+            return nullptr;
+        }
+
+        LARGE_INTEGER fileSize = {};
+        if (!::GetFileSizeEx(pFile->m_hFile, &fileSize) || fileSize.QuadPart == 0)
+        {
+            return nullptr;
+        }
+        pFile->m_size = static_cast<size_t>(fileSize.QuadPart);
+
+        pFile->m_hMapping =
+            ::CreateFileMappingA(pFile->m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!pFile->m_hMapping)
+        {
+            return nullptr;
+        }
+
+        pFile->m_pData = static_cast<uint8_t*>(
+            ::MapViewOfFile(pFile->m_hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (!pFile->m_pData)
+        {
+            return nullptr;
+        }
+
+        return pFile;
+    }
+
+    // Creates a file of the specified size at the specified path, replacing any existing file, and
+    // maps all of it for reading and writing. A temporary file is deleted when it is closed. Returns
+    // null if the file could not be created or mapped, e.g. if there is not enough disk space.
+    static shared_ptr<MappedFile> create(const string& filePath, uint64_t size, bool temporary)
+    {
+        shared_ptr<MappedFile> pFile(new MappedFile());
+        DWORD flags = temporary
+            ? FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE : FILE_ATTRIBUTE_NORMAL;
+        pFile->m_hFile = ::CreateFileA(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+            CREATE_ALWAYS, flags, nullptr);
+        if (pFile->m_hFile == INVALID_HANDLE_VALUE || size == 0)
+        {
+            return nullptr;
+        }
+        pFile->m_size = static_cast<size_t>(size);
+
+        // Creating the mapping with the size extends the file to that size.
+        pFile->m_hMapping = ::CreateFileMappingA(pFile->m_hFile, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+        if (!pFile->m_hMapping)
+        {
+            return nullptr;
+        }
+
+        pFile->m_pData = static_cast<uint8_t*>(
+            ::MapViewOfFile(pFile->m_hMapping, FILE_MAP_WRITE, 0, 0, 0));
+        if (!pFile->m_pData)
+        {
+            return nullptr;
+        }
+
+        return pFile;
+    }
+
+    // Destructor.
+    ~MappedFile()
+    {
+        if (m_pData)
+        {
+            ::UnmapViewOfFile(m_pData);
+        }
+        if (m_hMapping)
+        {
+            ::CloseHandle(m_hMapping);
+        }
+        if (m_hFile != INVALID_HANDLE_VALUE)
+        {
+            ::CloseHandle(m_hFile);
+        }
+    }
+
+    // Returns the contents of the file. The contents can only be modified if the file was created
+    // with create(), i.e. it is mapped for writing.
+    uint8_t* data() { return m_pData; }
+    const uint8_t* data() const { return m_pData; }
+
+    // Returns the size of the file, in bytes.
+    size_t size() const { return m_size; }
+
+    // Starts writing the modified pages in the specified range of the file back to the file, and
+    // removes them from the working set of the process, i.e. the memory used for those pages can be
+    // reused right away. The pages are read back from the file if they are used again.
+    //
+    // NOTE: Calling VirtualUnlock() on pages that are not locked removes them from the working set;
+    // this is documented behavior, not an error.
+    void flush(size_t offset, size_t size)
+    {
+        ::FlushViewOfFile(m_pData + offset, size);
+        ::VirtualUnlock(m_pData + offset, size);
+    }
+
+private:
+    HANDLE m_hFile = INVALID_HANDLE_VALUE;
+    HANDLE m_hMapping = nullptr;
+    uint8_t* m_pData = nullptr;
+    size_t m_size = 0;
+
+    // Constructor, which is private: use openRead() or create() to create a mapped file.
+    MappedFile() {}
+
+    // Copying is not supported, since the handles are owned by the object.
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+} // namespace Luma
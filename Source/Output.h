@@ -0,0 +1,224 @@
+#pragma once
+
+#include "AOV.h"
+#include "EXRWriter.h"
+#include "Framebuffer.h"
+#include "Image.h"
+#include "MappedFile.h"
+#include "Renderer.h"
+#include "Trace.h"
+
+#include <fstream>
+
+namespace Luma {
+
+// The file formats for output images.
+enum class OutputFormat
+{
+    PNG, // A color encoded 8-bit image, resized by the scale and filter in the render settings.
+    PFM, // The linear radiance as 32-bit floats.
+    EXR, // The linear radiance as 16-bit half floats, with the OpenEXR settings.
+};
+
+// Returns the output format for the specified path, which is determined by the file extension:
+// ".pfm" and ".exr" (in any case) for those formats, and any other extension for PNG.
+inline OutputFormat getOutputFormat(const string& path)
+{
+    string extension = path.substr(std::min(path.rfind('.'), path.size()));
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+        [](char c) { return static_cast<char>(::tolower(c)); });
+    if (extension == ".pfm")
+    {
+        return OutputFormat::PFM;
+    }
+    else if (extension == ".exr")
+    {
+        return OutputFormat::EXR;
+    }
+
+    return OutputFormat::PNG;
+}
+
+// Writes the framebuffer as an output image to the specified stream, which must be opened in binary
+// mode, with the format for the output path in the specified settings (see getOutputFormat()).
+// Returns whether the image was written successfully.
+inline bool writeOutput(
+    const Framebuffer& framebuffer, const RenderSettings& settings, std::ostream& stream)
+{
+    const OutputFormat format = getOutputFormat(settings.outputPath);
+    if (format == OutputFormat::PFM)
+    {
+        TraceScope scope("Write PFM");
+        return framebuffer.savePFM(stream);
+    }
+    else if (format == OutputFormat::EXR)
+    {
+        TraceScope scope("Write EXR");
+        EXRWriter writer(settings.exrCompression, settings.exrTileSize);
+        if (settings.isCropped())
+        {
+            writer.setDisplayWindow(
+                settings.width, settings.height, settings.cropX, settings.cropY);
+        }
+        return writer.write(stream, framebuffer);
+    }
+
+    // If the framebuffer is stored in a file, store the image in a file as well, next to it.
+    shared_ptr<MappedFile> pImageFile;
+    if (framebuffer.isSpilled())
+    {
+        pImageFile = MappedFile::create(settings.spillPath + ".image",
+            Image::dataSize(framebuffer.width(), framebuffer.height()), true);
+        if (!pImageFile)
+        {
+            return false;
+        }
+    }
+    Image image(framebuffer.width(), framebuffer.height(), pImageFile);
+    {
+        TraceScope scope("Encode colors");
+        image.setFromFramebuffer(framebuffer, settings.encoding);
+    }
+    TraceScope scope("Write PNG");
+
+    return image.savePNG(stream, settings.scale, settings.filter);
+}
+
+// Saves the framebuffer to the output path in the specified settings. PFM and OpenEXR files store
+// the linear radiance, and PNG files store a color encoded image resized by the scale and filter in
+// the settings. Returns whether the file was saved successfully.
+inline bool saveOutput(const Framebuffer& framebuffer, const RenderSettings& settings)
+{
+    std::ofstream file(settings.outputPath, std::ios::binary);
+
+    return writeOutput(framebuffer, settings, file);
+}
+
+// Saves the specified AOV from the specified buffer as a PFM file at the AOV path in the settings
+// (see RenderSettings::getAOVPath()), with three components ("PF") or one ("Pf") per pixel. Returns
+// whether the file was saved successfully.
+inline bool saveAOV(const AOVBuffer& buffer, AOV aov, const RenderSettings& settings)
+{
+    TraceScope scope("Write AOV");
+    std::ofstream file(settings.getAOVPath(aov), std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    // Write the header, where a negative scale indicates little-endian data, and then the rows,
+    // starting from the bottom.
+    const uint32_t components = aovComponents(aov);
+    file
+        << (components == 3 ? "PF" : "Pf") << "\n"
+        << buffer.width() << " " << buffer.height() << "\n-1.0\n";
+    const size_t rowSize = size_t(buffer.width()) * components;
+    for (uint32_t row = 0; row < buffer.height(); row++)
+    {
+        const float* pRow = buffer.getPlane(aov) + (buffer.height() - row - 1) * rowSize;
+        file.write(reinterpret_cast<const char*>(pRow), rowSize * sizeof(float));
+    }
+    file.flush();
+
+    return static_cast<bool>(file);
+}
+
+// Saves a false-color heatmap of the metric in the settings from the specified cost map, as a PNG
+// file at the heatmap path (see RenderSettings::getHeatmapPath()), resized by the scale and filter
+// in the settings like the output image. The colors are scaled so that the most costly pixel is the
+// brightest. Returns whether the file was saved successfully.
+inline bool saveHeatmap(const CostMap& costMap, const RenderSettings& settings)
+{
+    TraceScope scope("Write heatmap");
+    Image image(costMap.width(), costMap.height());
+    const float maxCost = static_cast<float>(std::max(costMap.getMax(settings.heatmapMetric), 1u));
+    uint8_t* pColor = image.getImageData();
+    for (uint32_t y = 0; y < costMap.height(); y++)
+    {
+        for (uint32_t x = 0; x < costMap.width(); x++, pColor += 3)
+        {
+            getHeatmapColor(costMap.get(x, y).get(settings.heatmapMetric) / maxCost, pColor);
+        }
+    }
+
+    return image.savePNG(settings.getHeatmapPath(), settings.scale, settings.filter);
+}
+
+// Saves output images on a background thread, so that the next frame of an animation can be
+// rendered while the previous frame is encoded and written. Saving then adds no time to rendering,
+// as long as it takes less time than rendering a frame.
+//
+// NOTE: One image is saved at a time, and the framebuffer must not be changed until it has been
+// saved, i.e. until the next call to save() or finish() returns. Rendering into two framebuffers in
+// turn (double buffering) allows one to be rendered while the other is saved.
+class OutputWriter
+{
+public:
+    // Constructor.
+    OutputWriter() {}
+
+    // Destructor, which waits for the image being saved.
+    ~OutputWriter() { finish(); }
+
+    // Starts saving the framebuffer to the output path in the specified settings (see
+    // saveOutput()), after waiting for the previous image to be saved. The file at the specified
+    // path, if any, is deleted once the image is saved, e.g. the checkpoint of the image.
+    void save(const Framebuffer& framebuffer, const RenderSettings& settings,
+        const string& completedPath = string())
+    {
+        finish();
+        m_thread = std::thread([this, &framebuffer, settings, completedPath]()
+        {
+            Tracer::setThreadName("Output");
+            TraceScope scope("Save output", "frame", settings.frame);
+            auto startTime = std::chrono::high_resolution_clock::now();
+            if (!saveOutput(framebuffer, settings))
+            {
+                m_error = m_error.empty() ? "Unable to save \"" + settings.outputPath + "\"."
+                    : m_error;
+                return;
+            }
+            if (!completedPath.empty())
+            {
+                std::remove(completedPath.c_str());
+            }
+            auto endTime = std::chrono::high_resolution_clock::now();
+            m_seconds += std::chrono::duration<double>(endTime - startTime).count();
+            m_savedCount++;
+        });
+    }
+
+    // Waits for the image being saved, if any. Returns whether all the images have been saved
+    // successfully; if not, error() describes the first problem.
+    bool finish()
+    {
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+
+        return m_error.empty();
+    }
+
+    // Returns the number of images saved, and the total time spent saving them, in seconds. These
+    // are only up to date after finish().
+    uint32_t savedCount() const { return m_savedCount; }
+    double seconds() const { return m_seconds; }
+
+    // Returns a description of the first error from saving an image, if any. This is only up to
+    // date after finish().
+    const string& error() const { return m_error; }
+
+private:
+    // The thread saving an image, and the results, which are only changed by the thread.
+    std::thread m_thread;
+    uint32_t m_savedCount = 0;
+    double m_seconds = 0.0;
+    string m_error;
+
+    // Copying is not supported, since the thread refers to the object.
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+};
+
+} // namespace Luma
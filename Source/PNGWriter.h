@@ -0,0 +1,295 @@
+#pragma once
+
+#include "Deflate.h"
+
+#include <ostream>
+#include <ppl.h>
+
+namespace Luma {
+
+// A streaming writer for 8-bit RGB PNG files, to any output stream (e.g. a file). Rows are collected
+// into bands, and each band is filtered, compressed, and written to the stream once it is full, so
+// the memory used is constant regardless of the image size: there is never a buffer for the whole
+// image or for the whole compressed data.
+//
+// NOTE: Each band is divided into strips which are filtered and compressed in parallel. Each strip
+// is compressed separately, with the preceding 32 KB of (filtered) data as the preset dictionary so
+// that the compression ratio is almost unaffected, and ends with a sync flush so that the compressed
+// strips can simply be concatenated into a single valid zlib stream. The Adler-32 checksum of the
+// stream is combined from the checksums of the strips.
+class PNGWriter
+{
+public:
+    static const uint8_t NUM_COMPONENTS = 3;
+
+    // Starts writing a PNG file to the specified stream, which must be opened in binary mode, for
+    // an image with the specified dimensions, and writes the file header. Returns whether the
+    // header was written successfully.
+    bool open(std::ostream& stream, uint32_t width, uint32_t height)
+    {
+        m_pStream = &stream;
+        if (!stream)
+        {
+            return false;
+        }
+
+        m_width = width;
+        m_height = height;
+        m_rowCount = 0;
+        m_adler = 1;
+        m_rowSize = size_t(width) * NUM_COMPONENTS;
+        m_previousRow.assign(m_rowSize, 0);
+        m_history.clear();
+        m_compressed.clear();
+
+        // Choose the strip height so that each strip has enough data to compress efficiently, and
+        // the band height so that there are a few strips per thread.
+        static const size_t MIN_STRIP_SIZE = 1 << 18;
+        m_stripHeight = static_cast<uint32_t>(std::max(size_t(1), MIN_STRIP_SIZE / m_rowSize));
+        const uint32_t stripCount = std::max(1u, std::thread::hardware_concurrency() * 2);
+        m_band.resize(m_rowSize * m_stripHeight * stripCount);
+        m_bandRows = 0;
+
+        // Write the PNG signature, and the header chunk: the dimensions, the bit depth (8), the
+        // color type (2, for RGB), and the compression, filter, and interlace methods (all zero).
+        static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        m_pStream->write(reinterpret_cast<const char*>(SIGNATURE), sizeof(SIGNATURE));
+        uint8_t header[13] = { 0 };
+        writeBigEndian(header, width);
+        writeBigEndian(header + 4, height);
+        header[8] = 8;
+        header[9] = 2;
+        writeChunk("IHDR", header, sizeof(header));
+
+        // Start the zlib stream for the image data with its header, indicating deflate compression
+        // with a 32 KB window and the default compression level.
+        m_compressed.push_back(0x78);
+        m_compressed.push_back(0x9c);
+
+        return static_cast<bool>(*m_pStream);
+    }
+
+    // Adds the next row of the image, which must have the width of the image.
+    void writeRow(const uint8_t* pRow)
+    {
+        assert(m_rowCount < m_height);
+
+        ::memcpy(&m_band[m_bandRows * m_rowSize], pRow, m_rowSize);
+        m_bandRows++;
+        m_rowCount++;
+        if (m_bandRows * m_rowSize == m_band.size())
+        {
+            writeBand(false);
+        }
+    }
+
+    // Finishes the file, after all rows of the image have been added, and flushes the stream.
+    // Returns whether the file was written successfully. This does not close the stream.
+    bool close()
+    {
+        assert(m_rowCount == m_height);
+
+        // Write the last band, which finishes the zlib stream, and then the checksum of the
+        // uncompressed data, in big-endian order.
+        writeBand(true);
+        uint8_t checksum[4];
+        writeBigEndian(checksum, m_adler);
+        m_compressed.insert(m_compressed.end(), checksum, checksum + sizeof(checksum));
+        writeChunk("IDAT", m_compressed.data(), m_compressed.size());
+        m_compressed.clear();
+
+        // Write the end chunk.
+        writeChunk("IEND", nullptr, 0);
+        m_pStream->flush();
+
+        return static_cast<bool>(*m_pStream);
+    }
+
+    // Filters a row of an image for better compression, storing the filter type followed by the
+    // filtered row in the specified buffer. The previous row is the unfiltered row above.
+    //
+    // NOTE: Each of the five PNG filters is tried, and the one with the smallest sum of absolute
+    // (signed) values is used, which is the heuristic recommended by the PNG specification.
+    static void filterRow(const uint8_t* pRow, const uint8_t* pPreviousRow, size_t rowSize,
+        uint8_t* pFiltered, uint8_t* pCandidate)
+    {
+        typedef uint32_t (*FilterFunction)(const uint8_t*, const uint8_t*, size_t, uint8_t*);
+        static const FilterFunction FILTERS[] = { &applyFilter<0>, &applyFilter<1>,
+            &applyFilter<2>, &applyFilter<3>, &applyFilter<4> };
+
+        uint32_t bestSum = UINT32_MAX;
+        for (uint8_t filter = 0; filter < 5; filter++)
+        {
+            pCandidate[0] = filter;
+            uint32_t sum = FILTERS[filter](pRow, pPreviousRow, rowSize, pCandidate + 1);
+            if (sum < bestSum)
+            {
+                bestSum = sum;
+                ::memcpy(pFiltered, pCandidate, rowSize + 1);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t WINDOW_SIZE = 32768;
+
+    std::ostream* m_pStream = nullptr;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_rowCount = 0;
+    uint32_t m_adler = 1;
+    size_t m_rowSize = 0;
+
+    // The band of rows that have not been written yet, and the height of the strips in a band.
+    vector<uint8_t> m_band;
+    uint32_t m_bandRows = 0;
+    uint32_t m_stripHeight = 1;
+
+    // The last (unfiltered) row of the previous band, and the last 32 KB of filtered data of the
+    // previous band, which is the dictionary for the first strip of the next band.
+    vector<uint8_t> m_previousRow;
+    vector<uint8_t> m_history;
+
+    // Compressed data that has not been written to the file yet.
+    vector<uint8_t> m_compressed;
+
+    // Filters and compresses the rows in the band, and writes the compressed data to the file. For
+    // the last band, the zlib stream is finished.
+    void writeBand(bool last)
+    {
+        // Filter the rows in parallel, after the history from the previous band, so that every
+        // strip has the preceding data available as a contiguous dictionary. Each row only depends
+        // on the unfiltered row above it.
+        const size_t filteredRowSize = m_rowSize + 1;
+        const size_t historySize = m_history.size();
+        vector<uint8_t> filtered(historySize + m_bandRows * filteredRowSize);
+        ::memcpy(filtered.data(), m_history.data(), historySize);
+        const uint32_t stripCount = (m_bandRows + m_stripHeight - 1) / m_stripHeight;
+        Concurrency::parallel_for(0u, stripCount, [&](uint32_t strip)
+        {
+            vector<uint8_t> candidate(filteredRowSize);
+            const uint32_t end = std::min((strip + 1) * m_stripHeight, m_bandRows);
+            for (uint32_t row = strip * m_stripHeight; row < end; row++)
+            {
+                const uint8_t* pRow = &m_band[row * m_rowSize];
+                const uint8_t* pPrevious = row > 0 ? pRow - m_rowSize : m_previousRow.data();
+                filterRow(pRow, pPrevious, m_rowSize,
+                    &filtered[historySize + row * filteredRowSize], candidate.data());
+            }
+        });
+
+        // Compress the strips in parallel, along with their checksums. The last strip of the image
+        // finishes the stream, and the other strips end with a sync flush.
+        vector<vector<uint8_t>> outputs(std::max(stripCount, 1u));
+        vector<uint32_t> adlers(outputs.size(), 1);
+        vector<size_t> sizes(outputs.size(), 0);
+        Concurrency::parallel_for(0u, static_cast<uint32_t>(outputs.size()), [&](uint32_t strip)
+        {
+            const size_t start = historySize + size_t(strip) * m_stripHeight * filteredRowSize;
+            const size_t end = std::min(start + size_t(m_stripHeight) * filteredRowSize,
+                filtered.size());
+            const size_t size = end - start;
+            const size_t dictionarySize = std::min(start, WINDOW_SIZE);
+            const bool finish = last && strip + 1 == outputs.size();
+
+            Deflater deflater;
+            deflater.setDictionary(filtered.data() + start - dictionarySize, dictionarySize);
+            deflater.compress(filtered.data() + start, size,
+                finish ? Deflater::Flush::Finish : Deflater::Flush::Sync, outputs[strip]);
+            adlers[strip] = adler32(1, filtered.data() + start, size);
+            sizes[strip] = size;
+        });
+
+        // Combine the checksums and write the compressed strips in order, as image data chunks
+        // once there is enough data.
+        static const size_t CHUNK_SIZE = 1 << 16;
+        for (size_t strip = 0; strip < outputs.size(); strip++)
+        {
+            m_adler = adler32Combine(m_adler, adlers[strip], sizes[strip]);
+            m_compressed.insert(m_compressed.end(), outputs[strip].begin(), outputs[strip].end());
+            if (m_compressed.size() >= CHUNK_SIZE)
+            {
+                writeChunk("IDAT", m_compressed.data(), m_compressed.size());
+                m_compressed.clear();
+            }
+        }
+
+        // Keep the last row and the last 32 KB of filtered data for the next band.
+        if (m_bandRows > 0)
+        {
+            ::memcpy(m_previousRow.data(), &m_band[(m_bandRows - 1) * m_rowSize], m_rowSize);
+        }
+        const size_t keep = std::min(filtered.size(), WINDOW_SIZE);
+        m_history.assign(filtered.end() - keep, filtered.end());
+        m_bandRows = 0;
+    }
+
+    // Applies the specified PNG filter to a row, storing the filtered row in the destination and
+    // returning the sum of absolute (signed) values. The filter is a template parameter so that each
+    // filter has its own loop, without a branch for the filter type for every byte.
+    template<int FILTER>
+    static uint32_t applyFilter(
+        const uint8_t* pRow, const uint8_t* pPreviousRow, size_t rowSize, uint8_t* pDst)
+    {
+        uint32_t sum = 0;
+        for (size_t i = 0; i < rowSize; i++)
+        {
+            int left = i >= NUM_COMPONENTS ? pRow[i - NUM_COMPONENTS] : 0;
+            int up = pPreviousRow[i];
+            int upLeft = i >= NUM_COMPONENTS ? pPreviousRow[i - NUM_COMPONENTS] : 0;
+            int predicted = 0;
+            if (FILTER == 1) predicted = left;
+            else if (FILTER == 2) predicted = up;
+            else if (FILTER == 3) predicted = (left + up) / 2;
+            else if (FILTER == 4) predicted = paeth(left, up, upLeft);
+            pDst[i] = static_cast<uint8_t>(pRow[i] - predicted);
+            sum += std::abs(static_cast<int8_t>(pDst[i]));
+        }
+
+        return sum;
+    }
+
+    // Computes the Paeth predictor: whichever of the left, up, and upper left values is closest to
+    // left + up - upLeft.
+    static int paeth(int left, int up, int upLeft)
+    {
+        int estimate = left + up - upLeft;
+        int distanceLeft = std::abs(estimate - left);
+        int distanceUp = std::abs(estimate - up);
+        int distanceUpLeft = std::abs(estimate - upLeft);
+        if (distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft) return left;
+        if (distanceUp <= distanceUpLeft) return up;
+        return upLeft;
+    }
+
+    // Stores a 32-bit value in big-endian order, as used by PNG files.
+    static void writeBigEndian(uint8_t* pDst, uint32_t value)
+    {
+        pDst[0] = static_cast<uint8_t>(value >> 24);
+        pDst[1] = static_cast<uint8_t>(value >> 16);
+        pDst[2] = static_cast<uint8_t>(value >> 8);
+        pDst[3] = static_cast<uint8_t>(value);
+    }
+
+    // Writes a chunk to the stream: the data length, the type, the data, and the CRC of the type and
+    // the data.
+    void writeChunk(const char* type, const uint8_t* pData, size_t size)
+    {
+        uint8_t length[4];
+        writeBigEndian(length, static_cast<uint32_t>(size));
+        m_pStream->write(reinterpret_cast<const char*>(length), sizeof(length));
+        m_pStream->write(type, 4);
+        if (size > 0)
+        {
+            m_pStream->write(reinterpret_cast<const char*>(pData), size);
+        }
+
+        uint32_t crc = crc32(0, reinterpret_cast<const uint8_t*>(type), 4);
+        crc = crc32(crc, pData, size);
+        uint8_t checksum[4];
+        writeBigEndian(checksum, crc);
+        m_pStream->write(reinterpret_cast<const char*>(checksum), sizeof(checksum));
+    }
+};
+
+} // namespace Luma
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "Utils.h"
+#include "Vec3.h"
+
+#include <numeric>
+
+namespace Luma {
+
+// The reasons that a path ends.
+enum class PathEnd
+{
+    Escaped,  // The last ray missed the scene, and was shaded with the background.
+    MaxDepth, // The path reached the maximum number of segments.
+    Light,    // The last ray hit a light, which doesn't reflect light.
+};
+
+// Returns the name of the specified path end, for reports.
+inline const char* pathEndName(PathEnd end)
+{
+    static const char* NAMES[] = { "escaped", "max depth", "light" };
+
+    return NAMES[static_cast<int>(end)];
+}
+
+// The state of a path being traced, for path statistics: the throughput, i.e. the fraction of the
+// light arriving at the current vertex that reaches the camera, and the number of surface bounces.
+struct PathState
+{
+    Vec3 throughput = Vec3(1.0f, 1.0f, 1.0f);
+    int bounces = 0;
+};
+
+// Statistics of the paths traced for a render: histograms of the path length (surface bounces), of
+// the reason each path ended, and of the throughput when it ended. These are the data needed to
+// tune the maximum depth against the cost of long paths: e.g. if most paths escape long before the
+// maximum depth, a smaller depth loses little, and paths ending with a tiny throughput contribute
+// little to the image.
+//
+// NOTE: Each render thread collects statistics in its own object, which are merged when the thread
+// is done, so there is no contention. Adding a path only increments a few counters.
+class PathStats
+{
+public:
+    // The longest path length with a separate bin; longer paths are counted in the last bin.
+    static const int MAX_LENGTH = 32;
+
+    // The number of throughput bins. Each bin covers a factor of two, i.e. [0.5, 1.0], [0.25, 0.5),
+    // etc., with the first bin including anything higher and the last bin anything lower.
+    static const int THROUGHPUT_BINS = 16;
+
+    // Adds a path that ended for the specified reason, after the specified number of bounces and
+    // with the specified throughput.
+    void addPath(PathEnd end, int length, const Vec3& throughput)
+    {
+        m_lengths[std::min(length, MAX_LENGTH)]++;
+        m_ends[static_cast<int>(end)]++;
+        m_throughputs[getThroughputBin(throughput)]++;
+        m_totalLength += length;
+    }
+
+    // Adds the statistics of the specified object, e.g. those collected by another thread.
+    void merge(const PathStats& other)
+    {
+        for (int i = 0; i <= MAX_LENGTH; i++)
+        {
+            m_lengths[i] += other.m_lengths[i];
+        }
+        for (int i = 0; i < END_COUNT; i++)
+        {
+            m_ends[i] += other.m_ends[i];
+        }
+        for (int i = 0; i < THROUGHPUT_BINS; i++)
+        {
+            m_throughputs[i] += other.m_throughputs[i];
+        }
+        m_totalLength += other.m_totalLength;
+    }
+
+    // Returns the number of paths.
+    uint64_t pathCount() const
+    {
+        return std::accumulate(m_ends, m_ends + END_COUNT, uint64_t(0));
+    }
+
+    // Returns the number of paths with the specified length (or longer, for MAX_LENGTH).
+    uint64_t lengthCount(int length) const { return m_lengths[length]; }
+
+    // Returns the number of paths that ended for the specified reason.
+    uint64_t endCount(PathEnd end) const { return m_ends[static_cast<int>(end)]; }
+
+    // Returns the number of paths that ended with a throughput in the specified bin.
+    uint64_t throughputCount(int bin) const { return m_throughputs[bin]; }
+
+    // Returns the mean path length.
+    double meanLength() const
+    {
+        const uint64_t count = pathCount();
+
+        return count > 0 ? static_cast<double>(m_totalLength) / count : 0.0;
+    }
+
+    // Writes a report of the statistics to the specified stream, as a table for each histogram with
+    // the count and percentage of paths in each (non-empty) bin.
+    void report(std::ostream& stream) const
+    {
+        const uint64_t count = pathCount();
+        const double percent = count > 0 ? 100.0 / count : 0.0;
+        stream
+            << std::fixed << std::setprecision(2)
+            << "Paths: " << count << ", mean length " << meanLength() << " bounces." << std::endl;
+
+        stream << "Path length (bounces):" << std::endl;
+        for (int i = 0; i <= MAX_LENGTH; i++)
+        {
+            if (m_lengths[i] > 0)
+            {
+                stream
+                    << "  " << std::setw(10) << (std::to_string(i) + (i == MAX_LENGTH ? "+" : ""))
+                    << std::setw(14) << m_lengths[i]
+                    << std::setw(9) << m_lengths[i] * percent << "%" << std::endl;
+            }
+        }
+
+        stream << "Termination:" << std::endl;
+        for (PathEnd end : { PathEnd::Escaped, PathEnd::MaxDepth, PathEnd::Light })
+        {
+            stream
+                << "  " << std::setw(10) << pathEndName(end)
+                << std::setw(14) << endCount(end)
+                << std::setw(9) << endCount(end) * percent << "%" << std::endl;
+        }
+
+        stream << "Throughput at termination (maximum component):" << std::endl;
+        for (int i = 0; i < THROUGHPUT_BINS; i++)
+        {
+            if (m_throughputs[i] > 0)
+            {
+                // Label each bin with its lower bound, as a power of two.
+                const string label = i == THROUGHPUT_BINS - 1
+                    ? "< 2^-" + std::to_string(i) : ">= 2^-" + std::to_string(i + 1);
+                stream
+                    << "  " << std::setw(10) << label
+                    << std::setw(14) << m_throughputs[i]
+                    << std::setw(9) << m_throughputs[i] * percent << "%" << std::endl;
+            }
+        }
+        stream << std::defaultfloat;
+    }
+
+private:
+    static const int END_COUNT = 3;
+
+    uint64_t m_lengths[MAX_LENGTH + 1] = {};
+    uint64_t m_ends[END_COUNT] = {};
+    uint64_t m_throughputs[THROUGHPUT_BINS] = {};
+    uint64_t m_totalLength = 0;
+
+    // Returns the throughput bin for the specified throughput, using its maximum component, which
+    // is what a Russian roulette threshold would be compared with.
+    static int getThroughputBin(const Vec3& throughput)
+    {
+        const float value = std::max(std::max(throughput.r(), throughput.g()), throughput.b());
+        if (!(value > 0.0f))
+        {
+            return THROUGHPUT_BINS - 1;
+        }
+
+        // The bin is the negated exponent, e.g. 0 for [0.5, 1.0) and 1 for [0.25, 0.5).
+        int exponent = 0;
+        std::frexp(value, &exponent);
+
+        return clamp(-exponent, 0, THROUGHPUT_BINS - 1);
+    }
+};
+
+} // namespace Luma
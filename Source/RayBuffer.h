@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Ray.h"
+
+namespace Luma {
+
+// A buffer of rays stored as a structure of arrays (SoA): a separate array for each component of
+// the origins and directions. This is the layout for processing several rays at once with SIMD,
+// e.g. generating camera rays (see Camera::getRays()), or intersecting packets or streams of rays
+// with the scene, where each SIMD lane takes a ray and the values of the lanes are loaded together
+// from consecutive memory.
+//
+// NOTE: Rays are stored without a range, since primary rays all have the default range. The buffer
+// only grows, so it can be reused for every tile without allocating memory.
+class RayBuffer
+{
+public:
+    // Constructor, for an empty buffer.
+    RayBuffer() {}
+
+    // Returns the number of rays.
+    size_t size() const { return m_size; }
+
+    // Sets the number of rays. The values of any added rays are undefined.
+    void resize(size_t size)
+    {
+        m_size = size;
+        if (m_components[0].size() < size)
+        {
+            for (vector<float>& component : m_components)
+            {
+                component.resize(size);
+            }
+        }
+    }
+
+    // Returns the array of the specified component (0 for X, 1 for Y, 2 for Z) of the origins or
+    // directions of the rays.
+    float* origin(int axis) { return m_components[axis].data(); }
+    const float* origin(int axis) const { return m_components[axis].data(); }
+    float* direction(int axis) { return m_components[3 + axis].data(); }
+    const float* direction(int axis) const { return m_components[3 + axis].data(); }
+
+    // Returns the ray at the specified index.
+    Ray getRay(size_t index) const
+    {
+        return Ray(
+            Vec3(m_components[0][index], m_components[1][index], m_components[2][index]),
+            Vec3(m_components[3][index], m_components[4][index], m_components[5][index]));
+    }
+
+    // Sets the ray at the specified index.
+    void setRay(size_t index, const Ray& ray)
+    {
+        m_components[0][index] = ray.origin().x();
+        m_components[1][index] = ray.origin().y();
+        m_components[2][index] = ray.origin().z();
+        m_components[3][index] = ray.direction().x();
+        m_components[4][index] = ray.direction().y();
+        m_components[5][index] = ray.direction().z();
+    }
+
+private:
+    size_t m_size = 0;
+    vector<float> m_components[6];
+};
+
+} // namespace Luma
@@ -0,0 +1,363 @@
+#pragma once
+
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Output.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "SceneParser.h"
+#include "Socket.h"
+#include "Trace.h"
+
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <queue>
+#include <sstream>
+
+namespace Luma {
+
+// A render server: a long-lived process that renders images for clients, which connect to a Unix
+// domain socket or a TCP port (see Socket). Scenes are loaded once and kept in memory
+// ("warm") across requests, and requests are rendered one at a time from a queue ordered by
+// priority, each using all of the threads. This avoids the cost of starting a process and loading
+// the scene for every image, which dominates for small images such as thumbnails.
+//
+// Each connection carries a single request, which is a line with a command, followed by any number
+// of lines with settings statements (as in scene files), and ends with an empty line or when the
+// client shuts down its side of the connection. The commands are:
+//
+//   render <scene file> [priority]      Renders the scene file with the settings in the file and
+//                                       the settings statements of the request. Higher priority
+//                                       requests (default zero) are rendered first.
+//   shutdown                            Stops the server after rendering the queued requests.
+//
+// The server replies with "ok <size>" and a newline followed by <size> bytes of data: the image for
+// a render request, in the format for the output path (e.g. "output thumbnail.exr" gives OpenEXR,
+// see Output.h), which is not written to a file. If a request fails, the server replies with
+// "error <message>" and a newline instead. The connection is then closed. A client that doesn't
+// send the whole request within a few seconds of connecting is also sent an error and dropped.
+//
+// NOTE: A scene file is loaded again if it has been modified since it was loaded. The "spill" and
+// "checkpoint" statements are ignored, since images are rendered in memory and sent to the client,
+// and the "frames" statement is ignored, since a request renders a single image.
+class RenderServer
+{
+public:
+    // Runs the server, listening on the specified socket address until a shutdown request is
+    // received. Returns whether the server ran successfully; if not, error() describes the problem.
+    bool run(const string& address)
+    {
+        // Listen for connections, replacing the socket file of a previous server if there is one.
+        m_error.clear();
+        m_listenSocket = Socket::listen(address);
+        if (!m_listenSocket.isValid())
+        {
+            return fail("Unable to listen on \"" + address + "\".");
+        }
+        std::cout << "Listening on \"" << address << "\"." << std::endl;
+
+        // Render queued requests on a separate thread, while accepting connections on this thread
+        // until a shutdown request is received. The render thread then finishes the queue.
+        std::thread renderThread([this]() { processJobs(); });
+        acceptConnections();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_condition.notify_one();
+        renderThread.join();
+
+        m_listenSocket.close();
+        std::cout << "Server stopped." << std::endl;
+
+        return true;
+    }
+
+    // Returns a description of the error from the last call to run(), if any.
+    const string& error() const { return m_error; }
+
+private:
+    // A queued render request, with the connection to send the image to.
+    struct Job
+    {
+        shared_ptr<Socket> pSocket;
+        int32_t priority = 0;
+        uint64_t sequence = 0;
+        string scenePath;
+        string settings;
+    };
+
+    // The ordering of jobs in the queue: higher priority first, and then first come, first served.
+    struct JobOrder
+    {
+        bool operator()(const Job& a, const Job& b) const
+        {
+            return a.priority != b.priority ? a.priority < b.priority : a.sequence > b.sequence;
+        }
+    };
+
+    // A scene loaded from a file, with the settings from the file.
+    struct CachedScene
+    {
+        Scene scene;
+        RenderSettings settings;
+        std::filesystem::file_time_type modifiedTime;
+        uint64_t lastUsed = 0;
+    };
+
+    // The maximum size of a request, which is only a few lines of text.
+    static const size_t MAX_REQUEST_SIZE = 1 << 16;
+
+    // The time allowed for receiving a request after accepting a connection.
+    static const int REQUEST_TIMEOUT_MILLISECONDS = 5000;
+
+    // The maximum number of scenes kept in memory; the least recently used scene is removed when
+    // another scene is loaded.
+    static const size_t MAX_CACHED_SCENES = 8;
+
+    Socket m_listenSocket;
+    string m_error;
+
+    // The queue of jobs, which is shared by the threads, and the next job sequence number.
+    std::priority_queue<Job, vector<Job>, JobOrder> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping = false;
+    uint64_t m_nextSequence = 0;
+
+    // The loaded scenes, by absolute path, which are only used by the render thread.
+    std::map<string, std::unique_ptr<CachedScene>> m_scenes;
+    uint64_t m_useCount = 0;
+
+    // Records the specified error message, returning false for convenience.
+    bool fail(const string& message)
+    {
+        m_error = message;
+
+        return false;
+    }
+
+    // Accepts connections and reads their requests, adding render requests to the queue, until a
+    // shutdown request is received.
+    //
+    // NOTE: Requests are read on this thread, as they are small and sent right after connecting.
+    // Reading a request is limited to a short time, so that a client that stalls can't stop other
+    // requests (including a shutdown) from being accepted.
+    void acceptConnections()
+    {
+        while (true)
+        {
+            auto pClient = std::make_shared<Socket>(m_listenSocket.accept());
+            if (!pClient->isValid())
+            {
+                continue;
+            }
+
+            // Read and parse the request. Reply immediately to requests that are invalid or that
+            // don't render an image.
+            Job job;
+            job.pSocket = pClient;
+            string command;
+            string error;
+            if (!readRequest(*pClient, command, job, error))
+            {
+                sendReply(*pClient, "error " + error + "\n", string());
+                continue;
+            }
+            if (command == "shutdown")
+            {
+                sendReply(*pClient, "ok 0\n", string());
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            job.sequence = m_nextSequence++;
+            m_jobs.push(job);
+            m_condition.notify_one();
+        }
+    }
+
+    // Reads a request from a connection, getting the command and the job details. Returns whether
+    // the request was valid; if not, the error describes the problem.
+    bool readRequest(Socket& socket, string& command, Job& job, string& error)
+    {
+        // Receive lines until the end of the request: an empty line, or the end of the connection.
+        // A partial request is rejected if the time limit is reached first.
+        string request;
+        socket.setReceiveTimeout(REQUEST_TIMEOUT_MILLISECONDS);
+        for (string line; request.size() < MAX_REQUEST_SIZE && socket.receiveLine(line)
+            && !line.empty();)
+        {
+            request += line + "\n";
+        }
+        if (socket.timedOut())
+        {
+            error = "The request was not received in time.";
+            return false;
+        }
+
+        // Parse the command line, and keep the remaining lines as settings.
+        const size_t lineEnd = std::min(request.find('\n'), request.size());
+        std::istringstream line(request.substr(0, lineEnd));
+        vector<string> tokens;
+        for (string token; line >> token;)
+        {
+            tokens.push_back(token);
+        }
+        command = tokens.empty() ? string() : tokens[0];
+        if (command == "render")
+        {
+            char* pEnd = nullptr;
+            if (tokens.size() == 3)
+            {
+                job.priority = static_cast<int32_t>(std::strtol(tokens[2].c_str(), &pEnd, 10));
+            }
+            if (tokens.size() < 2 || tokens.size() > 3 || (pEnd && *pEnd != '\0'))
+            {
+                error = "Invalid render request.";
+                return false;
+            }
+            job.scenePath = tokens[1];
+            job.settings = request.substr(std::min(lineEnd + 1, request.size()));
+        }
+        else if (command != "shutdown")
+        {
+            error = "Unknown request \"" + command + "\".";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Renders the queued jobs in order, until the server is stopping and the queue is empty.
+    void processJobs()
+    {
+        Tracer::setThreadName("Server");
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+                if (m_jobs.empty())
+                {
+                    return;
+                }
+                job = m_jobs.top();
+                m_jobs.pop();
+            }
+            runJob(job);
+        }
+    }
+
+    // Renders the image for a job, and sends it (or an error) to the client.
+    void runJob(const Job& job)
+    {
+        TraceScope scope("Job", "priority", job.priority);
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // Get the scene, and apply the settings of the request to the settings of the scene.
+        string error;
+        const CachedScene* pScene = getScene(job.scenePath, error);
+        RenderSettings settings;
+        if (pScene)
+        {
+            settings = pScene->settings;
+            SceneParser parser;
+            if (!parser.parseSettings(job.settings, settings))
+            {
+                error = parser.error();
+            }
+            else if (!settings.isCropValid())
+            {
+                error = "The crop window is outside the image.";
+            }
+        }
+        if (!error.empty())
+        {
+            sendReply(*job.pSocket, "error " + error + "\n", string());
+            std::cout << "Failed to render \"" << job.scenePath << "\": " << error << std::endl;
+            return;
+        }
+
+        // Render the image in memory and encode it, ignoring any spill file.
+        settings.spillPath.clear();
+        Framebuffer framebuffer(settings.renderWidth(), settings.renderHeight());
+        Camera camera(settings.camera, settings.aspect());
+        RenderStats stats = render(pScene->scene, camera, framebuffer, settings, false);
+        std::ostringstream image(std::ios::out | std::ios::binary);
+        if (!writeOutput(framebuffer, settings, image))
+        {
+            sendReply(*job.pSocket, "error Unable to encode the image.\n", string());
+            return;
+        }
+        const string data = image.str();
+        sendReply(*job.pSocket, "ok " + std::to_string(data.size()) + "\n", data);
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        std::cout
+            << std::setprecision(3)
+            << "Rendered \"" << job.scenePath << "\" at " << settings.renderWidth() << "x"
+            << settings.renderHeight() << " with priority " << job.priority << " in "
+            << std::chrono::duration<double>(endTime - startTime).count() << " seconds ("
+            << stats.seconds << " rendering)." << std::endl;
+    }
+
+    // Returns the scene loaded from the specified file, loading it if it has not been loaded or has
+    // been modified since. Returns null if the scene could not be loaded; the error describes the
+    // problem.
+    const CachedScene* getScene(const string& filePath, string& error)
+    {
+        std::error_code errorCode;
+        const string key = std::filesystem::absolute(filePath, errorCode).string();
+        const auto modifiedTime = std::filesystem::last_write_time(filePath, errorCode);
+        if (errorCode)
+        {
+            error = "Unable to open \"" + filePath + "\".";
+            return nullptr;
+        }
+
+        // Use the loaded scene if it is up to date.
+        auto it = m_scenes.find(key);
+        if (it != m_scenes.end() && it->second->modifiedTime == modifiedTime)
+        {
+            it->second->lastUsed = ++m_useCount;
+            return it->second.get();
+        }
+
+        // Otherwise load the scene, replacing the old version or the least recently used scene.
+        std::unique_ptr<CachedScene> pScene(new CachedScene());
+        if (!loadSceneFile(filePath, pScene->scene, pScene->settings, error))
+        {
+            return nullptr;
+        }
+        pScene->modifiedTime = modifiedTime;
+        pScene->lastUsed = ++m_useCount;
+        if (it == m_scenes.end() && m_scenes.size() >= MAX_CACHED_SCENES)
+        {
+            auto isLessRecent = [](const auto& a, const auto& b)
+            {
+                return a.second->lastUsed < b.second->lastUsed;
+            };
+            m_scenes.erase(std::min_element(m_scenes.begin(), m_scenes.end(), isLessRecent));
+        }
+        std::cout << "Loaded " << pScene->scene.size() << " elements from \"" << filePath << "\"."
+            << std::endl;
+
+        return (m_scenes[key] = std::move(pScene)).get();
+    }
+
+    // Sends a reply line and any data to a client, and closes the connection. A client that has
+    // disconnected is ignored.
+    static void sendReply(Socket& socket, const string& line, const string& data)
+    {
+        if (socket.sendText(line))
+        {
+            socket.sendText(data);
+        }
+        socket.close();
+    }
+};
+
+} // namespace Luma
@@ -0,0 +1,888 @@
+#pragma once
+
+#include "AOV.h"
+#include "Camera.h"
+#include "Color.h"
+#include "Cost.h"
+#include "EXRWriter.h"
+#include "Framebuffer.h"
+#include "PathStats.h"
+#include "Ray.h"
+#include "RayBuffer.h"
+#include "Resample.h"
+#include "Sampler.h"
+#include "Scene.h"
+#include "Trace.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+#include <numeric>
+#include <ppl.h>
+#include <sstream>
+
+namespace Luma {
+
+// The orders in which the tiles of an image are rendered.
+enum class TileOrder
+{
+    Rows,     // In rows from the top left, which bounds the memory used with a spilled framebuffer.
+    Center,   // Outward from the center of the rendered region.
+    Hotspots, // Outward from the nearest of a set of points (hotspots) in the image.
+};
+
+// Returns the name of the specified tile order, as used in scene files.
+inline const char* tileOrderName(TileOrder order)
+{
+    static const char* NAMES[] = { "rows", "center", "hotspots" };
+
+    return NAMES[static_cast<int>(order)];
+}
+
+// Parses the name of a tile order, returning whether the name was valid.
+inline bool parseTileOrder(const string& name, TileOrder& order)
+{
+    for (TileOrder candidate : { TileOrder::Rows, TileOrder::Center, TileOrder::Hotspots })
+    {
+        if (name == tileOrderName(candidate))
+        {
+            order = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// A point in an image, in pixels from the top left.
+struct ImagePoint
+{
+    uint32_t x;
+    uint32_t y;
+};
+
+// Settings for rendering an image.
+//
+// NOTE: The image can be rendered at a lower resolution and scaled up to the desired image size to
+// make it easier to see the individual pixels and for faster rendering. The defaults here take about
+// 2.1 seconds to render with a Debug build, but only about 300 ms with a Release build on a Core
+// i7-8700 CPU with 12 threads.
+struct RenderSettings
+{
+    // The dimensions of the rendered image, in pixels.
+    uint32_t width = 3840 / 8;
+    uint32_t height = 2160 / 8;
+
+    // The region of the image that is rendered and saved (the crop window), in pixels from the top
+    // left, or a zero width to render the whole image. The samples of each pixel are the same as
+    // when rendering the whole image, so a cropped render can be pasted into a full render.
+    uint32_t cropX = 0;
+    uint32_t cropY = 0;
+    uint32_t cropWidth = 0;
+    uint32_t cropHeight = 0;
+
+    // The order in which the tiles are rendered, and the hotspots for TileOrder::Hotspots.
+    TileOrder tileOrder = TileOrder::Rows;
+    vector<ImagePoint> hotspots;
+
+    // The scale factor used to resize the rendered image when it is saved, and the filter used to
+    // resample it.
+    float scale = 8.0f;
+    ResampleFilter filter = ResampleFilter::Nearest;
+
+    // The camera that the image is rendered from.
+    CameraSettings camera;
+
+    // The number of samples per pixel.
+    uint16_t samples = 16;
+
+    // The maximum number of path segments traced for each sample.
+    int maxDepth = 10;
+
+    // The encoding used to convert the linear radiance to 8-bit values for PNG output files.
+    ColorEncoding encoding = ColorEncoding::Gamma22;
+
+    // The path of the output image file. The extension determines the file format: see Output.h.
+    // For animations, the path can include "%d" (or e.g. "%04d" for leading zeros) for the frame
+    // number; see getFrameSettings().
+    string outputPath = "output.png";
+
+    // The range of frames to render as an animation, inclusive, if enabled, and the frame being
+    // rendered. The scene is the same for every frame, while the samples of each pixel differ.
+    bool animated = false;
+    uint32_t firstFrame = 0;
+    uint32_t lastFrame = 0;
+    uint32_t frame = 0;
+
+    // The path of a temporary file used to store the framebuffer while rendering, or empty to store
+    // it in memory. This allows rendering images that are too large for memory.
+    string spillPath;
+
+    // The compression method and tile size (zero for scanlines) for OpenEXR output files.
+    EXRCompression exrCompression = EXRCompression::ZIP;
+    uint32_t exrTileSize = 0;
+
+    // The interval between checkpoints saved while rendering, in seconds, or zero to not save
+    // checkpoints, and the path of the checkpoint file. See Checkpoint.h.
+    double checkpointInterval = 0.0;
+    string checkpointPath;
+
+    // Returns the path of the checkpoint file: the output path with ".checkpoint" appended, unless
+    // a path has been specified.
+    string getCheckpointPath() const
+    {
+        return checkpointPath.empty() ? outputPath + ".checkpoint" : checkpointPath;
+    }
+
+    // Whether to save a heatmap of the cost of rendering each pixel, and the metric shown. This
+    // requires a build with LUMA_COST_HEATMAP defined as 1; see Cost.h.
+    bool heatmap = false;
+    CostMetric heatmapMetric = CostMetric::Tests;
+
+    // Returns the path of the heatmap image: a PNG file with the output path and the metric name,
+    // e.g. "output_tests.png" for "output.exr".
+    string getHeatmapPath() const
+    {
+        return getOutputPath(costMetricName(heatmapMetric), ".png");
+    }
+
+    // The AOVs to save as separate images, in addition to the radiance; see AOV.h.
+    vector<AOV> aovs;
+
+    // Returns the path of the image for the specified AOV: a PFM file with the output path and the
+    // AOV name, e.g. "output_normal.pfm" for "output.png".
+    string getAOVPath(AOV aov) const { return getOutputPath(aovName(aov), ".pfm"); }
+
+    // Whether to denoise the rendered image before it is saved, and the number of filter passes;
+    // see Denoiser.h.
+    bool denoise = false;
+    uint32_t denoisePasses = 5;
+
+    // Returns the settings for rendering the specified frame of an animation, with the frame number
+    // in the output path and checkpoint path, replacing "%d" or "%0<N>d" (with N digits) in the
+    // paths. If there is no frame number in a path, it is added before the extension, with four
+    // digits. This is the same as the settings for a single image, i.e. not animated.
+    RenderSettings getFrameSettings(uint32_t frameNumber) const
+    {
+        RenderSettings result = *this;
+        result.frame = frameNumber;
+        if (animated)
+        {
+            result.outputPath = insertFrameNumber(outputPath, frameNumber);
+            if (!checkpointPath.empty())
+            {
+                result.checkpointPath = insertFrameNumber(checkpointPath, frameNumber);
+            }
+        }
+
+        return result;
+    }
+
+    // Returns the aspect ratio of the rendered image.
+    float aspect() const { return static_cast<float>(width) / height; }
+
+    // Returns whether only a region of the image is rendered.
+    bool isCropped() const { return cropWidth > 0; }
+
+    // Returns the dimensions of the rendered region, i.e. of the framebuffer: the crop window, or
+    // the whole image.
+    uint32_t renderWidth() const { return isCropped() ? cropWidth : width; }
+    uint32_t renderHeight() const { return isCropped() ? cropHeight : height; }
+
+    // Returns whether the crop window is within the image, and not empty if it is specified.
+    bool isCropValid() const
+    {
+        return !isCropped() || (cropHeight > 0
+            && cropX < width && cropWidth <= width - cropX
+            && cropY < height && cropHeight <= height - cropY);
+    }
+
+private:
+    // Returns the output path with the specified suffix (after an underscore) and extension in
+    // place of its extension, for other images saved with the output image.
+    string getOutputPath(const string& suffix, const string& newExtension) const
+    {
+        const size_t separator = outputPath.find_last_of("/\\");
+        size_t extension = outputPath.rfind('.');
+        if (extension == string::npos || (separator != string::npos && extension < separator))
+        {
+            extension = outputPath.size();
+        }
+
+        return outputPath.substr(0, extension) + "_" + suffix + newExtension;
+    }
+
+    // Returns the specified path with the specified frame number inserted; see getFrameSettings().
+    static string insertFrameNumber(const string& path, uint32_t frameNumber)
+    {
+        // Find a "%d" or "%0<N>d" pattern, and get the number of digits.
+        const size_t start = path.find('%');
+        const size_t end =
+            start == string::npos ? start : path.find_first_not_of("0123456789", start + 1);
+        if (end != string::npos && path[end] == 'd')
+        {
+            const int digits = end > start + 1 ? std::atoi(path.c_str() + start + 1) : 1;
+            std::ostringstream number;
+            number << std::setfill('0') << std::setw(std::min(digits, 10)) << frameNumber;
+
+            return path.substr(0, start) + number.str() + path.substr(end + 1);
+        }
+
+        // Otherwise insert the frame number before the extension, if there is an extension after
+        // the last directory separator.
+        const size_t separator = path.find_last_of("/\\");
+        size_t extension = path.rfind('.');
+        if (extension == string::npos || (separator != string::npos && extension < separator))
+        {
+            extension = path.size();
+        }
+        std::ostringstream number;
+        number << "_" << std::setfill('0') << std::setw(4) << frameNumber;
+
+        return path.substr(0, extension) + number.str() + path.substr(extension);
+    }
+};
+
+// Statistics collected while rendering an image.
+struct RenderStats
+{
+    // The total number of rays traced, i.e. camera rays and all bounce rays.
+    uint64_t rayCount = 0;
+
+    // The time spent rendering, in seconds.
+    double seconds = 0.0;
+
+    // Returns the number of rays traced per second.
+    double raysPerSecond() const { return seconds > 0.0 ? rayCount / seconds : 0.0; }
+};
+
+// Computes the radiance incident along the specified ray, for the specified element. The number of
+// rays traced is added to the specified ray count. If path statistics are specified, the path is
+// added to them when it ends, with the specified state of the path so far. If an AOV sample is
+// specified, it is set from the first hit of the ray (see AOVSample). If the ray was sampled from a
+// surface, the density of its direction is specified, to weight any light it hits (see below);
+// otherwise, e.g. for camera rays, it is zero.
+Vec3 radiance(const Ray& ray, const Element& element, int depth, uint32_t& index, uint64_t& rayCount,
+    PathStats* pPathStats = nullptr, const PathState& path = PathState(),
+    AOVSample* pAOVs = nullptr, float directionPdf = 0.0f)
+{
+    // If the trace depth has been exhausted, simply return black.
+    if (depth == 0)
+    {
+        if (pPathStats)
+        {
+            pPathStats->addPath(PathEnd::MaxDepth, path.bounces, path.throughput);
+        }
+        return Vec3();
+    }
+
+    // Intersect the sphere with the ray, and shade with the hit record if there was an
+    // intersection. Otherwise shade with a (vertical) background gradient.
+    Vec3 radiance;
+    Hit hit;
+    rayCount++;
+    const vector<shared_ptr<Light>>& lights = element.lights();
+    const bool hitFound = element.intersect(ray, hit);
+    if (hitFound && hit.pLight)
+    {
+        // The ray hit a light, which emits light and doesn't reflect any. If the ray was sampled
+        // from a surface, the light was also sampled directly from that surface (see below), so the
+        // emitted light is weighted for multiple importance sampling.
+        radiance = hit.pLight->emitted(hit, ray.direction());
+        if (directionPdf > 0.0f)
+        {
+            const float lightPdf = hit.pLight->pdf(ray.origin(), ray.direction(), hit)
+                / static_cast<float>(lights.size());
+            radiance *= powerHeuristic(directionPdf, lightPdf);
+        }
+        if (pAOVs)
+        {
+            pAOVs->albedo = radiance;
+            pAOVs->normal = hit.normal;
+            pAOVs->depth = hit.t;
+            pAOVs->objectID = hit.id;
+        }
+        if (pPathStats)
+        {
+            pPathStats->addPath(PathEnd::Light, path.bounces, path.throughput);
+        }
+    }
+    else if (hitFound)
+    {
+        CostCounter::countBounce();
+
+        // Generate a random direction in the hemisphere above the normal.
+        float u1 = 0.0f, u2 = 0.0f;
+        float pdf = 1.0f;
+        getRandom2D(u1, u2, index);
+        Vec3 direction = randomDirection(u1, u2, hit.normal, pdf);
+        float cosTheta = dot(hit.normal, direction);
+        assert(cosTheta > 0.0f);
+
+        // Compute the Lambertian BRDF, i.e. the amount of light reflected by the material.
+        static const Vec3 materialColor(Vec3(0.75f, 0.75f, 0.75f).sRGBToLinear());
+        Vec3 brdf = materialColor / PI;
+        if (pAOVs)
+        {
+            pAOVs->albedo = materialColor;
+            pAOVs->normal = hit.normal;
+            pAOVs->depth = hit.t;
+            pAOVs->objectID = hit.id;
+        }
+
+        // Compute the radiance incident from the direction, i.e. the incident light.
+        //
+        // NOTE: As this is recursive, this renders global illumination (indirect light) which is
+        // very difficult to achieve with rasterization on GPUs.
+        //
+        // NOTE: A small ray offset is used to avoid self-intersection.
+        //
+        // NOTE: The path state is only updated when collecting path statistics, as the throughput
+        // is otherwise not needed with this recursive form.
+        static const float RAY_OFFSET = 1e-4f;
+        Ray ray(hit.position, direction, RAY_OFFSET);
+        PathState nextPath;
+        if (pPathStats)
+        {
+            nextPath.throughput = path.throughput * brdf * cosTheta / pdf;
+            nextPath.bounces = path.bounces + 1;
+        }
+        Vec3 light = Luma::radiance(
+            ray, element, depth - 1, index, rayCount, pPathStats, nextPath, nullptr, pdf);
+
+        // Compute the outgoing radiance, as defined by the rendering equation.
+        radiance = brdf * light * cosTheta / pdf;
+
+        // Sample the lights directly (next event estimation), if there are any: choose a light and
+        // a point on it, and add the light from that point unless it is blocked, which is checked
+        // with a shadow ray. This finds small, bright lights that random directions rarely hit.
+        // The light is weighted for multiple importance sampling with the density of the same
+        // direction as a random direction (above), which is weighted the same way if it hits a
+        // light, so each way of finding the light contributes most where it has less variance.
+        //
+        // NOTE: The light and the point are chosen with Halton sequences of other bases at the same
+        // sequence index as the direction; see the "IMPORTANT" note in traceSamples(). Lights are
+        // only sampled if the random direction is traced further (i.e. not at the maximum depth),
+        // so that the weights of the two ways add up to one.
+        if (!lights.empty() && depth > 1)
+        {
+            const float lightChoice = halton(index, 5) * lights.size();
+            const size_t lightIndex =
+                std::min(static_cast<size_t>(lightChoice), lights.size() - 1);
+            LightSample sample;
+            const bool sampled = lights[lightIndex]->sample(
+                hit.position, lightChoice - lightIndex, halton(index, 7), sample);
+            const float cosSurface = dot(hit.normal, sample.direction);
+            if (sampled && cosSurface > 0.0f)
+            {
+                Ray shadowRay(hit.position, sample.direction, RAY_OFFSET,
+                    sample.distance - RAY_OFFSET);
+                rayCount++;
+                if (!element.occluded(shadowRay))
+                {
+                    const float lightPdf = sample.pdf / static_cast<float>(lights.size());
+                    const float weight = powerHeuristic(lightPdf, cosSurface / PI);
+                    radiance += brdf * sample.radiance * (cosSurface * weight / lightPdf);
+                }
+            }
+        }
+
+        // DIRECT LIGHTING: Uncomment this to perform simple direct shading and shadowing with a
+        // directional light. As there is no random sampling, this will have no noise.
+        //
+        // Hit shadowHit;
+        // static const Vec3 lightDirection(Vec3(1.0f, 1.0f, 1.0f).normalize());
+        // Ray shadowRay(hit.position, lightDirection, RAY_OFFSET);
+        // float visibility = element.intersect(shadowRay, shadowHit) ? 0.1f : 1.0f;
+        // radiance = brdf * visibility * std::max(dot(hit.normal, lightDirection), 0.0f);
+
+        // AMBIENT OCCLUSION: Uncomment this to render ambient occlusion, i.e. the amount by which a
+        // point can see the environment.
+        //
+        // Vec3 visibility = element.intersect(ray, hit) ? Vec3() : Vec3(1.0f, 1.0f, 1.0f);
+        // radiance = visibility * cosTheta / PI / pdf;
+    }
+    else
+    {
+        static const Vec3 topColor(Vec3(0.5f, 0.7f, 1.0f).sRGBToLinear());
+        static const Vec3 bottomColor(Vec3(1.0f, 1.0f, 1.0f).sRGBToLinear());
+
+        float gradientFactor = (ray.direction().y() + 1.0f) * 0.5f;
+        radiance = lerp(bottomColor, topColor, gradientFactor);
+        if (pAOVs)
+        {
+            *pAOVs = AOVSample();
+            pAOVs->albedo = radiance;
+        }
+        if (pPathStats)
+        {
+            pPathStats->addPath(PathEnd::Escaped, path.bounces, path.throughput);
+        }
+    }
+
+    return radiance;
+}
+
+// Returns the indices of the tiles of the framebuffer in the order they should be rendered, with
+// the specified settings. The framebuffer contains the rendered region of the image.
+//
+// NOTE: The tiles are sorted by the distance from their centers to the nearest target point, which
+// is the center of the rendered region or a hotspot. The sort is stable, so tiles at the same
+// distance are rendered in rows. With many threads, tiles finish roughly in this order.
+vector<uint32_t> getTileOrder(const Framebuffer& framebuffer, const RenderSettings& settings)
+{
+    vector<uint32_t> order(framebuffer.tileCount());
+    std::iota(order.begin(), order.end(), 0u);
+    if (settings.tileOrder == TileOrder::Rows)
+    {
+        return order;
+    }
+
+    // Collect the target points, in framebuffer coordinates (which may be outside the buffer for
+    // hotspots outside the crop window). Without any hotspots, the center is used.
+    vector<std::pair<float, float>> targets;
+    if (settings.tileOrder == TileOrder::Hotspots)
+    {
+        for (const ImagePoint& hotspot : settings.hotspots)
+        {
+            targets.emplace_back(static_cast<float>(hotspot.x) - settings.cropX,
+                static_cast<float>(hotspot.y) - settings.cropY);
+        }
+    }
+    if (targets.empty())
+    {
+        targets.emplace_back(framebuffer.width() * 0.5f, framebuffer.height() * 0.5f);
+    }
+
+    // Compute the squared distance from each tile to the nearest target, and sort by distance.
+    vector<float> distances(order.size());
+    for (uint32_t index = 0; index < order.size(); index++)
+    {
+        const Tile tile = framebuffer.getTile(index);
+        const float centerX = tile.x + tile.width * 0.5f;
+        const float centerY = tile.y + tile.height * 0.5f;
+        distances[index] = FLT_MAX;
+        for (const auto& target : targets)
+        {
+            const float dx = centerX - target.first;
+            const float dy = centerY - target.second;
+            distances[index] = std::min(distances[index], dx * dx + dy * dy);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [&distances](uint32_t a, uint32_t b) { return distances[a] < distances[b]; });
+
+    return order;
+}
+
+// Computes camera rays for the specified range of samples of every pixel in the specified tile,
+// with the specified settings and camera, and stores them in the specified buffer. The tile is in
+// image coordinates, with lines counted from the top. The rays are stored by pixel, in rows from
+// the top of the tile, with the rays of each pixel in sample order, i.e. the ray for a sample of a
+// pixel has the index (pixel index in the tile) * sampleCount + (sample - firstSample).
+//
+// NOTE: The sample positions are computed for a batch of samples of each pixel at a time, and the
+// rays for the batch are computed with SIMD by the camera, so ray generation takes a small fraction
+// of the time of rendering. The rays are laid out for tracing the samples of each pixel in turn,
+// and as a structure of arrays they can also be traced as packets or streams.
+void generateRays(const Camera& camera, const RenderSettings& settings, const Tile& tile,
+    uint32_t firstSample, uint32_t sampleCount, RayBuffer& rays)
+{
+    const uint32_t width = settings.width;
+    const uint32_t height = settings.height;
+    rays.resize(size_t(tile.width) * tile.height * sampleCount);
+
+    static const uint32_t BATCH_SIZE = 64;
+    float u[BATCH_SIZE];
+    float v[BATCH_SIZE];
+    float lensX[BATCH_SIZE];
+    float lensY[BATCH_SIZE];
+    size_t rayIndex = 0;
+    for (uint32_t line = tile.y; line < tile.y + tile.height; line++)
+    {
+        const uint32_t y = height - line - 1;
+        for (uint32_t x = tile.x; x < tile.x + tile.width; x++)
+        {
+            // Create the sampler for the pixel; see traceSamples().
+            const PixelSampler sampler(uint64_t(line) * width + x, settings.frame);
+            const uint32_t endSample = firstSample + sampleCount;
+            for (uint32_t start = firstSample; start < endSample; start += BATCH_SIZE)
+            {
+                // Compute the sample positions of the batch, using a quasirandom offset for each
+                // sample. If only one sample is being taken, use the pixel center.
+                //
+                // NOTE: The offsets use a separate sequence from the radiance sampling, because
+                // using the same sequence index as the radiance sampling yields minor edge
+                // artifacts. Unlike pseudorandom numbers from a shared generator, these only depend
+                // on the pixel and sample, so a render is reproducible.
+                //
+                // For a thin lens camera, the lens positions of the batch are computed along with
+                // the offsets, from the same 4D sequence (see PixelSampler::get4D()), and mapped to
+                // the unit disk. The lens is sampled even for a single sample, as there is no
+                // "center" sample for depth of field.
+                const uint32_t batchSize = std::min(BATCH_SIZE, endSample - start);
+                if (camera.hasLens())
+                {
+                    sampler.get4D(start, batchSize, u, v, lensX, lensY);
+                    for (uint32_t i = 0; i < batchSize; i++)
+                    {
+                        sampleDisk(lensX[i], lensY[i], lensX[i], lensY[i]);
+                    }
+                }
+                else if (settings.samples > 1)
+                {
+                    sampler.get2D(start, batchSize, PixelSampler::Dimension::Pixel, u, v);
+                }
+                if (settings.samples == 1)
+                {
+                    u[0] = 0.5f;
+                    v[0] = 0.5f;
+                }
+                for (uint32_t i = 0; i < batchSize; i++)
+                {
+                    u[i] = (x + u[i]) / width;
+                    v[i] = (y - v[i]) / height;
+                }
+
+                // Compute the camera rays of the batch.
+                camera.getRays(u, v, lensX, lensY, batchSize, rays, rayIndex);
+                rayIndex += batchSize;
+            }
+        }
+    }
+}
+
+// Traces camera rays for the specified range of samples of a pixel, with the specified settings,
+// element (scene), and sampler for the pixel. The rays are taken from the specified buffer, from
+// the specified index (see generateRays()). The radiance of the samples is added to the specified
+// radiance, and the number of rays traced is added to the specified ray count. The paths are added
+// to the specified path statistics, if any, and the AOVs of the samples are added to the specified
+// AOV sample, if any.
+void traceSamples(const Element& element, const RenderSettings& settings, const RayBuffer& rays,
+    size_t firstRay, const PixelSampler& sampler, uint32_t firstSample, uint32_t sampleCount,
+    uint64_t& rayCount, Vec3& radiance, PathStats* pPathStats = nullptr,
+    AOVSample* pAOVs = nullptr)
+{
+    // The sampler provides an index for a sequence of *quasirandom* numbers for each sample. Such
+    // numbers are used for "random" sampling while path tracing, e.g. selecting a random direction
+    // in a hemisphere. The sequence index starts with a unique value for each pixel in the image
+    // which is then randomized with a hash.
+    //
+    // NOTE: Using a constant sequence index leads to total aliasing, but will still converge to the
+    // correct result with enough samples. Using only the unique per-pixel starting index will
+    // reduce aliasing, but still yields substantial correlation artifacts. Finally, hashing that
+    // index yields less objectionable noise, but still with better convergence than using
+    // *pseudorandom* numbers.
+    //
+    // IMPORTANT: For now the same index is used for all random numbers in this pixel sample. This
+    // strangely works quite well, but will likely need to be revisited. The index is only
+    // incremented once, when the sample is complete.
+    //
+    // NOTE: The pixel index is computed with 64 bits to avoid overflow with large images, and only
+    // then hashed to the 32-bit sequence index.
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        // Compute a color for the ray, i.e. the scene radiance from that direction and add it to
+        // the accumulated radiance. The sequence index is incremented for each sample; see the
+        // "IMPORTANT" note above.
+        const Ray ray = rays.getRay(firstRay + i);
+        uint32_t sequenceIndex = sampler.sequenceIndex(firstSample + i);
+        AOVSample aovs;
+        radiance += Luma::radiance(ray, element, settings.maxDepth, sequenceIndex, rayCount,
+            pPathStats, PathState(), pAOVs ? &aovs : nullptr);
+        if (pAOVs)
+        {
+            *pAOVs += aovs;
+        }
+    }
+}
+
+// Computes radiance samples for the pixel at the specified image coordinates (with the line counted
+// from the top), with the specified settings, element (scene), and camera. The samples from the
+// specified first sample up to the number of samples in the settings are taken, and their sum is
+// returned. The number of rays traced is added to the specified ray count, the paths are added to
+// the specified path statistics, if any, and the AOVs of the samples are added to the specified AOV
+// sample, if any.
+//
+// NOTE: Each sample depends only on the pixel and sample index, so samples can be taken in any
+// number of parts, by any thread or process, with the same result. This renders a single pixel;
+// render() generates and traces the rays of a whole tile at a time.
+Vec3 renderPixel(const Element& element, const Camera& camera, const RenderSettings& settings,
+    uint32_t x, uint32_t line, uint32_t firstSample, uint64_t& rayCount,
+    PathStats* pPathStats = nullptr, AOVSample* pAOVs = nullptr)
+{
+    const uint32_t samples = settings.samples;
+    const uint32_t sampleCount = samples - std::min(firstSample, samples);
+    RayBuffer rays;
+    generateRays(camera, settings, Tile{ x, line, 1, 1 }, firstSample, sampleCount, rays);
+
+    Vec3 radiance;
+    const PixelSampler sampler(uint64_t(line) * settings.width + x, settings.frame);
+    traceSamples(element, settings, rays, 0, sampler, firstSample, sampleCount, rayCount, radiance,
+        pPathStats, pAOVs);
+
+    return radiance;
+}
+
+// Computes the radiance for all the pixels in the framebuffer with the specified settings, using
+// the specified element (scene) and camera. Progress is reported on the console unless disabled,
+// and statistics for the render are returned. Pixels that already have the number of samples in
+// the settings are left unchanged: use Framebuffer::clearSampleCounts() to render a buffer again.
+// The framebuffer contains the rendered region of the image, i.e. the crop window if there is one.
+// If a cost map is specified, the cost of rendering each pixel is recorded in it, when counting is
+// enabled with LUMA_COST_HEATMAP (see Cost.h). If an AOV buffer is specified, the AOVs of each
+// rendered pixel are recorded in it. Both have the dimensions of the framebuffer. If path
+// statistics are specified, the paths traced are added to them; otherwise none are collected.
+RenderStats render(
+    const Element& element, const Camera& camera, Framebuffer& framebuffer,
+    const RenderSettings& settings, bool reportProgress = true, CostMap* pCostMap = nullptr,
+    AOVBuffer* pAOVBuffer = nullptr, PathStats* pPathStats = nullptr)
+{
+    const uint32_t width = settings.width;
+    const uint32_t height = settings.height;
+    const uint16_t samples = settings.samples;
+    assert(settings.isCropValid());
+    assert(framebuffer.width() == settings.renderWidth());
+    assert(framebuffer.height() == settings.renderHeight());
+
+    // Report the rendering parameters.
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    if (reportProgress)
+    {
+        std::cout << "Rendering " << width << "x" << height;
+        if (settings.isCropped())
+        {
+            std::cout
+                << " (region " << settings.cropWidth << "x" << settings.cropHeight
+                << " at " << settings.cropX << "," << settings.cropY << ")";
+        }
+        std::cout
+            << " at " << samples << " samples per pixel on "
+            << threadCount << " threads..." << std::endl;
+    }
+
+    // Record the start time, and trace the render as a span, with the tiles as nested spans on
+    // each thread (see Tracer).
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto prevTime = startTime;
+    TraceScope renderScope("Render", "frame", settings.frame);
+
+    // Render the tiles of the framebuffer, computing the incident radiance for each pixel. A
+    // parallel for loop is used here to support thread concurrency, with each thread taking the
+    // next tile in the tile order from a shared counter until there are none left.
+    //
+    // NOTE: Ray tracing is a naturally parallel algorithm: there is no read / write contention for
+    // memory, with the exception of progress reporting. Taking tiles in order (rather than giving
+    // each thread a separate range of tiles) balances the load between threads, and means that the
+    // tiles being rendered at any time are close together. With the default order (rows), only a
+    // few rows of tiles are in use at any time. This is what allows a framebuffer stored in a file
+    // to spill finished rows of tiles; other orders still work, but spill rows later.
+    //
+    // Each pixel continues from the number of samples already stored in the framebuffer, e.g. from
+    // a checkpoint, so pixels that already have enough samples are not rendered again. Each tile is
+    // rendered into a local buffer and then committed to the framebuffer as a unit, so that a
+    // checkpoint saved at any time has a consistent state for each pixel.
+    //
+    // The camera rays of each tile are generated for several samples of every pixel at a time
+    // (see generateRays()), with at most the following number of rays, i.e. four samples for each
+    // pixel of a full tile, which keeps the ray buffer of each thread small (384 KB).
+    static const size_t MAX_TILE_RAYS = 16384;
+    std::mutex progressMutex;
+    std::atomic<uint32_t> nextTile(0);
+    std::atomic<uint32_t> completedTiles(0);
+    std::atomic<uint64_t> totalRayCount(0);
+    const uint32_t tileCount = framebuffer.tileCount();
+    const vector<uint32_t> tileOrder = getTileOrder(framebuffer, settings);
+    threadCount = std::max(1u, std::min(threadCount, tileCount));
+    Concurrency::parallel_for(0u, threadCount, [&](unsigned int)
+    {
+        Tracer::setThreadName("Render");
+        const size_t tilePixels = size_t(Framebuffer::TILE_SIZE) * Framebuffer::TILE_SIZE;
+        vector<float> tileRadiance(tilePixels * Framebuffer::NUM_COMPONENTS);
+        vector<uint32_t> tileSampleCounts(tilePixels);
+        vector<uint32_t> storedSampleCounts(tilePixels);
+        vector<Vec3> sampleSums(tilePixels);
+        vector<AOVSample> aovSums(pAOVBuffer ? tilePixels : 0);
+        vector<PixelCost> costs(pCostMap ? tilePixels : 0);
+        RayBuffer rays;
+        PathStats pathStats;
+        for (uint32_t orderIndex = nextTile++; orderIndex < tileCount; orderIndex = nextTile++)
+        {
+            // Count the rays traced for this tile locally, to avoid contention on the shared total.
+            const uint32_t tileIndex = tileOrder[orderIndex];
+            const Tile tile = framebuffer.getTile(tileIndex);
+            const size_t pixelCount = size_t(tile.width) * tile.height;
+            uint64_t rayCount = 0;
+            TraceScope tileScope("Tile", "index", tileIndex);
+
+            // Get the stored sample count of each pixel, and the first sample needed by any pixel
+            // of the tile. The tile is in framebuffer coordinates, which are offset from image
+            // coordinates by the crop window.
+            uint32_t firstSample = samples;
+            for (uint32_t bufferY = tile.y; bufferY < tile.y + tile.height; bufferY++)
+            {
+                for (uint32_t bufferX = tile.x; bufferX < tile.x + tile.width; bufferX++)
+                {
+                    const size_t tileOffset =
+                        size_t(bufferY - tile.y) * tile.width + (bufferX - tile.x);
+                    const uint32_t sampleCount = framebuffer.getSampleCount(bufferX, bufferY);
+                    storedSampleCounts[tileOffset] = sampleCount;
+                    tileSampleCounts[tileOffset] = std::max<uint32_t>(sampleCount, samples);
+                    firstSample = std::min(firstSample, sampleCount);
+                    if (pAOVBuffer)
+                    {
+                        pAOVBuffer->setSampleCount(bufferX, bufferY, tileSampleCounts[tileOffset]);
+                    }
+                }
+            }
+            std::fill(sampleSums.begin(), sampleSums.begin() + pixelCount, Vec3());
+            std::fill(aovSums.begin(), aovSums.end(), AOVSample());
+            std::fill(costs.begin(), costs.end(), PixelCost());
+
+            // Render the needed samples of the tile in passes, each generating the camera rays for
+            // a range of samples of every pixel (see generateRays()), and then tracing the rays of
+            // each pixel, skipping any samples the pixel already has. The number of samples in a
+            // pass is limited so that the ray buffer stays small.
+            const Tile imageTile = { settings.cropX + tile.x, settings.cropY + tile.y,
+                tile.width, tile.height };
+            const uint32_t passSamples = std::max<uint32_t>(
+                1, static_cast<uint32_t>(MAX_TILE_RAYS / pixelCount));
+            for (uint32_t passStart = firstSample; passStart < samples; passStart += passSamples)
+            {
+                const uint32_t passEnd = std::min<uint32_t>(passStart + passSamples, samples);
+                generateRays(camera, settings, imageTile, passStart, passEnd - passStart, rays);
+                for (uint32_t tileY = 0; tileY < tile.height; tileY++)
+                {
+                    const uint32_t line = imageTile.y + tileY;
+                    for (uint32_t tileX = 0; tileX < tile.width; tileX++)
+                    {
+                        const size_t tileOffset = size_t(tileY) * tile.width + tileX;
+                        const uint32_t start = std::max(passStart, storedSampleCounts[tileOffset]);
+                        if (start >= passEnd)
+                        {
+                            continue;
+                        }
+
+                        const uint32_t x = imageTile.x + tileX;
+                        const PixelSampler sampler(uint64_t(line) * width + x, settings.frame);
+                        CostCounter::take();
+                        traceSamples(element, settings, rays,
+                            tileOffset * (passEnd - passStart) + (start - passStart), sampler,
+                            start, passEnd - start, rayCount, sampleSums[tileOffset],
+                            pPathStats ? &pathStats : nullptr,
+                            pAOVBuffer ? &aovSums[tileOffset] : nullptr);
+                        if (pCostMap)
+                        {
+                            costs[tileOffset] += CostCounter::take();
+                        }
+                    }
+                }
+            }
+
+            // Compute the radiance of each pixel in the tile buffer, keeping the stored radiance of
+            // pixels that already have enough samples.
+            bool tileChanged = false;
+            for (uint32_t bufferY = tile.y; bufferY < tile.y + tile.height; bufferY++)
+            {
+                for (uint32_t bufferX = tile.x; bufferX < tile.x + tile.width; bufferX++)
+                {
+                    const size_t tileOffset =
+                        size_t(bufferY - tile.y) * tile.width + (bufferX - tile.x);
+                    const float* pStored =
+                        framebuffer.getRow(bufferY) + size_t(bufferX) * Framebuffer::NUM_COMPONENTS;
+                    float* pPixel = &tileRadiance[tileOffset * Framebuffer::NUM_COMPONENTS];
+                    const uint32_t sampleCount = storedSampleCounts[tileOffset];
+                    if (sampleCount >= samples)
+                    {
+                        ::memcpy(pPixel, pStored, Framebuffer::NUM_COMPONENTS * sizeof(float));
+                        continue;
+                    }
+                    tileChanged = true;
+
+                    // Add the new samples to the sum of the samples already taken.
+                    Vec3 radiance;
+                    if (sampleCount > 0)
+                    {
+                        radiance = Vec3(pStored[0], pStored[1], pStored[2]) * float(sampleCount);
+                    }
+                    radiance += sampleSums[tileOffset];
+                    if (pCostMap)
+                    {
+                        pCostMap->set(bufferX, bufferY, costs[tileOffset]);
+                    }
+                    if (pAOVBuffer)
+                    {
+                        pAOVBuffer->set(
+                            bufferX, bufferY, aovSums[tileOffset], samples - sampleCount);
+                    }
+
+                    // Compute the average of the radiance samples to yield the pixel radiance, and
+                    // store it in the tile buffer.
+                    radiance /= samples;
+                    pPixel[0] = radiance.r();
+                    pPixel[1] = radiance.g();
+                    pPixel[2] = radiance.b();
+                }
+            }
+
+            // Commit the tile to the framebuffer and report it as finished, and increment the
+            // (atomic) number of completed tiles and rays traced. Committing is traced separately,
+            // as it waits while a checkpoint copies the framebuffer.
+            {
+                TraceScope commitScope("Commit tile", "index", tileIndex);
+                if (tileChanged)
+                {
+                    framebuffer.commitTile(tile, tileRadiance.data(), tileSampleCounts.data());
+                }
+                framebuffer.finishTile(tileIndex);
+            }
+            completedTiles++;
+            totalRayCount += rayCount;
+
+            // Update the progress if more than one second has elapsed since the last update.
+            //
+            // NOTE: A mutex is used to avoid a race condition with multiple threads.
+            if (!reportProgress)
+            {
+                continue;
+            }
+            auto nextTime = std::chrono::high_resolution_clock::now();
+            auto elapsed =
+                std::chrono::duration_cast<std::chrono::seconds>(nextTime - prevTime).count();
+            if (elapsed >= 1)
+            {
+                progressMutex.lock();
+                float progress = static_cast<float>(completedTiles) / tileCount;
+                updateProgress(progress);
+                prevTime = nextTime;
+                progressMutex.unlock();
+            }
+        }
+
+        // Merge the path statistics collected by this thread into the total, if requested.
+        if (pPathStats)
+        {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            pPathStats->merge(pathStats);
+        }
+    });
+
+    // Record the time spent rendering and the number of rays traced.
+    auto endTime = std::chrono::high_resolution_clock::now();
+    RenderStats stats;
+    stats.rayCount = totalRayCount;
+    stats.seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    // Finish progress updates, and report the time spent rendering.
+    if (reportProgress)
+    {
+        updateProgress(1.0f);
+        std::cout << std::endl;
+        std::cout
+            << std::setprecision(3)
+            << "Completed in " << stats.seconds << " seconds." << std::endl;
+    }
+
+    return stats;
+}
+
+} // namespace Luma
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <emmintrin.h>
+#include <ppl.h>
+
+namespace Luma {
+
+// The filters that can be used to resample (resize) an image.
+enum class ResampleFilter
+{
+    Nearest,  // Each pixel is copied from the nearest source pixel, giving hard pixel edges.
+    Bilinear, // Linear interpolation between the nearest 2x2 source pixels.
+    Lanczos,  // A windowed sinc filter with three lobes, which is sharper than bilinear.
+};
+
+// Returns the name of the specified resample filter, as used in scene files.
+inline const char* resampleFilterName(ResampleFilter filter)
+{
+    switch (filter)
+    {
+    case ResampleFilter::Bilinear: return "bilinear";
+    case ResampleFilter::Lanczos: return "lanczos";
+    default: return "nearest";
+    }
+}
+
+// Parses the name of a resample filter, returning whether the name was valid.
+inline bool parseResampleFilter(const string& name, ResampleFilter& filter)
+{
+    for (ResampleFilter candidate :
+        { ResampleFilter::Nearest, ResampleFilter::Bilinear, ResampleFilter::Lanczos })
+    {
+        if (name == resampleFilterName(candidate))
+        {
+            filter = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Resamples 8-bit RGB images from one size to another with a resample filter. The rows of the
+// destination image are computed in parallel, and can be computed in bands so that the whole
+// destination image never needs to be in memory.
+//
+// NOTE: The nearest filter copies whole destination rows when they come from the same source row,
+// and enlarges rows by integer scales with SSE2 stores of several pixels at a time (see
+// replicateRow()). The other filters are separable: each destination row is computed by filtering
+// the source rows vertically into a floating-point row, and then filtering that row horizontally.
+// The filter weights are computed once for each destination column and row. Filtering is done on
+// the (gamma corrected) 8-bit values, which is the usual practice for display images.
+class Resampler
+{
+public:
+    static const uint8_t NUM_COMPONENTS = 3;
+
+    // Constructor, with the dimensions of the source and destination images.
+    Resampler(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight,
+        ResampleFilter filter) :
+        m_srcWidth(srcWidth), m_srcHeight(srcHeight), m_dstWidth(dstWidth),
+        m_dstHeight(dstHeight), m_filter(filter)
+    {
+        // Determine if the image is enlarged by the same integer scale in both dimensions, for
+        // which nearest filtering is simply replication of each pixel.
+        if (dstWidth % srcWidth == 0 && dstWidth / srcWidth * srcHeight == dstHeight)
+        {
+            m_integerScale = dstWidth / srcWidth;
+        }
+
+        if (filter == ResampleFilter::Nearest)
+        {
+            m_columns.indices = nearestIndices(srcWidth, dstWidth);
+            m_rows.indices = nearestIndices(srcHeight, dstHeight);
+        }
+        else
+        {
+            m_columns = computeWeights(srcWidth, dstWidth, filter);
+            m_rows = computeWeights(srcHeight, dstHeight, filter);
+        }
+    }
+
+    // Resamples the whole source image into the destination image.
+    void resample(const uint8_t* pSrc, uint8_t* pDst) const
+    {
+        resampleRows(pSrc, 0, m_dstHeight, pDst);
+    }
+
+    // Resamples a range of rows of the destination image from the source image, storing them at
+    // the start of the destination buffer, which must have room for the rows.
+    void resampleRows(
+        const uint8_t* pSrc, uint32_t firstRow, uint32_t rowCount, uint8_t* pDst) const
+    {
+        assert(firstRow + rowCount <= m_dstHeight);
+
+        // Compute blocks of rows in parallel, so that each task can reuse its temporary row and
+        // copy rows from the previous row in the block.
+        static const uint32_t BLOCK_SIZE = 16;
+        const uint32_t blockCount = (rowCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        const size_t dstRowSize = size_t(m_dstWidth) * NUM_COMPONENTS;
+        Concurrency::parallel_for(0u, blockCount, [&](uint32_t block)
+        {
+            const uint32_t start = block * BLOCK_SIZE;
+            const uint32_t end = std::min(start + BLOCK_SIZE, rowCount);
+            vector<float> row(m_filter == ResampleFilter::Nearest
+                ? 0 : size_t(m_srcWidth) * NUM_COMPONENTS);
+            for (uint32_t i = start; i < end; i++)
+            {
+                uint8_t* pDstRow = pDst + i * dstRowSize;
+                if (m_filter == ResampleFilter::Nearest)
+                {
+                    resampleNearestRow(pSrc, firstRow + i, pDstRow, i > start);
+                }
+                else
+                {
+                    resampleFilteredRow(pSrc, firstRow + i, row.data(), pDstRow);
+                }
+            }
+        });
+    }
+
+    // Enlarges a row of pixels by an integer scale, repeating each source pixel "scale" times in
+    // the destination row.
+    //
+    // NOTE: Each 16-byte SSE2 store writes five copies of a pixel (and one byte of a sixth), so a
+    // pixel is replicated with a few stores rather than a copy per destination pixel. The stores
+    // can extend past the copies of a pixel; this is overwritten by the next pixel, and the last
+    // pixels are copied one at a time to avoid writing past the end of the row.
+    static void replicateRow(const uint8_t* pSrc, uint32_t srcWidth, uint32_t scale, uint8_t* pDst)
+    {
+        const size_t runSize = size_t(scale) * NUM_COMPONENTS;
+        const size_t storeCount = (scale + 4) / 5;
+        const size_t rowSize = srcWidth * runSize;
+        uint8_t* pDstStart = pDst;
+        for (uint32_t x = 0; x < srcWidth; x++, pSrc += NUM_COMPONENTS)
+        {
+            if (size_t(pDst - pDstStart) + storeCount * 15 + 1 <= rowSize)
+            {
+                // Create a pattern of the pixel repeated over 16 bytes: bytes 0-7 are RGBRGBRG and
+                // bytes 8-15 are BRGBRGBR.
+                const uint64_t pixel = pSrc[0] | (pSrc[1] << 8) | (pSrc[2] << 16);
+                const uint64_t low = pixel | (pixel << 24) | (pixel << 48);
+                const uint64_t high = (low >> 16) | (((pixel >> 16) | (pixel << 8)) << 48);
+                const __m128i pattern =
+                    _mm_set_epi64x(static_cast<int64_t>(high), static_cast<int64_t>(low));
+                for (size_t i = 0; i < storeCount; i++)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + i * 15), pattern);
+                }
+                pDst += runSize;
+            }
+            else
+            {
+                for (uint32_t i = 0; i < scale; i++)
+                {
+                    ::memcpy(pDst, pSrc, NUM_COMPONENTS);
+                    pDst += NUM_COMPONENTS;
+                }
+            }
+        }
+    }
+
+private:
+    // The filter weights for each destination column or row: the source indices and weights of the
+    // taps for each destination pixel, which are stored consecutively.
+    struct FilterWeights
+    {
+        uint32_t tapCount = 1;
+        vector<uint32_t> indices;
+        vector<float> weights;
+    };
+
+    uint32_t m_srcWidth;
+    uint32_t m_srcHeight;
+    uint32_t m_dstWidth;
+    uint32_t m_dstHeight;
+    ResampleFilter m_filter;
+    uint32_t m_integerScale = 0;
+    FilterWeights m_columns;
+    FilterWeights m_rows;
+
+    // Computes the nearest source index for each destination index, i.e. the source pixel that
+    // contains the center of the destination pixel.
+    static vector<uint32_t> nearestIndices(uint32_t srcSize, uint32_t dstSize)
+    {
+        vector<uint32_t> indices(dstSize);
+        for (uint32_t i = 0; i < dstSize; i++)
+        {
+            indices[i] =
+                static_cast<uint32_t>((uint64_t(i) * 2 + 1) * srcSize / (uint64_t(dstSize) * 2));
+        }
+
+        return indices;
+    }
+
+    // Evaluates the specified filter at the specified distance from its center, in source pixels.
+    static float evaluateFilter(ResampleFilter filter, float x)
+    {
+        x = std::abs(x);
+        if (filter == ResampleFilter::Bilinear)
+        {
+            return std::max(1.0f - x, 0.0f);
+        }
+
+        // Lanczos: sinc(x) * sinc(x / 3), for x within three pixels.
+        static const float LOBES = 3.0f;
+        if (x < 1e-5f)
+        {
+            return 1.0f;
+        }
+        if (x >= LOBES)
+        {
+            return 0.0f;
+        }
+        float piX = PI * x;
+
+        return LOBES * std::sin(piX) * std::sin(piX / LOBES) / (piX * piX);
+    }
+
+    // Computes the filter weights for resampling from the source size to the destination size in
+    // one dimension. When the image is reduced, the filter is widened by the reduction factor so
+    // that every source pixel contributes; taps outside the image use the nearest edge pixel.
+    static FilterWeights computeWeights(uint32_t srcSize, uint32_t dstSize, ResampleFilter filter)
+    {
+        const float radius = filter == ResampleFilter::Bilinear ? 1.0f : 3.0f;
+        const float ratio = static_cast<float>(srcSize) / dstSize;
+        const float filterScale = std::max(ratio, 1.0f);
+        const float support = radius * filterScale;
+
+        FilterWeights result;
+        result.tapCount = static_cast<uint32_t>(std::ceil(support)) * 2 + 1;
+        result.indices.resize(size_t(dstSize) * result.tapCount);
+        result.weights.resize(size_t(dstSize) * result.tapCount);
+        for (uint32_t i = 0; i < dstSize; i++)
+        {
+            // Find the center of the destination pixel in source pixel coordinates, and evaluate
+            // the filter for each source pixel within its support.
+            const float center = (i + 0.5f) * ratio - 0.5f;
+            const int first = static_cast<int>(std::floor(center - support)) + 1;
+            uint32_t* pIndices = &result.indices[size_t(i) * result.tapCount];
+            float* pWeights = &result.weights[size_t(i) * result.tapCount];
+            float total = 0.0f;
+            for (uint32_t tap = 0; tap < result.tapCount; tap++)
+            {
+                const int index = first + static_cast<int>(tap);
+                pIndices[tap] = static_cast<uint32_t>(clamp(index, 0, int(srcSize) - 1));
+                pWeights[tap] = evaluateFilter(filter, (index - center) / filterScale);
+                total += pWeights[tap];
+            }
+
+            // Normalize the weights so that they sum to one.
+            for (uint32_t tap = 0; tap < result.tapCount; tap++)
+            {
+                pWeights[tap] /= total;
+            }
+        }
+
+        return result;
+    }
+
+    // Computes a destination row with the nearest filter. If the previous destination row has been
+    // computed (just before this row in memory) and is from the same source row, it is copied.
+    void resampleNearestRow(
+        const uint8_t* pSrc, uint32_t y, uint8_t* pDstRow, bool hasPrevious) const
+    {
+        const size_t dstRowSize = size_t(m_dstWidth) * NUM_COMPONENTS;
+        const uint32_t srcY = m_rows.indices[y];
+        if (hasPrevious && m_rows.indices[y - 1] == srcY)
+        {
+            ::memcpy(pDstRow, pDstRow - dstRowSize, dstRowSize);
+            return;
+        }
+
+        const uint8_t* pSrcRow = pSrc + size_t(srcY) * m_srcWidth * NUM_COMPONENTS;
+        if (m_integerScale > 0)
+        {
+            replicateRow(pSrcRow, m_srcWidth, m_integerScale, pDstRow);
+            return;
+        }
+
+        const uint32_t* pIndices = m_columns.indices.data();
+        for (uint32_t x = 0; x < m_dstWidth; x++)
+        {
+            ::memcpy(pDstRow + x * NUM_COMPONENTS, pSrcRow + pIndices[x] * NUM_COMPONENTS,
+                NUM_COMPONENTS);
+        }
+    }
+
+    // Computes a destination row with a separable filter, using the specified temporary row with
+    // the width of the source image.
+    void resampleFilteredRow(const uint8_t* pSrc, uint32_t y, float* pRow, uint8_t* pDstRow) const
+    {
+        // Filter the source rows vertically into the temporary row. These loops are over contiguous
+        // values with no dependencies, so the compiler vectorizes them.
+        const size_t srcRowSize = size_t(m_srcWidth) * NUM_COMPONENTS;
+        const uint32_t* pRowIndices = &m_rows.indices[size_t(y) * m_rows.tapCount];
+        const float* pRowWeights = &m_rows.weights[size_t(y) * m_rows.tapCount];
+        std::fill(pRow, pRow + srcRowSize, 0.0f);
+        for (uint32_t tap = 0; tap < m_rows.tapCount; tap++)
+        {
+            const float weight = pRowWeights[tap];
+            if (weight == 0.0f)
+            {
+                continue;
+            }
+
+            const uint8_t* pSrcRow = pSrc + pRowIndices[tap] * srcRowSize;
+            for (size_t i = 0; i < srcRowSize; i++)
+            {
+                pRow[i] += weight * pSrcRow[i];
+            }
+        }
+
+        // Filter the temporary row horizontally into the destination row, rounding and clamping
+        // each component to the 8-bit range (the filters can overshoot).
+        const uint32_t tapCount = m_columns.tapCount;
+        for (uint32_t x = 0; x < m_dstWidth; x++)
+        {
+            const uint32_t* pIndices = &m_columns.indices[size_t(x) * tapCount];
+            const float* pWeights = &m_columns.weights[size_t(x) * tapCount];
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            for (uint32_t tap = 0; tap < tapCount; tap++)
+            {
+                const float* pPixel = pRow + pIndices[tap] * NUM_COMPONENTS;
+                r += pWeights[tap] * pPixel[0];
+                g += pWeights[tap] * pPixel[1];
+                b += pWeights[tap] * pPixel[2];
+            }
+            uint8_t* pDstPixel = pDstRow + x * NUM_COMPONENTS;
+            pDstPixel[0] = static_cast<uint8_t>(clamp(r + 0.5f, 0.0f, 255.0f));
+            pDstPixel[1] = static_cast<uint8_t>(clamp(g + 0.5f, 0.0f, 255.0f));
+            pDstPixel[2] = static_cast<uint8_t>(clamp(b + 0.5f, 0.0f, 255.0f));
+        }
+    }
+};
+
+} // namespace Luma
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Utils.h"
+
+namespace Luma {
+
+// Generates the sample values for a pixel: the quasirandom sequence index used for path tracing,
+// and 2D sample positions for other uses such as the position of each sample within the pixel.
+// All values are determined by the pixel index and sample index alone (and the frame number, for
+// animations), so any sample of any pixel can be computed again exactly, e.g. to continue a render
+// from a checkpoint, with any number of threads.
+//
+// NOTE: The 2D positions use the R2 sequence (an additive recurrence based on the "plastic"
+// number), which is a low discrepancy sequence like Halton, but is computed directly from the
+// sample index. Each pixel and dimension uses a separate random offset (a Cranley-Patterson
+// rotation) so that the positions are not correlated between pixels, or with the Halton sequence
+// used for path tracing. The recurrence is computed with 32-bit fixed point values, where wrapping
+// gives the fractional part exactly. See
+// https://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences.
+//
+// NOTE: Positions that are used together, such as the pixel and lens positions of a camera ray,
+// must come from one higher-dimensional sequence (see get4D()), not from 2D sequences with
+// separate rotations. Each rotation of R2 has the same steps, so for any sample the two positions
+// would differ by a constant, i.e. the lens position would be a fixed function of the pixel
+// position, giving a fixed pattern of error that doesn't converge.
+class PixelSampler
+{
+public:
+    // The uses of sample positions, each of which has a separate rotation of the sequence.
+    enum class Dimension : uint32_t
+    {
+        Pixel = 0, // The position of the sample within the pixel.
+        Lens = 1,  // The position of the sample on the camera lens, for depth of field.
+    };
+
+    // Constructor, for the pixel with the specified index, i.e. y * width + x, in the specified
+    // frame of an animation.
+    //
+    // NOTE: The frame number is included in the hash, so that each frame has a different noise
+    // pattern. Otherwise noise is fixed to the screen while objects move, which is distracting.
+    PixelSampler(uint64_t pixelIndex, uint32_t frame = 0)
+    {
+        const uint32_t high =
+            lowBias32Hash(static_cast<uint32_t>(pixelIndex >> 32) + frame * 0x9E3779B9u);
+        m_pixelHash = lowBias32Hash(static_cast<uint32_t>(pixelIndex) ^ high);
+    }
+
+    // Returns the index in the quasirandom sequence for path tracing the specified sample.
+    //
+    // NOTE: The sequence starts at a hashed value for each pixel, and is incremented by one for
+    // each sample; see the notes in render().
+    uint32_t sequenceIndex(uint32_t sample) const { return m_pixelHash + sample; }
+
+    // Gets the 2D sample position in [0.0, 1.0) for the specified sample and dimension.
+    void get2D(uint32_t sample, Dimension dimension, float& u1, float& u2) const
+    {
+        get2D(sample, 1, dimension, &u1, &u2);
+    }
+
+    // Gets the 2D sample positions in [0.0, 1.0) for the specified number of consecutive samples,
+    // starting with the specified sample, and the specified dimension. The positions are the same
+    // as those returned for each sample individually.
+    //
+    // NOTE: The offsets are hashed once for the whole batch, leaving only a multiply-add, a shift
+    // and a conversion for each value, in a loop that the compiler can vectorize.
+    void get2D(uint32_t firstSample, uint32_t count, Dimension dimension, float* pU1,
+        float* pU2) const
+    {
+        uint32_t offset1, offset2;
+        getOffsets(dimension, offset1, offset2);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const uint32_t sample = firstSample + i;
+            pU1[i] = toUnit(offset1 + sample * ALPHA1);
+            pU2[i] = toUnit(offset2 + sample * ALPHA2);
+        }
+    }
+
+    // Gets the pixel and lens positions in [0.0, 1.0) for the specified number of consecutive
+    // samples, starting with the specified sample, as the 2D positions of the Pixel and Lens
+    // dimensions respectively.
+    //
+    // NOTE: This uses the 4D R sequence (based on the root of x^5 = x + 1), so the pair of
+    // positions is well distributed in 4D, and the lens positions are independent of the pixel
+    // positions. The pixel positions are different from those of get2D() as a result, so this is
+    // only used when both are needed.
+    void get4D(uint32_t firstSample, uint32_t count, float* pPixel1, float* pPixel2,
+        float* pLens1, float* pLens2) const
+    {
+        uint32_t offset1, offset2, offset3, offset4;
+        getOffsets(Dimension::Pixel, offset1, offset2);
+        getOffsets(Dimension::Lens, offset3, offset4);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const uint32_t sample = firstSample + i;
+            pPixel1[i] = toUnit(offset1 + sample * ALPHA4_1);
+            pPixel2[i] = toUnit(offset2 + sample * ALPHA4_2);
+            pLens1[i] = toUnit(offset3 + sample * ALPHA4_3);
+            pLens2[i] = toUnit(offset4 + sample * ALPHA4_4);
+        }
+    }
+
+private:
+    // The R2 sequence steps, i.e. 1 / p and 1 / p^2 for the plastic number p, scaled by 2^32.
+    static const uint32_t ALPHA1 = 0xC13FA9A9u;
+    static const uint32_t ALPHA2 = 0x91E10DA6u;
+
+    // The 4D R sequence steps, i.e. 1 / g^k for k = 1 to 4, where g is the root of x^5 = x + 1,
+    // scaled by 2^32.
+    static const uint32_t ALPHA4_1 = 0xDB4F0B91u;
+    static const uint32_t ALPHA4_2 = 0xBBE05633u;
+    static const uint32_t ALPHA4_3 = 0xA0F2EC76u;
+    static const uint32_t ALPHA4_4 = 0x89E18285u;
+
+    // Gets the random offsets of the two values of the specified dimension for the pixel.
+    void getOffsets(Dimension dimension, uint32_t& offset1, uint32_t& offset2) const
+    {
+        offset1 = lowBias32Hash(m_pixelHash + static_cast<uint32_t>(dimension) * 0x9E3779B9u);
+        offset2 = lowBias32Hash(offset1);
+    }
+
+    // Converts the specified 32-bit fixed point value to a float in [0.0, 1.0), keeping 24 bits so
+    // that the value is exact and can't be rounded up to 1.0.
+    static float toUnit(uint32_t value) { return (value >> 8) * (1.0f / (1u << 24)); }
+
+    uint32_t m_pixelHash;
+};
+
+} // namespace Luma
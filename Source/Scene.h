@@ -1,27 +1,19 @@
 ﻿#pragma once
 
+#include "Cost.h"
+#include "Element.h"
+#include "Light.h"
+#include "Sphere.h"
 #include "Utils.h"
 
 namespace Luma {
 
-// A structure storing the data for a hit (ray-element intersection).
-struct Hit
-{
-    float t;
-    Vec3 position;
-    Vec3 normal;
-};
-
-// An interface for any element that can be intersected by a ray.
-class Element
-{
-public:
-    // Intersects the ray with the element, returns whether an intersection was found. If so, the
-    // hit value is update with properties of the intersection.
-    virtual bool intersect(const Ray& ray, Hit& hit) const = 0;
-};
-
-// A scene consisting of multiple elements suitable for rendering.
+// A scene consisting of multiple elements suitable for rendering, and the lights that illuminate it
+// (in addition to the background), which are also elements.
+//
+// NOTE: Spheres are stored in a flat array of sphere data rather than as individual elements, which
+// avoids an allocation and a virtual call per sphere. The array can also be external to the scene,
+// e.g. memory mapped from a binary scene file, so that it doesn't need to be copied at all.
 class Scene : public Element
 {
 public:
@@ -31,17 +23,92 @@ public:
         m_elements.push_back(pElement);
     }
 
+    // Adds a light to the scene.
+    void addLight(shared_ptr<Light> pLight)
+    {
+        m_lights.push_back(pLight);
+    }
+
+    // Overrides Element::lights().
+    virtual const vector<shared_ptr<Light>>& lights() const override { return m_lights; }
+
+    // Adds a sphere with the specified center and radius to the scene.
+    void addSphere(const Vec3& center, float radius)
+    {
+        ownSpheres();
+        m_ownedSpheres.push_back({ center, radius });
+        m_pSpheres = m_ownedSpheres.data();
+        m_sphereCount = m_ownedSpheres.size();
+    }
+
+    // Adds the specified external array of spheres to the scene. If the scene has no spheres yet,
+    // the array is not copied but used directly: it must remain valid as long as the specified
+    // owner, which is kept by the scene, e.g. a memory mapped file. Otherwise the spheres are copied.
+    void addSpheres(const SphereData* pSpheres, size_t count, shared_ptr<const void> pOwner)
+    {
+        if (m_sphereCount == 0)
+        {
+            m_ownedSpheres.clear();
+            m_pSpheres = pSpheres;
+            m_sphereCount = count;
+            m_pSpheresOwner = pOwner;
+        }
+        else
+        {
+            ownSpheres();
+            m_ownedSpheres.insert(m_ownedSpheres.end(), pSpheres, pSpheres + count);
+            m_pSpheres = m_ownedSpheres.data();
+            m_sphereCount = m_ownedSpheres.size();
+        }
+    }
+
+    // Returns the spheres of the scene.
+    const SphereData* spheres() const { return m_pSpheres; }
+
+    // Returns the number of spheres in the scene.
+    size_t sphereCount() const { return m_sphereCount; }
+
+    // Reserves storage for the specified number of spheres, e.g. before adding many of them.
+    void reserve(size_t count)
+    {
+        ownSpheres();
+        m_ownedSpheres.reserve(count);
+        m_pSpheres = m_ownedSpheres.data();
+    }
+
+    // Returns the number of elements in the scene, including spheres and lights.
+    size_t size() const { return m_sphereCount + m_elements.size() + m_lights.size(); }
+
     // Overrides Element.Intersect().
     virtual bool intersect(const Ray& ray, Hit& hit) const override
     {
+        // Count the ray and its intersection tests, for a cost heatmap (if enabled).
+        CostCounter::countTraversal(size());
+
         // Initialize the closest hit with the rays TMax value.
         bool anyHit = false;
         Hit closestHit;
         closestHit.t = ray.tMax();
 
-        // Iterate the elements, finding the closest intersection with the ray.
-        for (auto element : m_elements)
+        // Iterate the spheres, finding the closest intersection with the ray. The maximum distance
+        // of the ray is reduced with each hit, so that farther spheres are rejected early.
+        Ray closestRay(ray);
+        for (size_t i = 0; i < m_sphereCount; i++)
         {
+            const SphereData& sphere = m_pSpheres[i];
+            if (intersectSphere(sphere.center, sphere.radius, closestRay, closestHit))
+            {
+                anyHit = true;
+                closestHit.id = static_cast<uint32_t>(i + 1);
+                closestRay = Ray(ray.origin(), ray.direction(), ray.tMin(), closestHit.t);
+            }
+        }
+
+        // Iterate the elements, finding the closest intersection with the ray. The elements are
+        // identified after the spheres.
+        for (size_t i = 0; i < m_elements.size(); i++)
+        {
+            const shared_ptr<Element>& element = m_elements[i];
             // If the ray intersects the element, and the hit is closer that the closest one so far,
             // record it as the closest hit.
             Hit nextHit;
@@ -49,6 +116,20 @@ public:
             {
                 anyHit = true;
                 closestHit = nextHit;
+                closestHit.id = static_cast<uint32_t>(m_sphereCount + i + 1);
+            }
+        }
+
+        // Iterate the lights in the same way, identified after the elements.
+        for (size_t i = 0; i < m_lights.size(); i++)
+        {
+            Hit nextHit;
+            if (m_lights[i]->intersect(ray, nextHit) && nextHit.t < closestHit.t)
+            {
+                anyHit = true;
+                closestHit = nextHit;
+                closestHit.id = static_cast<uint32_t>(m_sphereCount + m_elements.size() + i + 1);
+                closestHit.pLight = m_lights[i].get();
             }
         }
 
@@ -62,8 +143,49 @@ public:
         return anyHit;
     }
 
+    // Overrides Element::occluded(), returning at the first intersection found.
+    virtual bool occluded(const Ray& ray) const override
+    {
+        // Count the ray and the intersection tests that were needed, for a cost heatmap.
+        size_t tests = 0;
+        bool result = false;
+        Hit hit;
+        for (size_t i = 0; i < m_sphereCount && !result; i++, tests++)
+        {
+            result = intersectSphere(m_pSpheres[i].center, m_pSpheres[i].radius, ray, hit);
+        }
+        for (size_t i = 0; i < m_elements.size() && !result; i++, tests++)
+        {
+            result = m_elements[i]->occluded(ray);
+        }
+        for (size_t i = 0; i < m_lights.size() && !result; i++, tests++)
+        {
+            result = m_lights[i]->occluded(ray);
+        }
+        CostCounter::countTraversal(tests);
+
+        return result;
+    }
+
 private:
     vector<shared_ptr<Element>> m_elements;
+    vector<shared_ptr<Light>> m_lights;
+    vector<SphereData> m_ownedSpheres;
+    const SphereData* m_pSpheres = nullptr;
+    size_t m_sphereCount = 0;
+    shared_ptr<const void> m_pSpheresOwner;
+
+    // Makes sure the spheres are stored in the scene's own array, copying any external spheres to
+    // it, so that more spheres can be added.
+    void ownSpheres()
+    {
+        if (m_pSpheresOwner)
+        {
+            m_ownedSpheres.assign(m_pSpheres, m_pSpheres + m_sphereCount);
+            m_pSpheres = m_ownedSpheres.data();
+            m_pSpheresOwner.reset();
+        }
+    }
 };
 
 } // namespace Luma
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "Scene.h"
+#include "Sphere.h"
+#include "Trace.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+namespace Luma {
+
+// The types of scenes that can be generated procedurally, e.g. for testing how rendering scales
+// with the number of primitives in a scene.
+enum class SceneType
+{
+    RandomSpheres, // The "Ray Tracing in One Weekend" field of random spheres on a ground sphere.
+    Grid,          // A uniform 3D grid of spheres.
+    Clusters,      // Spheres in (roughly) normally distributed clusters.
+};
+
+// Returns the name of the specified scene type, as used on the command line.
+inline const char* sceneTypeName(SceneType type)
+{
+    switch (type)
+    {
+    case SceneType::RandomSpheres: return "random";
+    case SceneType::Grid: return "grid";
+    case SceneType::Clusters: return "clusters";
+    }
+
+    return "unknown";
+}
+
+// Parses a scene type from the specified name, returning whether the name was recognized.
+inline bool parseSceneType(const string& name, SceneType& type)
+{
+    for (SceneType candidate : { SceneType::RandomSpheres, SceneType::Grid, SceneType::Clusters })
+    {
+        if (name == sceneTypeName(candidate))
+        {
+            type = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Creates a random number generator state from a seed. The state is never zero, which would
+// otherwise make the XOR shift generator return zero forever.
+inline uint32_t createRandomState(uint32_t seed)
+{
+    return wangHash(seed) | 1u;
+}
+
+// Generates a field of random spheres resting on a large ground sphere, similar to the final scene
+// of "Ray Tracing in One Weekend", with the specified total number of spheres.
+//
+// NOTE: The field always covers the same area in front of the (fixed) camera, so the spheres become
+// smaller and denser as the count increases.
+void generateRandomSpheres(Scene& scene, size_t count, uint32_t seed)
+{
+    scene.reserve(scene.sphereCount() + count);
+    uint32_t state = createRandomState(seed);
+
+    // Add the ground sphere, with its top at the same height as the default scene.
+    static const float GROUND_HEIGHT = -0.5f;
+    static const float GROUND_RADIUS = 1000.0f;
+    if (count == 0)
+    {
+        return;
+    }
+    scene.addSphere(Vec3(0.0f, GROUND_HEIGHT - GROUND_RADIUS, 0.0f), GROUND_RADIUS);
+    count--;
+
+    // Add the three large spheres in the middle of the field.
+    static const float LARGE_RADIUS = 0.5f;
+    const Vec3 largeCenters[] =
+    {
+        Vec3(-1.5f, GROUND_HEIGHT + LARGE_RADIUS, -4.0f),
+        Vec3(0.0f, GROUND_HEIGHT + LARGE_RADIUS, -3.0f),
+        Vec3(1.5f, GROUND_HEIGHT + LARGE_RADIUS, -4.0f),
+    };
+    for (size_t i = 0; i < 3 && count > 0; i++, count--)
+    {
+        scene.addSphere(largeCenters[i], LARGE_RADIUS);
+    }
+
+    // Add the small spheres, one in each cell of a square grid on the ground, with a random offset
+    // within the cell. The grid is sized to fit the remaining sphere count, and filled row by row
+    // from the front.
+    static const float FIELD_SIZE = 22.0f;
+    static const float FIELD_NEAR = -1.0f;
+    size_t cellsPerSide = static_cast<size_t>(ceil(sqrt(static_cast<double>(count))));
+    float cellSize = FIELD_SIZE / std::max<size_t>(cellsPerSide, 1);
+    float radius = 0.2f * cellSize;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t row = i / cellsPerSide;
+        size_t column = i % cellsPerSide;
+        float x = -0.5f * FIELD_SIZE + (column + 0.1f + 0.8f * randomFloat(state)) * cellSize;
+        float z = FIELD_NEAR - (row + 0.1f + 0.8f * randomFloat(state)) * cellSize;
+        scene.addSphere(Vec3(x, GROUND_HEIGHT + radius, z), radius);
+    }
+}
+
+// Generates a uniform 3D grid of spheres with the specified total number of spheres. The radius of
+// each sphere is varied slightly, using the specified seed.
+void generateSphereGrid(Scene& scene, size_t count, uint32_t seed)
+{
+    scene.reserve(scene.sphereCount() + count);
+    uint32_t state = createRandomState(seed);
+
+    // Compute the number of spheres along each axis of a cube that can hold all of the spheres, and
+    // fill the cube layer by layer from the front.
+    static const Vec3 GRID_CENTER(0.0f, 0.0f, -3.0f);
+    static const float GRID_SIZE = 2.0f;
+    size_t spheresPerSide = static_cast<size_t>(ceil(cbrt(static_cast<double>(count))));
+    spheresPerSide = std::max<size_t>(spheresPerSide, 1);
+    float spacing = GRID_SIZE / spheresPerSide;
+    Vec3 start = GRID_CENTER - Vec3(1.0f, 1.0f, -1.0f) * (0.5f * (GRID_SIZE - spacing));
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t x = i % spheresPerSide;
+        size_t y = (i / spheresPerSide) % spheresPerSide;
+        size_t z = i / (spheresPerSide * spheresPerSide);
+        Vec3 center = start + Vec3(x * spacing, y * spacing, z * -spacing);
+        float radius = (0.3f + 0.15f * randomFloat(state)) * spacing;
+        scene.addSphere(center, radius);
+    }
+}
+
+// Generates clusters of spheres with the specified total number of spheres. The cluster centers
+// are uniformly distributed in a box in front of the camera, and the spheres of each cluster are
+// (roughly) normally distributed around the cluster center.
+void generateClusteredSpheres(Scene& scene, size_t count, uint32_t seed)
+{
+    scene.reserve(scene.sphereCount() + count);
+    uint32_t state = createRandomState(seed);
+
+    // Use about as many clusters as there are spheres in each cluster, which gives both sparse and
+    // dense regions at any sphere count. The sphere radius shrinks as the count grows so that the
+    // clusters don't simply become solid balls.
+    static const Vec3 BOX_MIN(-2.0f, -1.0f, -6.0f);
+    static const Vec3 BOX_SIZE(4.0f, 2.0f, 4.0f);
+    static const float CLUSTER_SIZE = 0.3f;
+    size_t clusterCount = std::max<size_t>(static_cast<size_t>(sqrt(static_cast<double>(count))), 1);
+    float radius = 0.1f / static_cast<float>(cbrt(static_cast<double>(std::max<size_t>(count, 1))));
+    radius = std::max(radius, 0.0005f);
+    Vec3 clusterCenter;
+    for (size_t i = 0; i < count; i++)
+    {
+        // Start a new cluster with a random center when the previous one is full.
+        if (i % ((count + clusterCount - 1) / clusterCount) == 0)
+        {
+            clusterCenter = BOX_MIN + BOX_SIZE * Vec3(
+                randomFloat(state), randomFloat(state), randomFloat(state));
+        }
+
+        // Approximate a normal distribution for each axis by summing uniform random numbers, i.e.
+        // with the central limit theorem. This is cheaper than the Box-Muller transform, and the
+        // result is bounded.
+        float offset[3];
+        for (float& value : offset)
+        {
+            value = randomFloat(state) + randomFloat(state) + randomFloat(state) - 1.5f;
+        }
+        Vec3 center = clusterCenter + Vec3(offset[0], offset[1], offset[2]) * CLUSTER_SIZE;
+        scene.addSphere(center, radius);
+    }
+}
+
+// Generates a scene of the specified type, with the specified total number of spheres. The same
+// seed always generates the same scene.
+void generateScene(Scene& scene, SceneType type, size_t count, uint32_t seed)
+{
+    TraceScope scope("Generate scene", "count", static_cast<int64_t>(count));
+    switch (type)
+    {
+    case SceneType::RandomSpheres: generateRandomSpheres(scene, count, seed); break;
+    case SceneType::Grid: generateSphereGrid(scene, count, seed); break;
+    case SceneType::Clusters: generateClusteredSpheres(scene, count, seed); break;
+    }
+}
+
+} // namespace Luma
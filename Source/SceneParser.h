@@ -0,0 +1,494 @@
+#pragma once
+
+#include "BinaryScene.h"
+#include "Denoiser.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "SceneGenerator.h"
+#include "Sphere.h"
+#include "Trace.h"
+#include "Vec3.h"
+
+#include <charconv>
+#include <fstream>
+#include <string_view>
+
+namespace Luma {
+
+// A parser for scene description files. These are text files with one statement per line, where
+// each statement is a keyword followed by values separated by whitespace. Anything after a "#" is a
+// comment. The supported statements are:
+//
+//   resolution <width> <height>         The dimensions of the rendered image, in pixels.
+//   crop <x> <y> <width> <height>       Render and save only this region of the image.
+//   order <rows|center|hotspots>        The order in which tiles are rendered.
+//   hotspot <x> <y>                     A point to render first, outward; sets "hotspots" order.
+//   scale <factor> [filter]             The scale factor and resample filter (nearest, bilinear,
+//                                       or lanczos) for resizing the saved PNG image.
+//   encoding <gamma|srgb>               The color encoding for PNG output: gamma 2.2 or exact sRGB.
+//   samples <count>                     The number of samples per pixel.
+//   depth <count>                       The maximum number of path segments for each sample.
+//   output <path>                       The path of the output image file (without spaces).
+//   frames <first> <last>               Render a range of frames as an animation, numbered in the
+//                                       output path with "%d" or "%04d" (or before the extension).
+//   spill <path>                        A temporary file for the framebuffer, for very large images.
+//   exr <none|zip> [tileSize]           The compression and tile size for OpenEXR output files.
+//   checkpoint <seconds> [path]         Save checkpoints at an interval, to resume with --resume.
+//   heatmap [tests|traversals|bounces]  Save a false-color image of the cost of each pixel, with
+//                                       LUMA_COST_HEATMAP builds; see Cost.h.
+//   denoise [passes]                    Denoise the image before saving it, with 1 to 10 passes
+//                                       (default 5); see Denoiser.h.
+//   aov <name> [name ...]               Save AOVs as PFM images: albedo, normal, depth, id (the
+//                                       element hit), or samples; see AOV.h.
+//   camera <eye> <target> [fov [up]]    The camera position and the point it looks at (x y z each),
+//                                       the vertical field of view in degrees (default 90), and the
+//                                       up direction (default 0 1 0); see Camera.h.
+//   lens <aperture> [focusDistance]     A thin lens for depth of field: the lens diameter, and the
+//                                       distance in focus (default: to the camera target).
+//   sphere <x> <y> <z> <radius>         A sphere with a center and (positive) radius.
+//   light disk <center> <normal> <radius> <radiance>
+//                                       A disk light, emitting radiance (r g b) toward its normal
+//                                       (x y z each); see Light.h.
+//   light sphere <center> <radius> <radiance>
+//                                       A sphere light, emitting radiance (r g b) from its surface.
+//   generate <type> <count> [seed]      A generated scene; see SceneGenerator.h.
+//   include <path>                      The geometry in a binary scene file; see BinaryScene.h.
+//
+// NOTE: The file is read in large blocks and parsed in place, without creating strings or other
+// allocations for each line, so that files with millions of statements can be parsed quickly.
+class SceneParser
+{
+public:
+    // Parses the scene description file at the specified path, adding its elements to the scene
+    // and updating the render settings with any settings in the file. Returns whether the file was
+    // parsed successfully; if not, error() describes the problem.
+    bool parse(const string& filePath, Scene& scene, RenderSettings& settings)
+    {
+        m_pScene = &scene;
+        m_pSettings = &settings;
+        m_lineNumber = 0;
+        m_error.clear();
+
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file)
+        {
+            m_error = "Unable to open \"" + filePath + "\".";
+            return false;
+        }
+
+        // Read the file in blocks, parsing every complete line in the buffer. Any incomplete line at
+        // the end of the buffer is moved to the start of the buffer, and the next block is read
+        // after it.
+        static const size_t BLOCK_SIZE = 1 << 20;
+        vector<char> buffer(BLOCK_SIZE);
+        size_t bufferUsed = 0;
+        bool endOfFile = false;
+        while (!endOfFile)
+        {
+            // Grow the buffer if a single line fills it, which should be very rare.
+            if (bufferUsed == buffer.size())
+            {
+                buffer.resize(buffer.size() * 2);
+            }
+
+            file.read(buffer.data() + bufferUsed, buffer.size() - bufferUsed);
+            bufferUsed += static_cast<size_t>(file.gcount());
+            endOfFile = !file;
+
+            // Parse each complete line, i.e. terminated with a newline. At the end of the file, the
+            // remainder of the buffer is treated as the last line.
+            const char* pStart = buffer.data();
+            const char* pEnd = buffer.data() + bufferUsed;
+            while (pStart < pEnd)
+            {
+                const char* pNewline =
+                    static_cast<const char*>(::memchr(pStart, '\n', pEnd - pStart));
+                if (!pNewline && !endOfFile)
+                {
+                    break;
+                }
+
+                const char* pLineEnd = pNewline ? pNewline : pEnd;
+                m_lineNumber++;
+                if (!parseLine(pStart, pLineEnd))
+                {
+                    m_error = filePath + "(" + std::to_string(m_lineNumber) + "): " + m_error;
+                    return false;
+                }
+                pStart = pLineEnd + (pNewline ? 1 : 0);
+            }
+
+            // Move the incomplete line (if any) to the start of the buffer.
+            bufferUsed = pEnd - pStart;
+            ::memmove(buffer.data(), pStart, bufferUsed);
+        }
+
+        return true;
+    }
+
+    // Parses render settings statements in the specified text, updating the render settings, e.g.
+    // to apply overrides to the settings of a scene file. Statements that add elements to a scene
+    // are not allowed. Returns whether the text was parsed successfully; if not, error() describes
+    // the problem.
+    bool parseSettings(const string& text, RenderSettings& settings)
+    {
+        m_pScene = nullptr;
+        m_pSettings = &settings;
+        m_lineNumber = 0;
+        m_error.clear();
+
+        const char* pStart = text.data();
+        const char* pEnd = text.data() + text.size();
+        while (pStart < pEnd)
+        {
+            const char* pNewline = static_cast<const char*>(::memchr(pStart, '\n', pEnd - pStart));
+            const char* pLineEnd = pNewline ? pNewline : pEnd;
+            m_lineNumber++;
+            if (!parseLine(pStart, pLineEnd))
+            {
+                m_error = "Line " + std::to_string(m_lineNumber) + ": " + m_error;
+                return false;
+            }
+            pStart = pLineEnd + (pNewline ? 1 : 0);
+        }
+
+        return true;
+    }
+
+    // Returns a description of the error from the last call to parse() or parseSettings(), if any.
+    const string& error() const { return m_error; }
+
+private:
+    Scene* m_pScene = nullptr;
+    RenderSettings* m_pSettings = nullptr;
+    size_t m_lineNumber = 0;
+    string m_error;
+
+    // The current position and end of the line being parsed.
+    const char* m_pCurrent = nullptr;
+    const char* m_pLineEnd = nullptr;
+
+    // Parses a single line, which does not include the newline character. Returns whether the line
+    // was parsed successfully.
+    bool parseLine(const char* pStart, const char* pEnd)
+    {
+        // Ignore any comment, and then any empty line.
+        const char* pComment = static_cast<const char*>(::memchr(pStart, '#', pEnd - pStart));
+        m_pCurrent = pStart;
+        m_pLineEnd = pComment ? pComment : pEnd;
+        std::string_view keyword = nextToken();
+        if (keyword.empty())
+        {
+            return true;
+        }
+
+        // Parse the statement for the keyword. The sphere statement is checked first, as it is by
+        // far the most common in large files. Statements that add elements require a scene.
+        bool result = false;
+        if (!m_pScene && (keyword == "sphere" || keyword == "light" || keyword == "generate"
+            || keyword == "include"))
+        {
+            m_error = "The \"" + string(keyword) + "\" statement is not allowed here.";
+            return false;
+        }
+        else if (keyword == "sphere")
+        {
+            float x = 0.0f, y = 0.0f, z = 0.0f, radius = 0.0f;
+            result = parseValue(x) && parseValue(y) && parseValue(z) && parseValue(radius)
+                && radius > 0.0f;
+            if (result)
+            {
+                m_pScene->addSphere(Vec3(x, y, z), radius);
+            }
+        }
+        else if (keyword == "resolution")
+        {
+            result = parseValue(m_pSettings->width) && parseValue(m_pSettings->height)
+                && m_pSettings->width > 0 && m_pSettings->height > 0;
+        }
+        else if (keyword == "crop")
+        {
+            result = parseValue(m_pSettings->cropX) && parseValue(m_pSettings->cropY)
+                && parseValue(m_pSettings->cropWidth) && parseValue(m_pSettings->cropHeight)
+                && m_pSettings->cropWidth > 0 && m_pSettings->cropHeight > 0;
+        }
+        else if (keyword == "order")
+        {
+            result = parseTileOrder(string(nextToken()), m_pSettings->tileOrder);
+        }
+        else if (keyword == "hotspot")
+        {
+            ImagePoint hotspot = {};
+            result = parseValue(hotspot.x) && parseValue(hotspot.y);
+            if (result)
+            {
+                m_pSettings->hotspots.push_back(hotspot);
+                m_pSettings->tileOrder = TileOrder::Hotspots;
+            }
+        }
+        else if (keyword == "scale")
+        {
+            result = parseValue(m_pSettings->scale) && m_pSettings->scale > 0.0f;
+            result = result && (nextTokenIsEnd()
+                || parseResampleFilter(string(nextToken()), m_pSettings->filter));
+        }
+        else if (keyword == "encoding")
+        {
+            result = parseColorEncoding(string(nextToken()), m_pSettings->encoding);
+        }
+        else if (keyword == "samples")
+        {
+            result = parseValue(m_pSettings->samples) && m_pSettings->samples > 0;
+        }
+        else if (keyword == "depth")
+        {
+            result = parseValue(m_pSettings->maxDepth) && m_pSettings->maxDepth > 0;
+        }
+        else if (keyword == "output")
+        {
+            std::string_view path = nextToken();
+            result = !path.empty();
+            m_pSettings->outputPath = string(path);
+        }
+        else if (keyword == "frames")
+        {
+            result = parseValue(m_pSettings->firstFrame) && parseValue(m_pSettings->lastFrame)
+                && m_pSettings->lastFrame >= m_pSettings->firstFrame;
+            m_pSettings->animated = true;
+        }
+        else if (keyword == "spill")
+        {
+            std::string_view path = nextToken();
+            result = !path.empty();
+            m_pSettings->spillPath = string(path);
+        }
+        else if (keyword == "exr")
+        {
+            std::string_view compression = nextToken();
+            result = compression == "none" || compression == "zip";
+            m_pSettings->exrCompression =
+                compression == "zip" ? EXRCompression::ZIP : EXRCompression::None;
+            m_pSettings->exrTileSize = 0;
+            result = result && (nextTokenIsEnd() || parseValue(m_pSettings->exrTileSize));
+        }
+        else if (keyword == "checkpoint")
+        {
+            result = parseValue(m_pSettings->checkpointInterval)
+                && m_pSettings->checkpointInterval >= 0.0;
+            std::string_view path = nextToken();
+            m_pSettings->checkpointPath = string(path);
+        }
+        else if (keyword == "heatmap")
+        {
+            m_pSettings->heatmap = true;
+            m_pSettings->heatmapMetric = CostMetric::Tests;
+            result = nextTokenIsEnd()
+                || parseCostMetric(string(nextToken()), m_pSettings->heatmapMetric);
+        }
+        else if (keyword == "denoise")
+        {
+            m_pSettings->denoise = true;
+            m_pSettings->denoisePasses = 5;
+            result = nextTokenIsEnd() || (parseValue(m_pSettings->denoisePasses)
+                && m_pSettings->denoisePasses >= 1
+                && m_pSettings->denoisePasses <= Denoiser::MAX_PASSES);
+        }
+        else if (keyword == "aov")
+        {
+            result = !nextTokenIsEnd();
+            while (result && !nextTokenIsEnd())
+            {
+                AOV aov = AOV::Albedo;
+                result = parseAOV(string(nextToken()), aov);
+                m_pSettings->aovs.push_back(aov);
+            }
+        }
+        else if (keyword == "camera")
+        {
+            // Keep the lens, which is set with a separate statement.
+            CameraSettings camera;
+            camera.aperture = m_pSettings->camera.aperture;
+            camera.focusDistance = m_pSettings->camera.focusDistance;
+            result = parseVec3(camera.position) && parseVec3(camera.lookAt);
+            result = result && (nextTokenIsEnd() || parseValue(camera.verticalFOV));
+            result = result && (nextTokenIsEnd() || parseVec3(camera.up));
+            result = result && camera.isValid();
+            m_pSettings->camera = camera;
+        }
+        else if (keyword == "lens")
+        {
+            CameraSettings& camera = m_pSettings->camera;
+            camera.focusDistance = 0.0f;
+            result = parseValue(camera.aperture);
+            result = result && (nextTokenIsEnd() || parseValue(camera.focusDistance));
+            result = result && camera.isValid();
+        }
+        else if (keyword == "light")
+        {
+            result = parseLight();
+        }
+        else if (keyword == "generate")
+        {
+            SceneType type = SceneType::RandomSpheres;
+            size_t count = 0;
+            uint32_t seed = 0;
+            result = parseSceneType(string(nextToken()), type) && parseValue(count);
+            result = result && (nextTokenIsEnd() || parseValue(seed));
+            if (result)
+            {
+                generateScene(*m_pScene, type, count, seed);
+            }
+        }
+        else if (keyword == "include")
+        {
+            // Binary scene paths are relative to the working directory, like the output path.
+            BinaryScene binaryScene;
+            std::string_view path = nextToken();
+            result = !path.empty();
+            if (result && !binaryScene.load(string(path), *m_pScene))
+            {
+                m_error = binaryScene.error();
+                return false;
+            }
+        }
+        else
+        {
+            m_error = "Unknown statement \"" + string(keyword) + "\".";
+            return false;
+        }
+
+        // Report an error if a value was missing or invalid, or there are extra values.
+        if (!result || !nextTokenIsEnd())
+        {
+            m_error = "Invalid \"" + string(keyword) + "\" statement.";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Returns the next whitespace-separated token on the current line, or an empty token if there
+    // are no more tokens.
+    std::string_view nextToken()
+    {
+        while (m_pCurrent < m_pLineEnd && isSpace(*m_pCurrent))
+        {
+            m_pCurrent++;
+        }
+        const char* pStart = m_pCurrent;
+        while (m_pCurrent < m_pLineEnd && !isSpace(*m_pCurrent))
+        {
+            m_pCurrent++;
+        }
+
+        return std::string_view(pStart, m_pCurrent - pStart);
+    }
+
+    // Returns whether there are no more tokens on the current line. This does not consume a token.
+    bool nextTokenIsEnd()
+    {
+        const char* pCurrent = m_pCurrent;
+        bool result = nextToken().empty();
+        m_pCurrent = pCurrent;
+
+        return result;
+    }
+
+    // Parses the next token on the current line as a number, returning whether it was valid.
+    template<class T>
+    bool parseValue(T& value)
+    {
+        std::string_view token = nextToken();
+        const char* pTokenEnd = token.data() + token.size();
+        std::from_chars_result result = std::from_chars(token.data(), pTokenEnd, value);
+
+        return !token.empty() && result.ec == std::errc() && result.ptr == pTokenEnd;
+    }
+
+    // Parses the values of a light statement after the keyword, and adds the light to the scene.
+    // Returns whether the values were valid.
+    bool parseLight()
+    {
+        std::string_view type = nextToken();
+        if (type == "disk")
+        {
+            Vec3 center, normal, radiance;
+            float radius = 0.0f;
+            if (!parseVec3(center) || !parseVec3(normal) || !parseValue(radius)
+                || !parseVec3(radiance) || dot(normal, normal) == 0.0f || radius <= 0.0f)
+            {
+                return false;
+            }
+            m_pScene->addLight(make_shared<DiskLight>(center, normal, radius, radiance));
+
+            return true;
+        }
+        else if (type == "sphere")
+        {
+            Vec3 center, radiance;
+            float radius = 0.0f;
+            if (!parseVec3(center) || !parseValue(radius) || !parseVec3(radiance)
+                || radius <= 0.0f)
+            {
+                return false;
+            }
+            m_pScene->addLight(make_shared<SphereLight>(center, radius, radiance));
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // Parses the next three tokens on the current line as a vector, returning whether they were
+    // valid.
+    bool parseVec3(Vec3& value)
+    {
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+        if (!parseValue(x) || !parseValue(y) || !parseValue(z))
+        {
+            return false;
+        }
+        value = Vec3(x, y, z);
+
+        return true;
+    }
+
+    // Returns whether the specified character is whitespace. This is simpler (and faster) than
+    // isspace(), which depends on the locale.
+    static bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+};
+
+// Loads the scene file (binary or text) at the specified path, adding its elements to the scene and
+// updating the render settings with any settings in the file. Returns whether the file was loaded
+// successfully; if not, the error describes the problem.
+inline bool loadSceneFile(
+    const string& filePath, Scene& scene, RenderSettings& settings, string& error)
+{
+    TraceScope scope("Load scene");
+    if (BinaryScene::isBinarySceneFile(filePath))
+    {
+        BinaryScene binaryScene;
+        if (!binaryScene.load(filePath, scene))
+        {
+            error = binaryScene.error();
+            return false;
+        }
+    }
+    else
+    {
+        SceneParser parser;
+        if (!parser.parse(filePath, scene, settings))
+        {
+            error = parser.error();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace Luma
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace Luma {
+
+// A stream socket, which is either a Unix domain socket with a file path as its address (supported
+// on Windows 10 and later), or a TCP socket with an address of the form "host:port", e.g.
+// "render-07:5000" or ":5000" to listen on all interfaces. Unix domain sockets are faster, while
+// TCP sockets connect processes on different machines. The socket is closed when the object is
+// destroyed; a socket can be moved but not copied.
+//
+// NOTE: Received data is buffered, so that text lines and binary data can be mixed in a protocol.
+class Socket
+{
+public:
+    // Constructor, for an invalid (closed) socket.
+    Socket() {}
+
+    // Move constructor and assignment.
+    Socket(Socket&& other) { *this = std::move(other); }
+    Socket& operator=(Socket&& other)
+    {
+        if (this != &other)
+        {
+            close();
+            std::swap(m_socket, other.m_socket);
+            std::swap(m_unixPath, other.m_unixPath);
+            std::swap(m_buffer, other.m_buffer);
+            std::swap(m_bufferStart, other.m_bufferStart);
+            std::swap(m_hasDeadline, other.m_hasDeadline);
+            std::swap(m_deadline, other.m_deadline);
+            std::swap(m_timedOut, other.m_timedOut);
+        }
+
+        return *this;
+    }
+
+    // Destructor.
+    ~Socket() { close(); }
+
+    // Creates a socket listening for connections on the specified address. Any existing file at a
+    // Unix domain socket path (e.g. from a previous process) is replaced, and the file is deleted
+    // when the socket is closed. Returns an invalid socket if the address could not be used.
+    static Socket listen(const string& address)
+    {
+        Socket result;
+        if (!startup())
+        {
+            return result;
+        }
+
+        string host, port;
+        if (splitTCPAddress(address, host, port))
+        {
+            addrinfo hints = {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_PASSIVE;
+            addrinfo* pInfo = nullptr;
+            if (::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &pInfo)
+                != 0)
+            {
+                return result;
+            }
+            result.m_socket = ::socket(pInfo->ai_family, pInfo->ai_socktype, pInfo->ai_protocol);
+            if (result.m_socket != INVALID_SOCKET
+                && (::bind(result.m_socket, pInfo->ai_addr, static_cast<int>(pInfo->ai_addrlen))
+                    == SOCKET_ERROR || ::listen(result.m_socket, SOMAXCONN) == SOCKET_ERROR))
+            {
+                result.close();
+            }
+            ::freeaddrinfo(pInfo);
+        }
+        else
+        {
+            sockaddr_un unixAddress = {};
+            if (!getUnixAddress(address, unixAddress))
+            {
+                return result;
+            }
+            std::remove(address.c_str());
+            result.m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (result.m_socket != INVALID_SOCKET
+                && (::bind(result.m_socket, reinterpret_cast<const sockaddr*>(&unixAddress),
+                    sizeof(unixAddress)) == SOCKET_ERROR
+                    || ::listen(result.m_socket, SOMAXCONN) == SOCKET_ERROR))
+            {
+                result.close();
+            }
+            result.m_unixPath = result.isValid() ? address : string();
+        }
+
+        return result;
+    }
+
+    // Connects to a socket listening on the specified address. Returns an invalid socket if the
+    // connection could not be made, e.g. if nothing is listening on the address.
+    static Socket connect(const string& address)
+    {
+        Socket result;
+        if (!startup())
+        {
+            return result;
+        }
+
+        string host, port;
+        if (splitTCPAddress(address, host, port))
+        {
+            addrinfo hints = {};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* pInfo = nullptr;
+            if (::getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints,
+                &pInfo) != 0)
+            {
+                return result;
+            }
+            for (addrinfo* pEntry = pInfo; pEntry && !result.isValid(); pEntry = pEntry->ai_next)
+            {
+                result.m_socket =
+                    ::socket(pEntry->ai_family, pEntry->ai_socktype, pEntry->ai_protocol);
+                if (result.m_socket != INVALID_SOCKET && ::connect(result.m_socket,
+                    pEntry->ai_addr, static_cast<int>(pEntry->ai_addrlen)) == SOCKET_ERROR)
+                {
+                    result.close();
+                }
+            }
+            ::freeaddrinfo(pInfo);
+
+            // Send small messages right away, rather than waiting to combine them.
+            int noDelay = 1;
+            if (result.isValid())
+            {
+                ::setsockopt(result.m_socket, IPPROTO_TCP, TCP_NODELAY,
+                    reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+            }
+        }
+        else
+        {
+            sockaddr_un unixAddress = {};
+            if (!getUnixAddress(address, unixAddress))
+            {
+                return result;
+            }
+            result.m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (result.m_socket != INVALID_SOCKET
+                && ::connect(result.m_socket, reinterpret_cast<const sockaddr*>(&unixAddress),
+                    sizeof(unixAddress)) == SOCKET_ERROR)
+            {
+                result.close();
+            }
+        }
+
+        return result;
+    }
+
+    // Returns whether the socket is open, i.e. listening or connected.
+    bool isValid() const { return m_socket != INVALID_SOCKET; }
+
+    // Accepts a connection on a listening socket, waiting for at most the specified time (or
+    // indefinitely with a negative time). Returns an invalid socket if no connection was accepted.
+    Socket accept(int timeoutMilliseconds = -1)
+    {
+        Socket result;
+        if (waitReadable(timeoutMilliseconds))
+        {
+            result.m_socket = ::accept(m_socket, nullptr, nullptr);
+        }
+
+        return result;
+    }
+
+    // Waits for at most the specified time (or indefinitely with a negative time) for data to be
+    // received, or a connection to be made on a listening socket. Returns whether there is data (or
+    // a connection) available; this is also true if the connection has been closed, so that a
+    // receive reports the end of the connection.
+    bool waitReadable(int timeoutMilliseconds)
+    {
+        if (m_bufferStart < m_buffer.size())
+        {
+            return true;
+        }
+
+        fd_set sockets;
+        FD_ZERO(&sockets);
+        FD_SET(m_socket, &sockets);
+        timeval timeout = { timeoutMilliseconds / 1000, (timeoutMilliseconds % 1000) * 1000 };
+        return ::select(static_cast<int>(m_socket + 1), &sockets, nullptr, nullptr,
+            timeoutMilliseconds < 0 ? nullptr : &timeout) > 0;
+    }
+
+    // Sets a time limit for receiving data, starting now, or removes the limit with a negative
+    // time. A receive that is still waiting for data when the time is up fails as if the
+    // connection was closed, and timedOut() then returns true.
+    //
+    // NOTE: The limit covers all receives until it is set again, e.g. a whole message rather than
+    // each part of it, so a peer that sends a little data at a time can't hold up the receiver.
+    void setReceiveTimeout(int timeoutMilliseconds)
+    {
+        m_hasDeadline = timeoutMilliseconds >= 0;
+        m_deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+        m_timedOut = false;
+    }
+
+    // Returns whether a receive failed because the time limit was reached; see
+    // setReceiveTimeout().
+    bool timedOut() const { return m_timedOut; }
+
+    // Sends all of the specified data. Returns whether the data was sent, i.e. the connection is
+    // still open.
+    bool sendAll(const void* pData, size_t size)
+    {
+        const char* pBytes = static_cast<const char*>(pData);
+        while (size > 0)
+        {
+            static const size_t MAX_SEND_SIZE = 1 << 20;
+            int sent = ::send(m_socket, pBytes, static_cast<int>(std::min(size, MAX_SEND_SIZE)), 0);
+            if (sent <= 0)
+            {
+                return false;
+            }
+            pBytes += sent;
+            size -= sent;
+        }
+
+        return true;
+    }
+
+    // Sends a string, e.g. a line of text including its newline character.
+    bool sendText(const string& text) { return sendAll(text.data(), text.size()); }
+
+    // Receives exactly the specified number of bytes, waiting until they arrive. Returns whether
+    // the data was received, i.e. the connection was not closed first.
+    bool receiveAll(void* pData, size_t size)
+    {
+        char* pBytes = static_cast<char*>(pData);
+        while (size > 0)
+        {
+            if (m_bufferStart == m_buffer.size() && !fillBuffer())
+            {
+                return false;
+            }
+            const size_t count = std::min(size, m_buffer.size() - m_bufferStart);
+            ::memcpy(pBytes, m_buffer.data() + m_bufferStart, count);
+            m_bufferStart += count;
+            pBytes += count;
+            size -= count;
+        }
+
+        return true;
+    }
+
+    // Receives a line of text, without the newline character (and any carriage return before it).
+    // The last line may end with the end of the connection instead of a newline. Returns whether
+    // a line was received, i.e. the connection was not closed first and the line was not longer
+    // than the specified maximum size.
+    bool receiveLine(string& line, size_t maxSize = 1 << 16)
+    {
+        line.clear();
+        while (true)
+        {
+            const char* pStart = m_buffer.data() + m_bufferStart;
+            const char* pEnd = m_buffer.data() + m_buffer.size();
+            const char* pNewline = static_cast<const char*>(::memchr(pStart, '\n', pEnd - pStart));
+            line.append(pStart, pNewline ? pNewline : pEnd);
+            m_bufferStart = pNewline ? pNewline + 1 - m_buffer.data() : m_buffer.size();
+            if (pNewline || line.size() > maxSize || !fillBuffer())
+            {
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.pop_back();
+                }
+                return (pNewline || !line.empty()) && line.size() <= maxSize;
+            }
+        }
+    }
+
+    // Shuts down the connection and closes the socket. This is done automatically on destruction.
+    void close()
+    {
+        if (m_socket != INVALID_SOCKET)
+        {
+            ::closesocket(m_socket);
+            m_socket = INVALID_SOCKET;
+        }
+        if (!m_unixPath.empty())
+        {
+            std::remove(m_unixPath.c_str());
+            m_unixPath.clear();
+        }
+    }
+
+private:
+    SOCKET m_socket = INVALID_SOCKET;
+    string m_unixPath;
+    vector<char> m_buffer;
+    size_t m_bufferStart = 0;
+    bool m_hasDeadline = false;
+    std::chrono::steady_clock::time_point m_deadline;
+    bool m_timedOut = false;
+
+    // Copying is not supported, since the socket is owned by the object.
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    // Initializes Winsock for the process, once. Returns whether it was initialized successfully.
+    static bool startup()
+    {
+        static const bool STARTED = []()
+        {
+            WSADATA wsaData = {};
+            return ::WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+        }();
+
+        return STARTED;
+    }
+
+    // Splits an address into a host and a port if it is a TCP address, i.e. it ends with a colon
+    // and a port number and is not a file path. Returns whether it is a TCP address.
+    static bool splitTCPAddress(const string& address, string& host, string& port)
+    {
+        const size_t colon = address.rfind(':');
+        if (colon == string::npos || colon + 1 == address.size()
+            || address.find_first_of("/\\") != string::npos
+            || address.find_first_not_of("0123456789", colon + 1) != string::npos)
+        {
+            return false;
+        }
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+
+        return true;
+    }
+
+    // Gets the Unix domain socket address for a file path. Returns whether the path is valid,
+    // i.e. not too long.
+    static bool getUnixAddress(const string& path, sockaddr_un& address)
+    {
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        ::memcpy(address.sun_path, path.c_str(), path.size());
+
+        return true;
+    }
+
+    // Receives more data into the buffer, replacing the data that has been used, and waiting until
+    // some data arrives or the time limit is reached. Returns whether data was received, i.e. the
+    // connection was not closed and the time limit was not reached.
+    bool fillBuffer()
+    {
+        static const size_t BUFFER_SIZE = 1 << 16;
+        if (m_hasDeadline)
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                m_deadline - std::chrono::steady_clock::now()).count();
+            if (!waitReadable(static_cast<int>(std::max<int64_t>(remaining, 0))))
+            {
+                m_buffer.clear();
+                m_bufferStart = 0;
+                m_timedOut = true;
+                return false;
+            }
+        }
+        m_buffer.resize(BUFFER_SIZE);
+        m_bufferStart = 0;
+        int received = ::recv(m_socket, m_buffer.data(), static_cast<int>(BUFFER_SIZE), 0);
+        m_buffer.resize(std::max(received, 0));
+
+        return received > 0;
+    }
+};
+
+} // namespace Luma
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <fstream>
+
+namespace Luma {
+
+// Records spans of time on each thread (e.g. rendering a tile, or writing an image), and saves
+// them in the Chrome trace event format, which can be viewed with Perfetto (ui.perfetto.dev) or
+// chrome://tracing as a timeline with a row for each thread. This shows where the time goes in a
+// render, e.g. gaps where threads are waiting, or threads that finish early (load imbalance).
+//
+// Tracing is disabled unless enable() is called, and then spans are recorded with TraceScope. Each
+// thread records its spans in a separate buffer, so recording does not use any locks or atomic
+// operations (other than checking whether tracing is enabled), and does not affect the timing of
+// other threads. The buffers are saved with save(), once the traced work is done.
+//
+// NOTE: Span names are not copied, so they must be string literals (or otherwise outlive the
+// tracer). A span can have one integer argument, e.g. the index of a tile.
+class Tracer
+{
+public:
+    // Enables recording spans, from now on. Times are recorded relative to this time.
+    static void enable()
+    {
+        State& state = getState();
+        state.startTime = std::chrono::steady_clock::now();
+        state.enabled = true;
+    }
+
+    // Returns whether spans are being recorded.
+    static bool isEnabled() { return getState().enabled.load(std::memory_order_relaxed); }
+
+    // Returns the current time for a span, in nanoseconds since tracing was enabled.
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - getState().startTime).count();
+    }
+
+    // Records a span on the current thread with the specified name, start and end times (from
+    // now()), and optional integer argument.
+    static void record(const char* name, int64_t startTime, int64_t endTime,
+        const char* argName = nullptr, int64_t arg = 0)
+    {
+        getThreadBuffer().events.push_back({ name, argName, startTime, endTime, arg });
+    }
+
+    // Sets the name of the current thread, as shown in the trace, e.g. "Render" or "Output", unless
+    // it has already been named. The first name is kept, e.g. for the main thread, which also
+    // renders tiles in parallel loops.
+    static void setThreadName(const char* name)
+    {
+        if (isEnabled() && !getThreadBuffer().name)
+        {
+            getThreadBuffer().name = name;
+        }
+    }
+
+    // Saves the recorded spans to a Chrome trace (JSON) file at the specified path. This must only
+    // be called when no spans are being recorded, e.g. after rendering. Returns whether the file
+    // was saved successfully.
+    static bool save(const string& filePath)
+    {
+        State& state = getState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        std::ofstream file(filePath);
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+
+        // Write the thread names as metadata events, followed by the spans as complete ("X")
+        // events, with times in microseconds.
+        const char* pSeparator = "";
+        file << std::fixed << std::setprecision(3);
+        for (size_t index = 0; index < state.buffers.size(); index++)
+        {
+            const ThreadBuffer& buffer = *state.buffers[index];
+            const size_t threadID = index + 1;
+            const char* pThreadName = buffer.name ? buffer.name : "Thread";
+            file
+                << pSeparator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                << threadID << ",\"args\":{\"name\":\"" << pThreadName << " " << threadID
+                << "\"}}";
+            pSeparator = ",\n";
+            for (const Event& event : buffer.events)
+            {
+                file
+                    << pSeparator << "{\"name\":\"" << event.name
+                    << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadID
+                    << ",\"ts\":" << event.startTime * 0.001
+                    << ",\"dur\":" << (event.endTime - event.startTime) * 0.001;
+                if (event.argName)
+                {
+                    file << ",\"args\":{\"" << event.argName << "\":" << event.arg << "}";
+                }
+                file << "}";
+            }
+        }
+        file << std::endl << "]}" << std::endl;
+
+        return !file.fail();
+    }
+
+private:
+    // A recorded span.
+    struct Event
+    {
+        const char* name;
+        const char* argName;
+        int64_t startTime;
+        int64_t endTime;
+        int64_t arg;
+    };
+
+    // The spans recorded by a thread, and the name of the thread.
+    struct ThreadBuffer
+    {
+        const char* name = nullptr;
+        vector<Event> events;
+    };
+
+    // The state of the tracer, shared by all threads. The buffers are only accessed with the mutex
+    // when a thread starts recording and when saving.
+    struct State
+    {
+        std::atomic<bool> enabled{ false };
+        std::chrono::steady_clock::time_point startTime;
+        std::mutex mutex;
+        vector<std::unique_ptr<ThreadBuffer>> buffers;
+    };
+
+    // Returns the state of the tracer.
+    static State& getState()
+    {
+        static State state;
+
+        return state;
+    }
+
+    // Returns the buffer for the current thread, creating it when the thread first records a span.
+    //
+    // NOTE: The buffers are owned by the tracer rather than the threads, so that they are kept
+    // when a thread exits, e.g. a thread saving an image.
+    static ThreadBuffer& getThreadBuffer()
+    {
+        static thread_local ThreadBuffer* pBuffer = nullptr;
+        if (!pBuffer)
+        {
+            State& state = getState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.buffers.emplace_back(new ThreadBuffer());
+            pBuffer = state.buffers.back().get();
+        }
+
+        return *pBuffer;
+    }
+};
+
+// Records a span on the current thread for the lifetime of the object, if tracing is enabled.
+// For example:
+//
+//   {
+//       TraceScope scope("Tile", "index", tileIndex);
+//       ...
+//   }
+class TraceScope
+{
+public:
+    // Constructor, which starts a span with the specified name and optional integer argument.
+    TraceScope(const char* name, const char* argName = nullptr, int64_t arg = 0)
+    {
+        if (Tracer::isEnabled())
+        {
+            m_name = name;
+            m_argName = argName;
+            m_arg = arg;
+            m_startTime = Tracer::now();
+        }
+    }
+
+    // Destructor, which ends the span.
+    ~TraceScope()
+    {
+        if (m_name)
+        {
+            Tracer::record(m_name, m_startTime, Tracer::now(), m_argName, m_arg);
+        }
+    }
+
+private:
+    const char* m_name = nullptr;
+    const char* m_argName = nullptr;
+    int64_t m_arg = 0;
+    int64_t m_startTime = 0;
+
+    // Copying is not supported, since the span is recorded once.
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+// Enables tracing for the lifetime of the object, and then saves the trace to a file, e.g. to trace
+// all of main() including every return path. Nothing is done for an empty path.
+class TraceSession
+{
+public:
+    // Constructor, which enables tracing if the specified path is not empty.
+    TraceSession(const string& filePath) : m_filePath(filePath)
+    {
+        if (!m_filePath.empty())
+        {
+            Tracer::enable();
+            Tracer::setThreadName("Main");
+        }
+    }
+
+    // Destructor, which saves the trace. This must be destroyed after any threads recording spans
+    // have finished.
+    ~TraceSession()
+    {
+        if (m_filePath.empty())
+        {
+            return;
+        }
+        if (Tracer::save(m_filePath))
+        {
+            std::cout << "Saved trace to \"" << m_filePath << "\"." << std::endl;
+        }
+        else
+        {
+            std::cerr << "Unable to save \"" << m_filePath << "\"." << std::endl;
+        }
+    }
+
+private:
+    string m_filePath;
+
+    // Copying is not supported, since the trace is saved once.
+    TraceSession(const TraceSession&) = delete;
+    TraceSession& operator=(const TraceSession&) = delete;
+};
+
+} // namespace Luma
@@ -38,6 +38,18 @@ uint32_t randomXORShift(uint32_t x)
     return x;
 }
 
+// Generates a uniformly distributed pseudorandom number in the range [0.0, 1.0) by advancing the
+// specified state with XOR shifts. The state must be nonzero, e.g. from hashing a seed.
+//
+// NOTE: Unlike randomMT(), the sequence is fully determined by the initial state, on any platform
+// and standard library, which makes it suitable for reproducible content such as generated scenes.
+inline float randomFloat(uint32_t& state)
+{
+    state = randomXORShift(state);
+
+    return (state >> 8) * (1.0f / (1u << 24));
+}
+
 // Hashes a 32-bit integer, which can be used to randomize a seed for an RNG, or directly as an RNG.
 //
 // NOTE: Based on http://www.reedbeta.com/blog/quick-and-easy-gpu-random-numbers-in-d3d11.
@@ -95,6 +107,23 @@ inline float halton3(uint32_t index)
     return result;
 }
 
+// Computes the entry in the Halton sequence with the specified base, which should be a prime number
+// other than 2 or 3 (see halton2() and halton3()), at the specified index. Sequences with different
+// bases are uncorrelated, so they provide more dimensions for the same index.
+inline float halton(uint32_t index, uint32_t base)
+{
+    float result = 0.0f;
+    float scale = 1.0f;
+    while (index != 0)
+    {
+        scale /= base;
+        result += (index % base) * scale;
+        index /= base;
+    }
+
+    return result;
+}
+
 // Generates a uniformly distributed pseudorandom random number in the range [0.0, 1.0) using the
 // Mersenne Twister. This gives very high quality numbers.
 float randomMT()
@@ -153,6 +182,39 @@ Vec3 randomDirection(float u1, float u2, const Vec3& normal, float& pdf)
     return direction;
 }
 
+// Maps a position in the unit square to a point in the unit disk, with the "concentric" mapping,
+// which maps concentric squares to concentric circles. This keeps the distribution of stratified
+// or low discrepancy positions in the disk, unlike a polar mapping, which distorts it near the
+// center. See PBRT 13.6.2 for details.
+inline void sampleDisk(float u1, float u2, float& x, float& y)
+{
+    // Map the position to [-1.0, 1.0], and map the origin (a degenerate case) to itself.
+    const float a = 2.0f * u1 - 1.0f;
+    const float b = 2.0f * u2 - 1.0f;
+    if (a == 0.0f && b == 0.0f)
+    {
+        x = 0.0f;
+        y = 0.0f;
+        return;
+    }
+
+    // Map each square to a circle with the same radius, using the larger coordinate as the radius.
+    float radius = 0.0f;
+    float theta = 0.0f;
+    if (std::abs(a) > std::abs(b))
+    {
+        radius = a;
+        theta = (PI / 4.0f) * (b / a);
+    }
+    else
+    {
+        radius = b;
+        theta = (PI / 2.0f) - (PI / 4.0f) * (a / b);
+    }
+    x = radius * std::cos(theta);
+    y = radius * std::sin(theta);
+}
+
 // Reports the specified progress on the console, as a progress bar.
 void updateProgress(float progress)
 {
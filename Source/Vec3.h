@@ -69,6 +69,15 @@ inline float dot(const Vec3& a, const Vec3& b)
     return a.x() * b.x() + a.y() * b.y() + a.z() * b.z();
 }
 
+// Computes the cross product of two vectors.
+inline Vec3 cross(const Vec3& a, const Vec3& b)
+{
+    return Vec3(
+        a.y() * b.z() - a.z() * b.y(),
+        a.z() * b.x() - a.x() * b.z(),
+        a.x() * b.y() - a.y() * b.x());
+}
+
 // Overloads the + operator for two vectors.
 inline Vec3 operator+(const Vec3& a, const Vec3& b)
 {
@@ -1,250 +1,589 @@
 ﻿#include "pch.h"
 
+#include "Benchmark.h"
+#include "BinaryScene.h"
 #include "Camera.h"
+#include "Checkpoint.h"
+#include "Cost.h"
+#include "Denoiser.h"
+#include "Distributed.h"
+#include "EXRWriter.h"
+#include "Framebuffer.h"
 #include "Image.h"
+#include "ImageCompare.h"
+#include "ImageTest.h"
+#include "MappedFile.h"
+#include "Output.h"
 #include "Ray.h"
+#include "Renderer.h"
+#include "RenderServer.h"
 #include "Scene.h"
+#include "SceneGenerator.h"
+#include "SceneParser.h"
 #include "Sphere.h"
+#include "Trace.h"
 #include "Vec3.h"
 #include "Utils.h"
-using namespace Luma;
 
-#include <ppl.h>
+#include <charconv>
+#include <filesystem>
+
+using namespace Luma;
 
-// Computes the radiance incident along the specified ray, for the specified element.
-Vec3 radiance(const Ray& ray, const Element& element, int depth, uint32_t& index)
+// Reports the command line usage on the console.
+void printUsage()
 {
-    // If the trace depth has been exhausted, simply return black.
-    if (depth == 0)
-    {
-        return Vec3();
-    }
-
-    // Intersect the sphere with the ray, and shade with the hit record if there was an
-    // intersection. Otherwise shade with a (vertical) background gradient.
-    Vec3 radiance;
-    Hit hit;
-    if (element.intersect(ray, hit))
-    {
-        // Generate a random direction in the hemisphere above the normal.
-        float u1 = 0.0f, u2 = 0.0f;
-        float pdf = 1.0f;
-        getRandom2D(u1, u2, index);
-        Vec3 direction = randomDirection(u1, u2, hit.normal, pdf);
-        float cosTheta = dot(hit.normal, direction);
-        assert(cosTheta > 0.0f);
-
-        // Compute the Lambertian BRDF, i.e. the amount of light reflected by the material.
-        static const Vec3 materialColor(Vec3(0.75f, 0.75f, 0.75f).sRGBToLinear());
-        Vec3 brdf = materialColor / PI;
-
-        // Compute the radiance incident from the direction, i.e. the incident light.
-        //
-        // NOTE: As this is recursive, this renders global illumination (indirect light) which is
-        // very difficult to achieve with rasterization on GPUs.
-        //
-        // NOTE: A small ray offset is used to avoid self-intersection.
-        static const float RAY_OFFSET = 1e-4f;
-        Ray ray(hit.position, direction, RAY_OFFSET);
-        Vec3 light = ::radiance(ray, element, depth - 1, index);
-
-        // Compute the outgoing radiance, as defined by the rendering equation.
-        radiance = brdf * light * cosTheta / pdf;
-
-        // DIRECT LIGHTING: Uncomment this to perform simple direct shading and shadowing with a
-        // directional light. As there is no random sampling, this will have no noise.
-        //
-        // Hit shadowHit;
-        // static const Vec3 lightDirection(Vec3(1.0f, 1.0f, 1.0f).normalize());
-        // Ray shadowRay(hit.position, lightDirection, RAY_OFFSET);
-        // float visibility = element.intersect(shadowRay, shadowHit) ? 0.1f : 1.0f;
-        // radiance = brdf * visibility * std::max(dot(hit.normal, lightDirection), 0.0f);
-
-        // AMBIENT OCCLUSION: Uncomment this to render ambient occlusion, i.e. the amount by which a
-        // point can see the environment.
-        //
-        // Vec3 visibility = element.intersect(ray, hit) ? Vec3() : Vec3(1.0f, 1.0f, 1.0f);
-        // radiance = visibility * cosTheta / PI / pdf;
-
-        // NORMALS: Uncomment this to render the surface normals as colors.
-        //
-        // radiance = (0.5f * (hit.normal + Vec3(1.0f, 1.0f, 1.0f))).Linearize();
-    }
-    else
-    {
-        static const Vec3 topColor(Vec3(0.5f, 0.7f, 1.0f).sRGBToLinear());
-        static const Vec3 bottomColor(Vec3(1.0f, 1.0f, 1.0f).sRGBToLinear());
-
-        float gradientFactor = (ray.direction().y() + 1.0f) * 0.5f;
-        radiance = lerp(bottomColor, topColor, gradientFactor);
-    }
-
-    return radiance;
+    std::cout
+        << "Usage: Luma [scene file] [options]" << std::endl
+        << "Renders the scene file (text or binary), or the default scene if none is specified."
+        << std::endl
+        << "Options:" << std::endl
+        << "  --generate <type> <count> [seed]      Render a generated scene." << std::endl
+        << "  --benchmark <type> [maxCount] [seed]  Benchmark generated scenes." << std::endl
+        << "  --benchmark-resample                  Benchmark image resampling." << std::endl
+        << "  --benchmark-png                       Benchmark PNG writing." << std::endl
+        << "  --convert <binary file>               Save the scene as a binary scene file." << std::endl
+        << "  --resume                              Continue the render from its checkpoint." << std::endl
+        << "  --crop <x> <y> <width> <height>       Render and save only a region of the image."
+        << std::endl
+        << "  --server <address>                    Run a render server; see RenderServer.h."
+        << std::endl
+        << "  --distribute <address>                Render with workers; see Distributed.h."
+        << std::endl
+        << "  --worker <address>                    Render tiles for a --distribute process."
+        << std::endl
+        << "  --trace <trace file>                  Save a Chrome trace (JSON) of the activity."
+        << std::endl
+        << "  --path-stats                          Report path length and termination statistics."
+        << std::endl
+        << "  --compare <reference PFM file>        Report the error compared with a reference."
+        << std::endl
+        << "  --test [manifest]                     Run image regression tests; see ImageTest.h."
+        << std::endl
+        << "Addresses are Unix domain socket paths, or \"host:port\" for TCP." << std::endl
+        << "Scene types: random, grid, clusters." << std::endl;
 }
 
-// Computes the radiance for all the pixels in the image buffer with the specified properties, using
-// the specified element (scene) and camera.
-void render(
-    const Element& element, const Camera& camera, uint8_t* pImageData,
-    uint16_t width, uint16_t height, uint16_t samples)
+// Gets the command line argument after the specified index, if there is one and it is not an
+// option, advancing the index. Returns whether there was such an argument.
+bool getNextArg(const vector<string>& args, size_t& index, string& value)
 {
-    // Report the rendering parameters.
-    unsigned int threadCount = std::thread::hardware_concurrency();
-    std::cout
-        << "Rendering " << width << "x" << height
-        << " at " << samples << " samples per pixel on "
-        << threadCount << " threads..." << std::endl;
-
-    // Record the start time.
-    auto startTime = std::chrono::high_resolution_clock::now();
-    auto prevTime = startTime;
-
-    // Iterate the image pixels, starting from the top left (U = 0.0, Y = 1.0) corner, and computing
-    // the incident radiance for each one. A parallel for loop is used here to support thread
-    // concurrency.
-    //
-    // NOTE: Ray tracing is a naturally parallel algorithm: there is no read / write contention for
-    // memory, with the exception of progress reporting.
-    static const uint8_t NUM_COMPONENTS = 3;
-    const size_t stride = width * NUM_COMPONENTS;
-    std::mutex progressMutex;
-    std::atomic<uint16_t> completedLines(0);
-    Concurrency::parallel_for(uint16_t(0), height, [&](uint16_t line)
-    {
-        // Get a pointer to the start of the current line.
-        uint16_t y = height - line - 1;
-        uint8_t* pPixel = pImageData + stride * line;
-
-        // Iterate the pixels of line, computing radiance for each one.
-        for (uint16_t x = 0; x < width; x++)
-        {
-            // Create an index for a sequence of *quasirandom* numbers. Such numbers are used for
-            // "random" sampling while path tracing, e.g. selecting a random direction in a
-            // hemisphere. The sequence index starts with a unique value for each pixel in the image
-            // which is then randomized with a hash.
-            //
-            // NOTE: Using a constant sequence index leads to total aliasing, but will still
-            // converge to the correct result with enough samples. Using only the unique per-pixel
-            // starting index will reduce aliasing, but still yields substantial correlation
-            // artifacts. Finally, hashing that index yields less objectionable noise, but still
-            // with better convergence than using *pseudorandom* numbers.
-            // 
-            // IMPORTANT: For now the same index is used for all random numbers in this pixel
-            // sample. This strangely works quite well, but will likely need to be revisited. The
-            // index is only incremented once, when the sample is complete.
-            uint32_t sequenceIndex = 0;
-            sequenceIndex = samples * (line * height + x);
-            sequenceIndex = lowBias32Hash(sequenceIndex);
-
-            // Accumulate radiance samples for each pixel.
-            Vec3 radiance;
-            for (uint16_t sample = 0; sample < samples; sample++)
-            {
-                // Compute the sample position, using a random offset for each sample. If only one
-                // sample is being taken, use the pixel center.
-                //
-                // NOTE: This uses pseudorandom (MT) numbers because using the quasirandom sequence
-                // with the same index as the radiance sampling yields minor edge artifacts.
-                float rand_x = samples == 1 ? 0.5f : randomMT();
-                float rand_y = samples == 1 ? 0.5f : randomMT();
-                float u = (x + rand_x) / width;
-                float v = (y - rand_y) / height;
-
-                // Compute a camera ray direction based on the current pixel's UV coordinates.
-                Ray ray = camera.getRay(u, v);
-
-                // Compute a color for the ray, i.e. the scene radiance from that direction and add
-                // it to the accumulated radiance.
-                static const int MAX_DEPTH = 10;
-                radiance += ::radiance(ray, element, MAX_DEPTH, sequenceIndex);
-
-                // Increment the sequence index, for the next sample.
-                //
-                // NOTE: See the "IMPORTANT" note above.
-                sequenceIndex++;
-            }
+    if (index + 1 >= args.size() || args[index + 1].compare(0, 2, "--") == 0)
+    {
+        return false;
+    }
+    value = args[++index];
 
-            // Compute the average of the radiance samples to yield the pixel radiance.
-            radiance /= samples;
+    return true;
+}
 
-            // Gamma correct the radiance and store it in the image buffer.
-            radiance.linearTosRGB();
-            const float COMPONENT_SCALE = 255.99f;
-            uint8_t color[] =
-            {
-                static_cast<uint8_t>(clamp(radiance.r(), 0.0f, 1.0f) * COMPONENT_SCALE),
-                static_cast<uint8_t>(clamp(radiance.g(), 0.0f, 1.0f) * COMPONENT_SCALE),
-                static_cast<uint8_t>(clamp(radiance.b(), 0.0f, 1.0f) * COMPONENT_SCALE),
-            };
-            ::memcpy(pPixel, color, 3);
-            pPixel += 3;
-        }
-
-        // Increment the (atomic) number of completed lines.
-        completedLines++;
-
-        // Update the progress if more than one second has elapsed since the last update.
-        //
-        // NOTE: A mutex is used to avoid a race condition with multiple threads.
-        auto nextTime = std::chrono::high_resolution_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(nextTime - prevTime).count();
-        if (elapsed >= 1)
-        {
-            progressMutex.lock();
-            float progress = static_cast<float>(completedLines) / height;
-            updateProgress(progress);
-            prevTime = nextTime;
-            progressMutex.unlock();
-        }
-    });
-
-    // Finish progress updates.
-    ::updateProgress(1.0f);
-    std::cout << std::endl;
-
-    // Report the image dimensions and time spent rendering.
-    auto endTime = std::chrono::high_resolution_clock::now();
-    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
-    std::cout
-        << std::setprecision(3)
-        << "Completed in " << elapsedTime / 1000.0f << " seconds." << std::endl;
+// Parses the specified command line argument as a number, returning whether the whole argument is
+// a valid number in the range of the type, e.g. not negative for an unsigned type.
+template <typename T>
+bool parseNumber(const string& text, T& value)
+{
+    const char* pEnd = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), pEnd, value);
+
+    return !text.empty() && result.ec == std::errc() && result.ptr == pEnd;
 }
 
 // Main entry point.
-int main()
+int main(int argc, char* argv[])
 {
     // Enable memory leak detection. This will output a memory leak report when the process exits,
     // if there are any detected memory leaks. The report starts with "Detected memory leaks!"
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 
-    // Create scene geometry.
-    auto pCenter = make_shared<Sphere>(Vec3(0.0f, 0.0f, -1.0f), 0.5f);
-    auto pGround = make_shared<Sphere>(Vec3(0.0f, -100.5f, -1.0f), 100.0f);
+    // Parse the command line. Without any arguments, the default scene is rendered.
+    vector<string> args(argv + 1, argv + argc);
+    bool benchmark = false;
+    bool benchmarkResample = false;
+    bool benchmarkPNGWriting = false;
+    bool generate = false;
+    bool resume = false;
+    bool reportPaths = false;
+    uint32_t crop[4] = {};
+    string sceneFilePath;
+    string convertFilePath;
+    string serverAddress;
+    string coordinatorAddress;
+    string workerAddress;
+    string tracePath;
+    string referencePath;
+    string testManifestPath;
+    SceneType sceneType = SceneType::RandomSpheres;
+    size_t sceneCount = 0;
+    uint32_t seed = 0;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        string value;
+        bool valid = true;
+        if (args[i] == "--generate" || args[i] == "--benchmark")
+        {
+            // Parse the scene type, and the count (required for a generated scene) and seed.
+            static const size_t DEFAULT_MAX_COUNT = 10000000;
+            benchmark = args[i] == "--benchmark";
+            generate = !benchmark;
+            valid = getNextArg(args, i, value) && parseSceneType(value, sceneType);
+            sceneCount = DEFAULT_MAX_COUNT;
+            if (getNextArg(args, i, value))
+            {
+                valid = valid && parseNumber(value, sceneCount);
+            }
+            else
+            {
+                valid = valid && benchmark;
+            }
+            if (getNextArg(args, i, value))
+            {
+                valid = valid && parseNumber(value, seed);
+            }
+        }
+        else if (args[i] == "--benchmark-resample")
+        {
+            benchmarkResample = true;
+        }
+        else if (args[i] == "--benchmark-png")
+        {
+            benchmarkPNGWriting = true;
+        }
+        else if (args[i] == "--convert")
+        {
+            valid = getNextArg(args, i, convertFilePath);
+        }
+        else if (args[i] == "--server")
+        {
+            valid = getNextArg(args, i, serverAddress);
+        }
+        else if (args[i] == "--distribute")
+        {
+            valid = getNextArg(args, i, coordinatorAddress);
+        }
+        else if (args[i] == "--worker")
+        {
+            valid = getNextArg(args, i, workerAddress);
+        }
+        else if (args[i] == "--trace")
+        {
+            valid = getNextArg(args, i, tracePath);
+        }
+        else if (args[i] == "--resume")
+        {
+            resume = true;
+        }
+        else if (args[i] == "--path-stats")
+        {
+            reportPaths = true;
+        }
+        else if (args[i] == "--compare")
+        {
+            valid = getNextArg(args, i, referencePath);
+        }
+        else if (args[i] == "--test")
+        {
+            testManifestPath = "Scenes/Tests/tests.txt";
+            getNextArg(args, i, testManifestPath);
+        }
+        else if (args[i] == "--crop")
+        {
+            // Parse the position and size of the crop window, which must not be empty.
+            for (uint32_t& cropValue : crop)
+            {
+                valid = valid && getNextArg(args, i, value);
+                valid = valid && parseNumber(value, cropValue);
+            }
+            valid = valid && crop[2] > 0 && crop[3] > 0;
+        }
+        else if (args[i].compare(0, 2, "--") != 0 && sceneFilePath.empty())
+        {
+            sceneFilePath = args[i];
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    // Trace the activity of the threads if requested, saving the trace when this function returns.
+    TraceSession traceSession(tracePath);
+
+    // Run a benchmark if requested, instead of rendering an image.
+    if (benchmark)
+    {
+        benchmarkScenes(sceneType, sceneCount, seed);
+
+        return 0;
+    }
+    if (benchmarkResample)
+    {
+        benchmarkResampling();
+
+        return 0;
+    }
+    if (benchmarkPNGWriting)
+    {
+        benchmarkPNG();
+
+        return 0;
+    }
+
+    // Run the image regression tests if requested, instead of rendering an image.
+    if (!testManifestPath.empty())
+    {
+        return runImageTests(testManifestPath) ? 0 : 1;
+    }
+
+    // Run a render server if requested, which renders scenes for clients until it is shut down.
+    if (!serverAddress.empty())
+    {
+        RenderServer server;
+        if (!server.run(serverAddress))
+        {
+            std::cerr << server.error() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Create scene geometry and render settings, from a scene file (binary or text), a generated
+    // scene, or the default scene.
     Scene scene;
-    scene.add(pCenter);
-    scene.add(pGround);
-
-    // Create the output image.
-    //
-    // NOTE: The image can be rendered at a lower resolution and scaled up to the desired image
-    // size to make it easier to see the individual pixels and for faster rendering. The settings
-    // here take about 2.1 seconds to render with a Debug build, but only about 300 ms with a
-    // Release build on a Core i7-8700 CPU with 12 threads.
-    static const uint8_t SCALE = 8;
-    static const uint16_t OUTPUT_WIDTH = 3840;
-    static const uint16_t OUTPUT_HEIGHT = 2160;
-    static const uint16_t WIDTH = OUTPUT_WIDTH / SCALE;
-    static const uint16_t HEIGHT = OUTPUT_HEIGHT / SCALE;
-    static const uint16_t SPP = 16;
-    Image image(WIDTH, HEIGHT);
-
-    // Create a camera.
-    // TODO: This will eventually accept typical camera properties: position, direction, FOV, etc.
-    Camera camera(static_cast<float>(WIDTH) / HEIGHT);
-
-    // Render the scene with the camera, to the image buffer with the specified properties.
-    ::render(scene, camera, image.getImageData(), WIDTH, HEIGHT, SPP);
-
-    // Save the image.
-    image.savePNG("output.png", SCALE);
+    RenderSettings settings;
+    if (!sceneFilePath.empty())
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        string error;
+        if (!loadSceneFile(sceneFilePath, scene, settings, error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+        std::cout
+            << "Loaded " << scene.size() << " elements from \"" << sceneFilePath << "\" in "
+            << std::chrono::duration<double>(endTime - startTime).count() << " seconds." << std::endl;
+    }
+    if (generate)
+    {
+        generateScene(scene, sceneType, sceneCount, seed);
+    }
+    if (sceneFilePath.empty() && !generate)
+    {
+        scene.addSphere(Vec3(0.0f, 0.0f, -1.0f), 0.5f);
+        scene.addSphere(Vec3(0.0f, -100.5f, -1.0f), 100.0f);
+    }
+
+    // Save the scene as a binary scene file if requested, instead of rendering an image.
+    if (!convertFilePath.empty())
+    {
+        BinaryScene binaryScene;
+        if (!binaryScene.save(convertFilePath, scene))
+        {
+            std::cerr << binaryScene.error() << std::endl;
+            return 1;
+        }
+        std::cout
+            << "Saved " << scene.sphereCount() << " spheres to \"" << convertFilePath << "\"."
+            << std::endl;
+
+        return 0;
+    }
+
+    // Render tiles for a coordinator if requested, which provides the other render settings.
+    if (!workerAddress.empty())
+    {
+        RenderWorker worker;
+        const uint64_t sceneHash = computeSceneHash(scene, settings.camera);
+        if (!worker.run(workerAddress, scene, settings, sceneHash))
+        {
+            std::cerr << worker.error() << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Apply the crop window from the command line, if any, and make sure the crop window is within
+    // the image.
+    if (crop[2] > 0)
+    {
+        settings.cropX = crop[0];
+        settings.cropY = crop[1];
+        settings.cropWidth = crop[2];
+        settings.cropHeight = crop[3];
+    }
+    if (!settings.isCropValid())
+    {
+        std::cerr << "The crop window is outside the image." << std::endl;
+        return 1;
+    }
+
+    // Create the camera.
+    Camera camera(settings.camera, settings.aspect());
+
+    // Render each frame of an animation, or a single image (frame zero). The scene is loaded once
+    // and used for every frame. Each frame is saved on a background thread while the next frame
+    // is rendered, alternating between two framebuffers, so saving does not delay rendering.
+    const uint32_t firstFrame = settings.animated ? settings.firstFrame : 0;
+    const uint32_t lastFrame = settings.animated ? settings.lastFrame : 0;
+    const bool useCheckpoints = resume || settings.checkpointInterval > 0.0;
+    const uint64_t sceneHash = useCheckpoints || !coordinatorAddress.empty()
+        ? computeSceneHash(scene, settings.camera) : 0;
+    std::unique_ptr<Framebuffer> pFramebuffers[2];
+    OutputWriter outputWriter;
+    RenderCoordinator coordinator;
+
+    // Create a map of the cost of rendering each pixel for a heatmap, if requested. The cost is
+    // only counted in builds with LUMA_COST_HEATMAP (see Cost.h), and only for local rendering.
+    std::unique_ptr<CostMap> pCostMap;
+    if (settings.heatmap && !COST_COUNTING)
+    {
+        std::cerr
+            << "The heatmap is not available: build with LUMA_COST_HEATMAP defined as 1."
+            << std::endl;
+    }
+    else if (settings.heatmap && !coordinatorAddress.empty())
+    {
+        std::cerr << "The heatmap is not available for distributed rendering." << std::endl;
+    }
+    else if (settings.heatmap)
+    {
+        pCostMap.reset(new CostMap(settings.renderWidth(), settings.renderHeight()));
+    }
+
+    // Create a buffer for the AOVs of each pixel if they are saved or used for denoising. These
+    // are only recorded for local rendering. Checkpoints don't store the AOVs, so pixels restored
+    // from a checkpoint would have no AOVs, and the denoiser would have nothing to guide it there:
+    // resuming with AOVs is an error rather than a silently worse image.
+    std::unique_ptr<AOVBuffer> pAOVBuffer;
+    const bool useAOVs = settings.denoise || !settings.aovs.empty();
+    if (useAOVs && resume)
+    {
+        std::cerr
+            << "AOVs and denoising are not available when resuming a render from a checkpoint."
+            << std::endl;
+        return 1;
+    }
+    else if (useAOVs && !coordinatorAddress.empty())
+    {
+        std::cerr << "AOVs and denoising are not available for distributed rendering." << std::endl;
+    }
+    else if (useAOVs)
+    {
+        pAOVBuffer.reset(new AOVBuffer(settings.renderWidth(), settings.renderHeight()));
+    }
+
+    // Load the reference image to compare each frame with, if requested. Every frame is compared
+    // with the same reference, since only the noise differs between frames.
+    ImageComparer comparer;
+    if (!referencePath.empty())
+    {
+        if (!comparer.load(referencePath))
+        {
+            std::cerr << comparer.error() << std::endl;
+            return 1;
+        }
+        if (comparer.width() != settings.renderWidth()
+            || comparer.height() != settings.renderHeight())
+        {
+            std::cerr
+                << "The reference image is " << comparer.width() << "x" << comparer.height()
+                << ", not " << settings.renderWidth() << "x" << settings.renderHeight() << "."
+                << std::endl;
+            return 1;
+        }
+    }
+
+    // Path statistics are only collected when requested, and only for local rendering.
+    if (reportPaths && !coordinatorAddress.empty())
+    {
+        std::cerr << "Path statistics are not available for distributed rendering." << std::endl;
+    }
+
+    for (uint32_t frame = firstFrame; frame <= lastFrame; frame++)
+    {
+        // Get the settings for the frame, with the output path for the frame.
+        RenderSettings frameSettings = settings.getFrameSettings(frame);
+        const string checkpointPath = frameSettings.getCheckpointPath();
+        if (settings.animated)
+        {
+            std::cout
+                << "Frame " << frame << " (" << frame - firstFrame + 1 << " of "
+                << lastFrame - firstFrame + 1 << "):" << std::endl;
+        }
+
+        // When resuming an animation, skip frames that have been saved, i.e. that have an output
+        // file and no checkpoint, and render frames without a checkpoint from the start.
+        bool resumeFrame = resume;
+        if (resume && settings.animated && !std::filesystem::exists(checkpointPath))
+        {
+            if (std::filesystem::exists(frameSettings.outputPath))
+            {
+                std::cout << "Already saved \"" << frameSettings.outputPath << "\"." << std::endl;
+                continue;
+            }
+            resumeFrame = false;
+        }
+
+        // Create the framebuffer for the rendered radiance, i.e. the crop window or the whole
+        // image, stored in a temporary file if requested, or reuse it from an earlier frame. The
+        // second framebuffer has a separate temporary file.
+        const uint32_t bufferIndex = (frame - firstFrame) % 2;
+        std::unique_ptr<Framebuffer>& pFramebuffer = pFramebuffers[bufferIndex];
+        if (!frameSettings.spillPath.empty() && bufferIndex > 0)
+        {
+            frameSettings.spillPath += "." + std::to_string(bufferIndex);
+        }
+        if (!pFramebuffer)
+        {
+            shared_ptr<MappedFile> pSpillFile;
+            if (!frameSettings.spillPath.empty())
+            {
+                pSpillFile = MappedFile::create(frameSettings.spillPath,
+                    Framebuffer::dataSize(settings.renderWidth(), settings.renderHeight()), true);
+                if (!pSpillFile)
+                {
+                    std::cerr
+                        << "Unable to create \"" << frameSettings.spillPath << "\"." << std::endl;
+                    return 1;
+                }
+            }
+            pFramebuffer.reset(
+                new Framebuffer(settings.renderWidth(), settings.renderHeight(), pSpillFile));
+        }
+        else
+        {
+            pFramebuffer->clearSampleCounts();
+        }
+        Framebuffer& framebuffer = *pFramebuffer;
+
+        // Load the checkpoint into the framebuffer if resuming a render, and start saving
+        // checkpoints while rendering if requested.
+        std::unique_ptr<CheckpointWriter> pCheckpointWriter;
+        if (useCheckpoints)
+        {
+            Checkpoint checkpoint(frameSettings, sceneHash);
+            if (resumeFrame)
+            {
+                if (!checkpoint.load(checkpointPath, framebuffer))
+                {
+                    std::cerr << checkpoint.error() << std::endl;
+                    return 1;
+                }
+                std::cout << "Resuming from \"" << checkpointPath << "\"." << std::endl;
+            }
+            if (settings.checkpointInterval > 0.0)
+            {
+                pCheckpointWriter.reset(new CheckpointWriter(
+                    checkpoint, checkpointPath, settings.checkpointInterval, framebuffer));
+            }
+        }
+
+        // Render the scene with the camera, to the framebuffer with the specified settings, or
+        // have worker processes render it if requested.
+        RenderStats stats;
+        if (!coordinatorAddress.empty())
+        {
+            if (!coordinator.render(
+                coordinatorAddress, framebuffer, frameSettings, sceneHash, frame < lastFrame))
+            {
+                std::cerr << coordinator.error() << std::endl;
+                return 1;
+            }
+            stats = coordinator.stats();
+        }
+        else
+        {
+            PathStats pathStats;
+            stats = render(scene, camera, framebuffer, frameSettings, true, pCostMap.get(),
+                pAOVBuffer.get(), reportPaths ? &pathStats : nullptr);
+            if (reportPaths)
+            {
+                pathStats.report(std::cout);
+            }
+        }
+        pCheckpointWriter.reset();
+
+        // Save the AOVs, and denoise the image guided by the AOVs.
+        for (AOV aov : pAOVBuffer ? settings.aovs : vector<AOV>())
+        {
+            if (!saveAOV(*pAOVBuffer, aov, frameSettings))
+            {
+                std::cerr
+                    << "Unable to save \"" << frameSettings.getAOVPath(aov) << "\"." << std::endl;
+                return 1;
+            }
+        }
+        if (pAOVBuffer && settings.denoise)
+        {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            Denoiser(settings.denoisePasses).denoise(framebuffer, *pAOVBuffer);
+            auto endTime = std::chrono::high_resolution_clock::now();
+            std::cout
+                << std::setprecision(3) << "Denoised in "
+                << std::chrono::duration<double>(endTime - startTime).count() << " seconds."
+                << std::endl;
+        }
+        if (pAOVBuffer)
+        {
+            pAOVBuffer->clear();
+        }
+
+        // Report the error compared with the reference image, including the equal-time error,
+        // which uses the time spent rendering (so it is only meaningful without a checkpoint).
+        if (!referencePath.empty())
+        {
+            const ImageErrors errors = comparer.compare(framebuffer);
+            std::cout
+                << std::setprecision(4)
+                << "Compared with \"" << referencePath << "\": RMSE " << errors.rmse
+                << ", relMSE " << errors.relMSE << ", PSNR " << errors.psnr << " dB, FLIP "
+                << errors.flip << ", equal-time relMSE x seconds "
+                << errors.equalTimeError(stats.seconds) << "." << std::endl;
+        }
+
+        // Save the heatmap, and report the mean and maximum cost of the pixels. Pixels restored
+        // from a checkpoint were not rendered, so they have no cost.
+        if (pCostMap)
+        {
+            const CostMetric metric = frameSettings.heatmapMetric;
+            if (!saveHeatmap(*pCostMap, frameSettings))
+            {
+                std::cerr
+                    << "Unable to save \"" << frameSettings.getHeatmapPath() << "\"." << std::endl;
+                return 1;
+            }
+            std::cout
+                << std::setprecision(4) << "Cost per pixel (" << costMetricName(metric)
+                << "): mean " << pCostMap->getMean(metric) << ", max " << pCostMap->getMax(metric)
+                << ", saved to \"" << frameSettings.getHeatmapPath() << "\"." << std::endl;
+            pCostMap->clear();
+        }
+
+        // Start saving the output image, and then delete the checkpoint, which is no longer needed
+        // once the output image has been saved.
+        outputWriter.save(framebuffer, frameSettings, useCheckpoints ? checkpointPath : string());
+    }
+
+    // Wait for the last output image to be saved.
+    if (!outputWriter.finish())
+    {
+        std::cerr << outputWriter.error() << std::endl;
+        return 1;
+    }
+    if (settings.animated)
+    {
+        std::cout
+            << std::setprecision(3)
+            << "Saved " << outputWriter.savedCount() << " frames, in " << outputWriter.seconds()
+            << " seconds on a background thread." << std::endl;
+    }
 }
@@ -19,6 +19,11 @@
 #include <thread>
 #include <vector>
 
+// Windows headers, without the min() and max() macros which conflict with the STL.
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
 // Make certain names from the std namespace accessible.
 using std::make_shared;
 using std::shared_ptr;